@@ -0,0 +1,140 @@
+#include <iostream>
+
+#include <generelle/modelling.hpp>
+
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace gn = generelle;
+namespace sg = generelle::StaticGeometry;
+
+// Compares batched evaluation, which runs the AVX kernels on CPUs that have them, against evaluating each point
+// alone with the scalar code. The two must agree bit for bit, so any difference is reported as a failure
+
+struct Case {
+    std::string name;
+    gn::GE ge;
+};
+
+static bool sameBits(float a, float b) {
+    if (std::isnan(a) && std::isnan(b)) {
+        return true;
+    }
+    return std::memcmp(&a, &b, sizeof(float)) == 0;
+}
+
+// Returns the number of points where the batched and the scalar distance differ
+static int checkCase(const Case& c, const std::vector<float>& xs, const std::vector<float>& ys,
+                     const std::vector<float>& zs) {
+    size_t n = xs.size();
+    std::vector<float> batched(n);
+    c.ge.signedDistBatch(xs.data(), ys.data(), zs.data(), batched.data(), n);
+
+    int mismatches = 0;
+    for (size_t i = 0; i < n; i++) {
+        float scalar = c.ge.signedDist(falg::Vec3(xs[i], ys[i], zs[i]));
+        if (!sameBits(scalar, batched[i])) {
+            if (mismatches == 0) {
+                std::cerr << c.name << ": at (" << xs[i] << ", " << ys[i] << ", " << zs[i] << ") scalar gives "
+                          << scalar << ", batched gives " << batched[i] << std::endl;
+            }
+            mismatches++;
+        }
+    }
+
+    return mismatches;
+}
+
+int main() {
+    gn::GE sphere = gn::makeSphere(0.8f);
+    gn::GE box = gn::makeBox(falg::Vec3(0.6f, -0.4f, 0.9f));
+    gn::GE cylinder = gn::makeCylinder(0.5f, 1.6f);
+
+    std::vector<gn::GE> spheres;
+    std::mt19937 placement(7);
+    std::uniform_real_distribution<float> offset(-2.0f, 2.0f);
+    for (int i = 0; i < 40; i++) {
+        falg::Vec3 d(offset(placement), offset(placement), offset(placement));
+        spheres.push_back(gn::makeSphere(0.1f + 0.01f * i).translate(d));
+    }
+    gn::GE scene = gn::makeUnion(spheres).smoothAdd(box.scale(falg::Vec3(1.5f, 0.5f, -2.0f)), 0.3f)
+        .subtract(cylinder.translate(falg::Vec3(0.3f, 0.0f, 0.2f)));
+
+    gn::ExpressionArena arena;
+    int arena_root = arena.smoothAdd(arena.translate(arena.sphere(0.8f), falg::Vec3(0.5f, 0.0f, 0.0f)),
+                                     arena.scale(arena.subtract(arena.box(falg::Vec3(0.6f, 0.4f, 0.9f)),
+                                                                arena.cylinder(0.5f, 1.6f)),
+                                                 falg::Vec3(1.5f, 0.5f, -2.0f)),
+                                     0.3f);
+    int arena_mixed = arena.intersect(arena.pad(arena.leaf(scene), 0.1f),
+                                      arena.inverse(arena.scale(arena.sphere(0.3f), 2.0f)));
+
+    auto static_model = sg::Sphere(0.8f).translate(falg::Vec3(0.5f, 0.0f, 0.0f))
+        .smoothAdd(sg::Box(falg::Vec3(0.6f, 0.4f, 0.9f)).subtract(sg::Cylinder(0.5f, 1.6f))
+                   .scale(falg::Vec3(1.5f, 0.5f, -2.0f)), 0.3f)
+        .intersect(sg::Sphere(0.3f).scale(2.0f).inverse()).pad(0.1f);
+
+    std::vector<Case> cases = {
+        { "sphere", sphere },
+        { "box", box },
+        { "cylinder", cylinder },
+        { "add", sphere.add(box) },
+        { "subtract", box.subtract(cylinder) },
+        { "intersect", sphere.intersect(cylinder) },
+        { "smooth add", sphere.smoothAdd(cylinder, 0.4f) },
+        { "pad", box.pad(0.2f) },
+        { "inverse", cylinder.inverse() },
+        { "translate", sphere.translate(falg::Vec3(0.5f, -0.3f, 0.2f)) },
+        { "uniform scale", box.scale(1.7f) },
+        { "negative uniform scale", box.scale(-0.6f) },
+        { "non-uniform scale", sphere.scale(falg::Vec3(2.0f, 3.0f, 4.0f)) },
+        { "mirroring scale", cylinder.scale(falg::Vec3(-1.0f, 0.5f, 2.0f)) },
+        { "union", gn::makeUnion(spheres) },
+        { "multi intersect", sphere.intersect(box).intersect(cylinder).intersect(sphere.pad(-0.1f)).optimize() },
+        { "scene", scene },
+        { "optimized scene", scene.optimize() },
+        { "compiled scene", scene.compile() },
+        { "baked scene", scene.bake(0.05f, 1.5f) },
+        { "arena", arena.expression(arena_root) },
+        { "arena with leaf", arena.expression(arena_mixed) },
+        { "static", static_model.expression() },
+    };
+
+    // Points on a grid through the origin hit the special cases, random points cover the rest. The count is
+    // not a multiple of the vector width or the batch chunk size, so the scalar tails are checked as well
+    std::vector<float> xs, ys, zs;
+    for (int i = -4; i <= 4; i++) {
+        for (int j = -4; j <= 4; j++) {
+            for (int k = -4; k <= 4; k++) {
+                xs.push_back(0.4f * i);
+                ys.push_back(0.4f * j);
+                zs.push_back(0.4f * k);
+            }
+        }
+    }
+
+    std::mt19937 rng(3);
+    std::uniform_real_distribution<float> coordinate(-3.0f, 3.0f);
+    for (int i = 0; i < 5003; i++) {
+        xs.push_back(coordinate(rng));
+        ys.push_back(coordinate(rng));
+        zs.push_back(coordinate(rng));
+    }
+
+    int failed = 0;
+    for (const Case& c : cases) {
+        int mismatches = checkCase(c, xs, ys, zs);
+        if (mismatches > 0) {
+            std::cout << "FAIL " << c.name << ": " << mismatches << " of " << xs.size() << " points differ" << std::endl;
+            failed++;
+        } else {
+            std::cout << "ok   " << c.name << std::endl;
+        }
+    }
+
+    std::cout << (cases.size() - failed) << " of " << cases.size() << " expressions match" << std::endl;
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,97 @@
+#include <iostream>
+
+#include <generelle/modelling.hpp>
+
+#include <cmath>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace gn = generelle;
+
+// Compares signedDistGrad against central differences of signedDist. The expressions are smooth away from a few
+// points, so the two must agree closely. The points include ties of smooth unions, where both children are at
+// the same distance, as every point on the symmetry plane of a symmetric blend is
+
+struct Case {
+    std::string name;
+    gn::GE ge;
+};
+
+static const float difference_step = 1e-3f;
+static const float tolerance = 1e-2f;
+
+static falg::Vec3 centralDifference(const gn::GE& ge, const falg::Vec3& pos) {
+    falg::Vec3 grad;
+    for (int d = 0; d < 3; d++) {
+        falg::Vec3 offset(0.0f, 0.0f, 0.0f);
+        offset[d] = difference_step;
+        grad[d] = (ge.signedDist(pos + offset) - ge.signedDist(pos - offset)) / (2 * difference_step);
+    }
+    return grad;
+}
+
+// Returns the number of points where the gradient is off
+static int checkCase(const Case& c, const std::vector<falg::Vec3>& points) {
+    int mismatches = 0;
+    for (const falg::Vec3& pos : points) {
+        falg::Vec3 grad;
+        c.ge.signedDistGrad(pos, grad);
+        falg::Vec3 expected = centralDifference(c.ge, pos);
+
+        if (!((grad - expected).norm() <= tolerance)) {
+            if (mismatches == 0) {
+                std::cerr << c.name << ": at (" << pos.x() << ", " << pos.y() << ", " << pos.z() << ") gradient is ("
+                          << grad.x() << ", " << grad.y() << ", " << grad.z() << "), differences give ("
+                          << expected.x() << ", " << expected.y() << ", " << expected.z() << ")" << std::endl;
+            }
+            mismatches++;
+        }
+    }
+
+    return mismatches;
+}
+
+int main() {
+    gn::GE left = gn::makeSphere(1.0f).translate(falg::Vec3(-0.8f, 0.0f, 0.0f));
+    gn::GE right = gn::makeSphere(1.0f).translate(falg::Vec3(0.8f, 0.0f, 0.0f));
+    gn::GE blend = left.smoothAdd(right, 0.5f);
+    gn::GE swapped = right.smoothAdd(left, 0.5f);
+
+    std::vector<Case> cases = {
+        { "smooth add", blend },
+        { "swapped smooth add", swapped },
+        { "uneven smooth add", gn::makeSphere(0.7f).smoothAdd(gn::makeSphere(0.4f).scale(1.5f)
+                                                              .translate(falg::Vec3(0.3f, 0.6f, -0.2f)), 0.4f) },
+        { "padded smooth add", blend.pad(0.2f) },
+        { "inverted smooth add", blend.inverse() },
+        { "scaled smooth add", blend.scale(0.6f).translate(falg::Vec3(0.1f, -0.2f, 0.3f)) },
+        { "nested smooth add", blend.smoothAdd(gn::makeSphere(0.5f).translate(falg::Vec3(0.0f, 1.2f, 0.0f)), 0.3f) },
+    };
+
+    // Ties on the symmetry plane x = 0 of the blends, then random points
+    std::vector<falg::Vec3> points;
+    std::mt19937 rng(5);
+    std::uniform_real_distribution<float> coordinate(-2.0f, 2.0f);
+    points.push_back(falg::Vec3(0.0f, 0.9f, 0.3f));
+    for (int i = 0; i < 200; i++) {
+        points.push_back(falg::Vec3(0.0f, coordinate(rng), coordinate(rng)));
+    }
+    for (int i = 0; i < 1000; i++) {
+        points.push_back(falg::Vec3(coordinate(rng), coordinate(rng), coordinate(rng)));
+    }
+
+    int failed = 0;
+    for (const Case& c : cases) {
+        int mismatches = checkCase(c, points);
+        if (mismatches > 0) {
+            std::cout << "FAIL " << c.name << ": " << mismatches << " of " << points.size() << " points differ" << std::endl;
+            failed++;
+        } else {
+            std::cout << "ok   " << c.name << std::endl;
+        }
+    }
+
+    std::cout << (cases.size() - failed) << " of " << cases.size() << " gradients match" << std::endl;
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,79 @@
+#include <iostream>
+
+#include <generelle/modelling.hpp>
+#include "../src/modelling/algebraic/marching_cubes.hpp"
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace gn = generelle;
+
+// Compares the chunks of marchingCubesStreamed, concatenated, against marchingCubesIndexed. The two must give the
+// same vertices in the same order and the same triangles, including at the default span of constructMeshStreamed,
+// where the lattice has billions of cells along each axis
+
+struct Case {
+    std::string name;
+    gn::GE ge;
+    float span;
+    int chunk_cells;
+};
+
+static bool samePositions(const std::vector<falg::Vec3>& a, const std::vector<falg::Vec3>& b) {
+    return a.size() == b.size() && std::memcmp(a.data(), b.data(), a.size() * sizeof(falg::Vec3)) == 0;
+}
+
+static bool checkCase(const Case& c) {
+    // As constructMeshStreamed does at its default resolution
+    const float target_span = 0.05f;
+    const falg::Vec3 mid(0.0f, 0.0f, 0.0f);
+
+    std::vector<falg::Vec3> positions;
+    std::vector<unsigned int> indices;
+    gn::MarchingCubes::marchingCubesIndexed(c.ge, positions, indices, target_span, c.span, mid);
+
+    std::vector<falg::Vec3> streamed_positions;
+    std::vector<unsigned int> streamed_indices;
+    gn::MarchingCubes::marchingCubesStreamed(c.ge, [&](const std::vector<falg::Vec3>& chunk_positions,
+                                                       const std::vector<unsigned int>& chunk_indices) {
+        streamed_positions.insert(streamed_positions.end(), chunk_positions.begin(), chunk_positions.end());
+        streamed_indices.insert(streamed_indices.end(), chunk_indices.begin(), chunk_indices.end());
+    }, target_span, c.span, mid, c.chunk_cells);
+
+    if (!samePositions(positions, streamed_positions) || indices != streamed_indices) {
+        std::cerr << c.name << ": indexed gives " << positions.size() << " vertices and " << indices.size() / 3
+                  << " triangles, streamed gives " << streamed_positions.size() << " vertices and "
+                  << streamed_indices.size() / 3 << " triangles" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+int main() {
+    gn::GE sphere = gn::makeSphere(1.0f);
+    gn::GE scene = gn::makeBox(falg::Vec3(0.8f, 0.3f, 0.6f)).translate(falg::Vec3(0.4f, -0.2f, 0.1f))
+        .smoothAdd(gn::makeCylinder(0.3f, 2.0f).translate(falg::Vec3(-0.5f, 0.3f, 0.0f)), 0.3f);
+
+    std::vector<Case> cases = {
+        { "sphere, small span", sphere, 4.0f, 8 },
+        { "sphere, default span", sphere, 1e8f, 8 },
+        { "sphere, default span and chunks", sphere, 1e8f, 128 },
+        { "scene, small span", scene, 4.0f, 16 },
+        { "scene, default span", scene, 1e8f, 16 },
+    };
+
+    int failed = 0;
+    for (const Case& c : cases) {
+        if (checkCase(c)) {
+            std::cout << "ok   " << c.name << std::endl;
+        } else {
+            std::cout << "FAIL " << c.name << std::endl;
+            failed++;
+        }
+    }
+
+    std::cout << (cases.size() - failed) << " of " << cases.size() << " meshes match" << std::endl;
+    return failed == 0 ? 0 : 1;
+}
@@ -3,3 +3,5 @@
 #include "../../src/modelling/algebraic/algebraic.hpp"
 #include "../../src/modelling/algebraic/shapes.hpp"
 #include "../../src/modelling/algebraic/mesh_constructor.hpp"
+#include "../../src/modelling/algebraic/static_geometry.hpp"
+#include "../../src/modelling/algebraic/arena.hpp"
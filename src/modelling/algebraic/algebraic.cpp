@@ -1,6 +1,10 @@
 #include "algebraic.hpp"
 #include "operations.hpp"
 #include "transformations.hpp"
+#include "compiled.hpp"
+#include "brick_map.hpp"
+#include "expression_pool.hpp"
+#include "simplifier.hpp"
 
 #include <algorithm>
 
@@ -11,15 +15,54 @@ namespace generelle {
      */
 
     falg::Vec3 InnerGeometricExpression::normal(const falg::Vec3& pos) const {
+        falg::Vec3 grad;
+        this->signedDistGrad(pos, grad);
+        return grad.normalized();
+    }
+
+    float InnerGeometricExpression::signedDistGrad(const falg::Vec3& pos, falg::Vec3& grad) const {
         float epsilon = 1e-5;
 
-        falg::Vec3 v;
         for(int i = 0; i < 3; i++) {
             falg::Vec3 diff(0.0f, 0.0f, 0.0f);
             diff[i] = epsilon;
-            v[i] = this->signedDist(pos + diff) - this->signedDist(pos - diff);
+            grad[i] = (this->signedDist(pos + diff) - this->signedDist(pos - diff)) / (2 * epsilon);
+        }
+        return this->signedDist(pos);
+    }
+
+    void InnerGeometricExpression::signedDistBatch(const float* xs, const float* ys, const float* zs,
+                                                   float* out, size_t n) const {
+        for (size_t i = 0; i < n; i++) {
+            out[i] = this->signedDist(falg::Vec3(xs[i], ys[i], zs[i]));
         }
-        return v.normalized();
+    }
+
+    Interval InnerGeometricExpression::signedDistInterval(const IntervalBox& box) const {
+        float dist = this->signedDist(box.center());
+        float radius = box.halfDiagonal();
+        return Interval(dist - radius, dist + radius);
+    }
+
+    IGE InnerGeometricExpression::specialize(const IGE& self, const IntervalBox& box, Interval& range) const {
+        range = this->signedDistInterval(box);
+        return self;
+    }
+
+    int InnerGeometricExpression::compile(TapeBuilder& builder, int pos) const {
+        return builder.emitCall(this, pos);
+    }
+
+    bool InnerGeometricExpression::bounds(falg::Vec3&, falg::Vec3&) const {
+        return false;
+    }
+
+    IGE InnerGeometricExpression::deduplicate(const IGE& self, ExpressionPool&) const {
+        return self;
+    }
+
+    IGE InnerGeometricExpression::simplify(const IGE& self, Simplifier&) const {
+        return self;
     }
 
     InnerGeometricExpression::~InnerGeometricExpression() { }
@@ -44,6 +87,50 @@ namespace generelle {
         return this->ige->normal(pos);
     }
 
+    float GeometricExpression::signedDistGrad(const falg::Vec3& pos, falg::Vec3& grad) const {
+        return this->ige->signedDistGrad(pos, grad);
+    }
+
+    void GeometricExpression::signedDistBatch(const float* xs, const float* ys, const float* zs,
+                                              float* out, size_t n) const {
+        this->ige->signedDistBatch(xs, ys, zs, out, n);
+    }
+
+    Interval GeometricExpression::signedDistInterval(const IntervalBox& box) const {
+        return this->ige->signedDistInterval(box);
+    }
+
+    GE GeometricExpression::specialize(const IntervalBox& box, Interval& range) const {
+        return GeometricExpression(this->ige->specialize(this->ige, box, range));
+    }
+
+    bool GeometricExpression::bounds(falg::Vec3& min, falg::Vec3& max) const {
+        return this->ige->bounds(min, max);
+    }
+
+    GE GeometricExpression::deduplicate() const {
+        ExpressionPool pool;
+        return GeometricExpression(pool.deduplicate(this->ige));
+    }
+
+    GE GeometricExpression::optimize() const {
+        Simplifier simplifier;
+        ExpressionPool pool;
+        return GeometricExpression(pool.deduplicate(simplifier.simplify(this->ige)));
+    }
+
+    GE GeometricExpression::compile() const {
+        // Shared subtrees are compiled once, so deduplicate first
+        ExpressionPool pool;
+        IGE ige(new GCompiled(pool.deduplicate(this->ige)));
+        return GeometricExpression(ige);
+    }
+
+    GE GeometricExpression::bake(float voxel_size, float span, const falg::Vec3& mid) const {
+        IGE ige(new GBrickMap(this->ige, voxel_size, span, mid));
+        return GeometricExpression(ige);
+    }
+
     GeometricExpression GeometricExpression::add(const GeometricExpression& ge) const {
         IGE ige(new GAdd(this->ige, ge.ige));
 
@@ -1,13 +1,22 @@
 #pragma once
 
 #include "declarations.hpp"
+#include "interval.hpp"
 
 #include <FlatAlg.hpp>
 
 #include <memory>
+#include <vector>
 
 namespace generelle {
 
+    /*
+     * Batched evaluation is done in chunks of this many points, so that nodes needing
+     * temporary buffers can keep them on the stack
+     */
+
+    static const size_t batch_chunk_size = 64;
+
     /*
      * InnerGeometricExpression - A base class for
      */
@@ -15,8 +24,45 @@ namespace generelle {
     class InnerGeometricExpression {
     public:
         virtual float signedDist(const falg::Vec3& pos) const = 0;
+
+        // Normalized gradient of signedDist. The default implementation normalizes signedDistGrad
         virtual falg::Vec3 normal(const falg::Vec3& pos) const;
 
+        // Returns signedDist and stores its gradient in grad, computed alongside the distance in one pass
+        // The default implementation uses central differences
+        virtual float signedDistGrad(const falg::Vec3& pos, falg::Vec3& grad) const;
+
+        // Evaluates signedDist for n points given as separate coordinate arrays (SoA)
+        // The default implementation calls signedDist once per point
+        virtual void signedDistBatch(const float* xs, const float* ys, const float* zs,
+                                     float* out, size_t n) const;
+
+        // Returns an interval guaranteed to contain signedDist at every point in the box
+        // The default implementation assumes the node is an exact SDF (1-Lipschitz)
+        virtual Interval signedDistInterval(const IntervalBox& box) const;
+
+        // Returns an expression equal to this one inside the box, where branches that cannot affect the
+        // result there are removed. Stores signedDistInterval(box) in range. self must own this node
+        // The default implementation returns self unchanged
+        virtual IGE specialize(const IGE& self, const IntervalBox& box, Interval& range) const;
+
+        // Emits tape instructions computing signedDist at the point with SSA id pos, returns the SSA id
+        // of the result. The default implementation emits a call back into this node
+        virtual int compile(TapeBuilder& builder, int pos) const;
+
+        // Stores an axis-aligned box in min and max such that signedDist at any point outside the box is at least
+        // the distance to the box, or returns false if there is no such box. The default implementation returns false
+        virtual bool bounds(falg::Vec3& min, falg::Vec3& max) const;
+
+        // Returns the node of the pool equal to this one, after deduplicating the children. self must own this node
+        // The default implementation returns self unchanged, so the node is only shared where it already was
+        virtual IGE deduplicate(const IGE& self, ExpressionPool& pool) const;
+
+        // Returns an expression equal to this one up to rounding, with chained transformations folded and nested
+        // unions and intersections flattened. Children are simplified through simplifier. self must own this node
+        // The default implementation returns self unchanged
+        virtual IGE simplify(const IGE& self, Simplifier& simplifier) const;
+
         virtual ~InnerGeometricExpression() = 0;
 
         friend class GeometricExpression;
@@ -35,6 +81,27 @@ namespace generelle {
 
         float signedDist(const falg::Vec3& pos) const;
         falg::Vec3 normal(const falg::Vec3& pos) const;
+        float signedDistGrad(const falg::Vec3& pos, falg::Vec3& grad) const;
+        void signedDistBatch(const float* xs, const float* ys, const float* zs,
+                             float* out, size_t n) const;
+        Interval signedDistInterval(const IntervalBox& box) const;
+        GeometricExpression specialize(const IntervalBox& box, Interval& range) const;
+        bool bounds(falg::Vec3& min, falg::Vec3& max) const;
+
+        // Merges structurally equal subtrees into shared nodes. Evaluation gives the same results
+        GeometricExpression deduplicate() const;
+
+        // Simplifies, then deduplicates the expression, giving a smaller tree that evaluates faster. Results
+        // are equal up to rounding
+        GeometricExpression optimize() const;
+
+        // Lowers the expression tree into a linear tape, the result evaluates faster but is otherwise equivalent
+        // Equal subexpressions evaluated at the same point are computed once
+        GeometricExpression compile() const;
+
+        // Samples the expression near its surface inside the cube mid +- span into a sparse voxel cache, with
+        // voxels of at most voxel_size. The result interpolates the samples, and is evaluated as before outside the cube
+        GeometricExpression bake(float voxel_size, float span, const falg::Vec3& mid = falg::Vec3(0.0f, 0.0f, 0.0f)) const;
 
         GeometricExpression pad(float padding) const;
         GeometricExpression inverse() const;
@@ -47,5 +114,12 @@ namespace generelle {
         GeometricExpression translate(const falg::Vec3& d) const;
         GeometricExpression scale(const falg::Vec3& scale) const;
         GeometricExpression scale(float scale) const;
+
+        friend GeometricExpression makeUnion(const std::vector<GeometricExpression>& ges);
+        friend class ExpressionArena;
     };
+
+    // The union of all the expressions. Children are kept in a bounding volume hierarchy, so evaluation
+    // only visits children whose bounds are closer than the nearest surface found so far
+    GeometricExpression makeUnion(const std::vector<GeometricExpression>& ges);
 };
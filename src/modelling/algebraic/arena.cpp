@@ -0,0 +1,388 @@
+#include "arena.hpp"
+#include "shapes.hpp"
+#include "operations.hpp"
+#include "transformations.hpp"
+#include "kernels.hpp"
+#include "compiled.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace generelle {
+
+    /*
+     * ExpressionArena member functions
+     */
+
+    int ExpressionArena::push(ArenaOp op, int a, int b, std::initializer_list<float> params) {
+        ArenaNode node = { op, a, b, { } };
+        std::copy(params.begin(), params.end(), node.params);
+
+        this->nodes.push_back(node);
+        return this->nodes.size() - 1;
+    }
+
+    void ExpressionArena::reserve(size_t num_nodes) {
+        this->nodes.reserve(num_nodes);
+    }
+
+    void ExpressionArena::clear() {
+        this->nodes.clear();
+        this->leaves.clear();
+    }
+
+    int ExpressionArena::sphere(float radius) {
+        return this->push(ARENA_SPHERE, -1, -1, { radius });
+    }
+
+    int ExpressionArena::box(const falg::Vec3& span) {
+        return this->push(ARENA_BOX, -1, -1, { std::abs(span.x()), std::abs(span.y()), std::abs(span.z()) });
+    }
+
+    int ExpressionArena::cylinder(float radius, float length) {
+        return this->push(ARENA_CYLINDER, -1, -1, { radius, length / 2 });
+    }
+
+    int ExpressionArena::leaf(const GeometricExpression& ge) {
+        this->leaves.push_back(ge.ige);
+        return this->push(ARENA_LEAF, this->leaves.size() - 1, -1, { });
+    }
+
+    int ExpressionArena::add(int a, int b) {
+        return this->push(ARENA_ADD, a, b, { });
+    }
+
+    int ExpressionArena::subtract(int a, int b) {
+        return this->intersect(a, this->inverse(b));
+    }
+
+    int ExpressionArena::smoothAdd(int a, int b, float k) {
+        return this->push(ARENA_SMOOTH_ADD, a, b, { k });
+    }
+
+    int ExpressionArena::intersect(int a, int b) {
+        return this->push(ARENA_INTERSECT, a, b, { });
+    }
+
+    int ExpressionArena::pad(int a, float padding) {
+        return this->push(ARENA_PAD, a, -1, { padding });
+    }
+
+    int ExpressionArena::inverse(int a) {
+        return this->push(ARENA_INVERSE, a, -1, { });
+    }
+
+    int ExpressionArena::translate(int a, const falg::Vec3& d) {
+        return this->push(ARENA_TRANSLATE, a, -1, { d.x(), d.y(), d.z() });
+    }
+
+    int ExpressionArena::scale(int a, const falg::Vec3& scale) {
+        return this->push(ARENA_NON_UNIFORM_SCALE, a, -1, { scale.x(), scale.y(), scale.z(),
+                                                             1.0f / scale.x(), 1.0f / scale.y(), 1.0f / scale.z() });
+    }
+
+    int ExpressionArena::scale(int a, float scale) {
+        return this->push(ARENA_UNIFORM_SCALE, a, -1, { scale, 1.0f / scale });
+    }
+
+    GeometricExpression ExpressionArena::expression(int node) const {
+        // Copy the nodes reachable from node, keeping their order so that children stay before parents
+        std::vector<int> remap(node + 1, -1);
+        std::vector<int> stack = { node };
+        remap[node] = 0;
+
+        while (!stack.empty()) {
+            const ArenaNode& n = this->nodes[stack.back()];
+            stack.pop_back();
+
+            bool has_children = n.op != ARENA_LEAF && n.a >= 0;
+            for (int child : { has_children ? n.a : -1, n.b }) {
+                if (child >= 0 && remap[child] < 0) {
+                    remap[child] = 0;
+                    stack.push_back(child);
+                }
+            }
+        }
+
+        std::vector<ArenaNode> used;
+        std::vector<IGE> used_leaves;
+        for (int i = 0; i <= node; i++) {
+            if (remap[i] < 0) {
+                continue;
+            }
+
+            ArenaNode n = this->nodes[i];
+            if (n.op == ARENA_LEAF) {
+                used_leaves.push_back(this->leaves[n.a]);
+                n.a = used_leaves.size() - 1;
+            } else {
+                n.a = n.a >= 0 ? remap[n.a] : -1;
+                n.b = n.b >= 0 ? remap[n.b] : -1;
+            }
+
+            remap[i] = used.size();
+            used.push_back(n);
+        }
+
+        return GeometricExpression(new GArena(std::move(used), std::move(used_leaves)));
+    }
+
+
+    /*
+     * GArena member functions
+     */
+
+    GArena::GArena(std::vector<ArenaNode>&& nodes, std::vector<IGE>&& leaves)
+        : nodes(std::move(nodes)), leaves(std::move(leaves)) {
+        this->functions.reserve(this->nodes.size());
+        for (const ArenaNode& node : this->nodes) {
+            this->functions.push_back(dist_functions[node.op]);
+        }
+    }
+
+    inline float GArena::signedDistAt(int node, float x, float y, float z) const {
+        return this->functions[node](*this, node, x, y, z);
+    }
+
+    // Same arithmetic as the corresponding tree nodes. Each operation calls its children through its own call
+    // site, so the indirect calls are predicted as well as the virtual calls of the tree
+    template<ArenaOp op>
+    float GArena::signedDistOp(const GArena& arena, int node, float x, float y, float z) {
+        const ArenaNode& n = arena.nodes[node];
+        const float* p = n.params;
+
+        if constexpr (op == ARENA_SPHERE) {
+            return Kernels::sphereDist(x, y, z, p[0]);
+        } else if constexpr (op == ARENA_BOX) {
+            return Kernels::boxDist(x, y, z, p[0], p[1], p[2]);
+        } else if constexpr (op == ARENA_CYLINDER) {
+            return Kernels::cylinderDist(x, y, z, p[0], p[1]);
+        } else if constexpr (op == ARENA_ADD) {
+            return std::min(arena.signedDistAt(n.a, x, y, z), arena.signedDistAt(n.b, x, y, z));
+        } else if constexpr (op == ARENA_SMOOTH_ADD) {
+            return Kernels::smoothMin(arena.signedDistAt(n.a, x, y, z), arena.signedDistAt(n.b, x, y, z), p[0]);
+        } else if constexpr (op == ARENA_INTERSECT) {
+            return std::max(arena.signedDistAt(n.a, x, y, z), arena.signedDistAt(n.b, x, y, z));
+        } else if constexpr (op == ARENA_PAD) {
+            return arena.signedDistAt(n.a, x, y, z) - p[0];
+        } else if constexpr (op == ARENA_INVERSE) {
+            return - arena.signedDistAt(n.a, x, y, z);
+        } else if constexpr (op == ARENA_TRANSLATE) {
+            return arena.signedDistAt(n.a, x - p[0], y - p[1], z - p[2]);
+        } else if constexpr (op == ARENA_NON_UNIFORM_SCALE) {
+            float nx = x * p[3], ny = y * p[4], nz = z * p[5];
+            return Kernels::backScale(x, y, z, nx, ny, nz, Kernels::backScaleAtOrigin(p[0], p[1], p[2])) *
+                arena.signedDistAt(n.a, nx, ny, nz);
+        } else if constexpr (op == ARENA_UNIFORM_SCALE) {
+            return p[0] * arena.signedDistAt(n.a, p[1] * x, p[1] * y, p[1] * z);
+        } else {
+            return arena.leaves[n.a]->signedDist(falg::Vec3(x, y, z));
+        }
+    }
+
+    // Indexed by ArenaOp
+    const GArena::DistFunction GArena::dist_functions[] = {
+        &GArena::signedDistOp<ARENA_SPHERE>,
+        &GArena::signedDistOp<ARENA_BOX>,
+        &GArena::signedDistOp<ARENA_CYLINDER>,
+        &GArena::signedDistOp<ARENA_ADD>,
+        &GArena::signedDistOp<ARENA_SMOOTH_ADD>,
+        &GArena::signedDistOp<ARENA_INTERSECT>,
+        &GArena::signedDistOp<ARENA_PAD>,
+        &GArena::signedDistOp<ARENA_INVERSE>,
+        &GArena::signedDistOp<ARENA_TRANSLATE>,
+        &GArena::signedDistOp<ARENA_NON_UNIFORM_SCALE>,
+        &GArena::signedDistOp<ARENA_UNIFORM_SCALE>,
+        &GArena::signedDistOp<ARENA_LEAF>
+    };
+
+    // Evaluates at most batch_chunk_size points
+    void GArena::signedDistChunk(int node, const float* xs, const float* ys, const float* zs,
+                                 float* out, size_t n) const {
+        const ArenaNode& nd = this->nodes[node];
+        const float* p = nd.params;
+        float tmp[batch_chunk_size];
+        float txs[batch_chunk_size], tys[batch_chunk_size], tzs[batch_chunk_size];
+
+        switch (nd.op) {
+        case ARENA_SPHERE:
+            Kernels::sphereDist(xs, ys, zs, out, n, p[0]);
+            break;
+        case ARENA_BOX:
+            Kernels::boxDist(xs, ys, zs, out, n, p[0], p[1], p[2]);
+            break;
+        case ARENA_CYLINDER:
+            Kernels::cylinderDist(xs, ys, zs, out, n, p[0], p[1]);
+            break;
+        case ARENA_ADD:
+        case ARENA_SMOOTH_ADD:
+        case ARENA_INTERSECT:
+            this->signedDistChunk(nd.a, xs, ys, zs, out, n);
+            this->signedDistChunk(nd.b, xs, ys, zs, tmp, n);
+
+            if (nd.op == ARENA_ADD) {
+                Kernels::minInPlace(out, tmp, n);
+            } else if (nd.op == ARENA_INTERSECT) {
+                Kernels::maxInPlace(out, tmp, n);
+            } else {
+                Kernels::smoothMinInPlace(out, tmp, n, p[0]);
+            }
+            break;
+        case ARENA_PAD:
+            this->signedDistChunk(nd.a, xs, ys, zs, out, n);
+            Kernels::affineInPlace(out, n, 1.0f, - p[0]);
+            break;
+        case ARENA_INVERSE:
+            this->signedDistChunk(nd.a, xs, ys, zs, out, n);
+            Kernels::scaleInPlace(out, n, -1.0f);
+            break;
+        case ARENA_TRANSLATE:
+            Kernels::transformPoints(xs, ys, zs, txs, tys, tzs, n, 1.0f, 1.0f, 1.0f, - p[0], - p[1], - p[2]);
+            this->signedDistChunk(nd.a, txs, tys, tzs, out, n);
+            break;
+        case ARENA_NON_UNIFORM_SCALE:
+            Kernels::transformPoints(xs, ys, zs, txs, tys, tzs, n, p[3], p[4], p[5], 0.0f, 0.0f, 0.0f);
+            this->signedDistChunk(nd.a, txs, tys, tzs, out, n);
+            Kernels::backScaleInPlace(xs, ys, zs, txs, tys, tzs, out, n, Kernels::backScaleAtOrigin(p[0], p[1], p[2]));
+            break;
+        case ARENA_UNIFORM_SCALE:
+            Kernels::transformPoints(xs, ys, zs, txs, tys, tzs, n, p[1], p[1], p[1], 0.0f, 0.0f, 0.0f);
+            this->signedDistChunk(nd.a, txs, tys, tzs, out, n);
+            Kernels::scaleInPlace(out, n, p[0]);
+            break;
+        case ARENA_LEAF:
+            this->leaves[nd.a]->signedDistBatch(xs, ys, zs, out, n);
+            break;
+        }
+    }
+
+    int GArena::compileAt(int node, TapeBuilder& builder, int pos) const {
+        const ArenaNode& n = this->nodes[node];
+        const float* p = n.params;
+
+        switch (n.op) {
+        case ARENA_SPHERE:
+            return builder.emitSphere(pos, p[0]);
+        case ARENA_BOX:
+            return builder.emitBox(pos, falg::Vec3(p[0], p[1], p[2]));
+        case ARENA_CYLINDER:
+            return builder.emitCylinder(pos, p[0], p[1]);
+        case ARENA_ADD:
+            return builder.emitMin(this->compileAt(n.a, builder, pos), this->compileAt(n.b, builder, pos));
+        case ARENA_SMOOTH_ADD:
+            return builder.emitSmoothMin(this->compileAt(n.a, builder, pos), this->compileAt(n.b, builder, pos), p[0]);
+        case ARENA_INTERSECT:
+            return builder.emitMax(this->compileAt(n.a, builder, pos), this->compileAt(n.b, builder, pos));
+        case ARENA_PAD:
+            return builder.emitAffine(this->compileAt(n.a, builder, pos), 1.0f, - p[0]);
+        case ARENA_INVERSE:
+            return builder.emitAffine(this->compileAt(n.a, builder, pos), -1.0f, 0.0f);
+        case ARENA_TRANSLATE: {
+            int npos = builder.emitTransform(pos, falg::Vec3(1.0f, 1.0f, 1.0f), - falg::Vec3(p[0], p[1], p[2]));
+            return this->compileAt(n.a, builder, npos);
+        }
+        case ARENA_NON_UNIFORM_SCALE: {
+            int npos = builder.emitTransform(pos, falg::Vec3(p[3], p[4], p[5]), falg::Vec3(0.0f, 0.0f, 0.0f));
+            return builder.emitBackScale(this->compileAt(n.a, builder, npos), pos, npos,
+                                         Kernels::backScaleAtOrigin(p[0], p[1], p[2]));
+        }
+        case ARENA_UNIFORM_SCALE: {
+            int npos = builder.emitTransform(pos, falg::Vec3(p[1], p[1], p[1]), falg::Vec3(0.0f, 0.0f, 0.0f));
+            return builder.emitAffine(this->compileAt(n.a, builder, npos), p[0], 0.0f);
+        }
+        case ARENA_LEAF:
+            return builder.compile(this->leaves[n.a].get(), pos);
+        }
+
+        return -1;
+    }
+
+    // Builds the expression tree equal to the nodes, sharing the subtrees that are shared in the arena
+    const IGE& GArena::getTree() const {
+        std::call_once(this->tree_built, [this]() {
+            std::vector<IGE> trees(this->nodes.size());
+
+            for (unsigned int i = 0; i < this->nodes.size(); i++) {
+                const ArenaNode& n = this->nodes[i];
+                const float* p = n.params;
+
+                switch (n.op) {
+                case ARENA_SPHERE:
+                    trees[i] = IGE(new Sphere(p[0]));
+                    break;
+                case ARENA_BOX:
+                    trees[i] = IGE(new Box(falg::Vec3(p[0], p[1], p[2])));
+                    break;
+                case ARENA_CYLINDER:
+                    trees[i] = IGE(new Cylinder(p[0], 2 * p[1]));
+                    break;
+                case ARENA_ADD:
+                    trees[i] = IGE(new GAdd(trees[n.a], trees[n.b]));
+                    break;
+                case ARENA_SMOOTH_ADD:
+                    trees[i] = IGE(new GSmoothAdd(trees[n.a], trees[n.b], p[0]));
+                    break;
+                case ARENA_INTERSECT:
+                    trees[i] = IGE(new GIntersect(trees[n.a], trees[n.b]));
+                    break;
+                case ARENA_PAD:
+                    trees[i] = IGE(new GPad(trees[n.a], p[0]));
+                    break;
+                case ARENA_INVERSE:
+                    trees[i] = IGE(new GInverse(trees[n.a]));
+                    break;
+                case ARENA_TRANSLATE:
+                    trees[i] = IGE(new GTranslate(trees[n.a], falg::Vec3(p[0], p[1], p[2])));
+                    break;
+                case ARENA_NON_UNIFORM_SCALE:
+                    trees[i] = IGE(new GNonUniformScale(trees[n.a], falg::Vec3(p[0], p[1], p[2])));
+                    break;
+                case ARENA_UNIFORM_SCALE:
+                    trees[i] = IGE(new GUniformScale(trees[n.a], p[0]));
+                    break;
+                case ARENA_LEAF:
+                    trees[i] = this->leaves[n.a];
+                    break;
+                }
+            }
+
+            this->tree = trees.back();
+        });
+
+        return this->tree;
+    }
+
+    float GArena::signedDist(const falg::Vec3& pos) const {
+        return this->signedDistAt(this->nodes.size() - 1, pos.x(), pos.y(), pos.z());
+    }
+
+    float GArena::signedDistGrad(const falg::Vec3& pos, falg::Vec3& grad) const {
+        return this->getTree()->signedDistGrad(pos, grad);
+    }
+
+    void GArena::signedDistBatch(const float* xs, const float* ys, const float* zs,
+                                 float* out, size_t n) const {
+        for (size_t base = 0; base < n; base += batch_chunk_size) {
+            size_t m = std::min(batch_chunk_size, n - base);
+            this->signedDistChunk(this->nodes.size() - 1, xs + base, ys + base, zs + base, out + base, m);
+        }
+    }
+
+    Interval GArena::signedDistInterval(const IntervalBox& box) const {
+        return this->getTree()->signedDistInterval(box);
+    }
+
+    IGE GArena::specialize(const IGE& self, const IntervalBox& box, Interval& range) const {
+        const IGE& tree = this->getTree();
+        IGE specialized = tree->specialize(tree, box, range);
+        return specialized == tree ? self : specialized;
+    }
+
+    int GArena::compile(TapeBuilder& builder, int pos) const {
+        return this->compileAt(this->nodes.size() - 1, builder, pos);
+    }
+
+    bool GArena::bounds(falg::Vec3& min, falg::Vec3& max) const {
+        return this->getTree()->bounds(min, max);
+    }
+};
@@ -0,0 +1,120 @@
+#pragma once
+
+#include "algebraic.hpp"
+
+#include <FlatAlg.hpp>
+
+#include <initializer_list>
+#include <mutex>
+#include <vector>
+
+namespace generelle {
+
+    /*
+     * ArenaOp - node types of an ExpressionArena, mirroring the expression tree nodes
+     */
+
+    enum ArenaOp {
+        ARENA_SPHERE,             // params: radius
+        ARENA_BOX,                // params: absolute half edge lengths
+        ARENA_CYLINDER,           // params: radius, half length
+        ARENA_ADD,                // min(a, b)
+        ARENA_SMOOTH_ADD,         // smoothMin(a, b), params: k
+        ARENA_INTERSECT,          // max(a, b)
+        ARENA_PAD,                // a - params[0]
+        ARENA_INVERSE,            // -a
+        ARENA_TRANSLATE,          // a at the point minus params[0..2]
+        ARENA_NON_UNIFORM_SCALE,  // params: scale, inverse scale
+        ARENA_UNIFORM_SCALE,      // params: scale, inverse scale
+        ARENA_LEAF                // leaves[a], an arbitrary expression
+    };
+
+    struct ArenaNode {
+        ArenaOp op;
+        int a, b;
+        float params[6];
+    };
+
+
+    /*
+     * ExpressionArena - builds models as flat arrays of nodes, with children referred to by index
+     *
+     * Nodes are stored contiguously in the order they are created, which puts children before their parents.
+     * There is no allocation per node and no reference counting, and clear() keeps the storage for the next
+     * model. All functions take and return node indices
+     */
+
+    class ExpressionArena {
+        std::vector<ArenaNode> nodes;
+        std::vector<IGE> leaves;
+
+        int push(ArenaOp op, int a, int b, std::initializer_list<float> params);
+
+    public:
+        void reserve(size_t num_nodes);
+
+        // Removes all nodes, keeping the allocated storage
+        void clear();
+
+        int sphere(float radius);
+        int box(const falg::Vec3& span);
+        int cylinder(float radius, float length);
+
+        // Uses an existing expression as a node
+        int leaf(const GeometricExpression& ge);
+
+        int add(int a, int b);
+        int subtract(int a, int b);
+        int smoothAdd(int a, int b, float k = 0.5f);
+        int intersect(int a, int b);
+        int pad(int a, float padding);
+        int inverse(int a);
+
+        int translate(int a, const falg::Vec3& d);
+        int scale(int a, const falg::Vec3& scale);
+        int scale(int a, float scale);
+
+        // The model rooted at node, as an expression. Copies the nodes it uses, so the arena may be changed after
+        GeometricExpression expression(int node) const;
+    };
+
+
+    /*
+     * GArena - a model from an ExpressionArena. Distances are computed directly from the node array, the
+     * equivalent expression tree is built on first use for the other operations
+     */
+
+    class GArena : public InnerGeometricExpression {
+        // Nodes with the root last
+        std::vector<ArenaNode> nodes;
+        std::vector<IGE> leaves;
+
+        // Distance function of each node, chosen by its operation
+        typedef float (*DistFunction)(const GArena& arena, int node, float x, float y, float z);
+        std::vector<DistFunction> functions;
+        static const DistFunction dist_functions[];
+
+        mutable std::once_flag tree_built;
+        mutable IGE tree;
+
+        template<ArenaOp op>
+        static float signedDistOp(const GArena& arena, int node, float x, float y, float z);
+        float signedDistAt(int node, float x, float y, float z) const;
+        void signedDistChunk(int node, const float* xs, const float* ys, const float* zs, float* out, size_t n) const;
+        int compileAt(int node, TapeBuilder& builder, int pos) const;
+
+        const IGE& getTree() const;
+
+    public:
+        GArena(std::vector<ArenaNode>&& nodes, std::vector<IGE>&& leaves);
+
+        virtual float signedDist(const falg::Vec3& pos) const;
+        virtual float signedDistGrad(const falg::Vec3& pos, falg::Vec3& grad) const;
+        virtual void signedDistBatch(const float* xs, const float* ys, const float* zs,
+                                     float* out, size_t n) const;
+        virtual Interval signedDistInterval(const IntervalBox& box) const;
+        virtual IGE specialize(const IGE& self, const IntervalBox& box, Interval& range) const;
+        virtual int compile(TapeBuilder& builder, int pos) const;
+        virtual bool bounds(falg::Vec3& min, falg::Vec3& max) const;
+    };
+};
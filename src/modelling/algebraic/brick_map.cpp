@@ -0,0 +1,277 @@
+#include "brick_map.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace generelle {
+
+    // Voxels per side of a brick, a brick stores one more sample per side
+    static const int brick_voxels = 8;
+    static const int brick_samples = brick_voxels + 1;
+
+    // Leaves whose distance may be within this many voxels of zero are sampled
+    static const float band_voxels = 2.0f;
+
+    static falg::Vec3 childMid(const falg::Vec3& mid, float child_span, int child) {
+        return mid + child_span * falg::Vec3(2 * (child / 4) - 1.0f, 2 * ((child / 2) % 2) - 1.0f, 2 * (child % 2) - 1.0f);
+    }
+
+
+    /*
+     * GBrickMap member functions
+     */
+
+    GBrickMap::GBrickMap(const IGE& source, float voxel_size, float span, const falg::Vec3& mid)
+        : source(source), mid(mid), span(span) {
+
+        // Halve the cube until bricks have voxels no larger than voxel_size
+        int levels = 0;
+        float leaf_span = span;
+        while (2 * leaf_span > brick_voxels * voxel_size) {
+            leaf_span /= 2;
+            levels++;
+        }
+        this->voxel_size = 2 * leaf_span / brick_voxels;
+
+        this->nodes.push_back(Node { Interval(), -1, -1 });
+        this->build(0, source, span, mid, levels, band_voxels * this->voxel_size);
+    }
+
+    void GBrickMap::build(int node, const IGE& local, float node_span, const falg::Vec3& node_mid, int levels, float band) {
+        Interval range;
+        IGE specialized = local->specialize(local, IntervalBox(node_mid, node_span), range);
+        this->nodes[node] = Node { range, -1, -1 };
+
+        if (range.lo > band || range.hi < - band) {
+            return;
+        }
+
+        if (levels > 0) {
+            int first = this->nodes.size();
+            this->nodes[node].children = first;
+            this->nodes.resize(first + 8);
+
+            for (int c = 0; c < 8; c++) {
+                this->build(first + c, specialized, node_span / 2, childMid(node_mid, node_span / 2, c), levels - 1, band);
+            }
+
+            // The children bound the values returned below this node tighter than the interval did
+            Interval children_range = this->nodes[first].range;
+            for (int c = 1; c < 8; c++) {
+                children_range = IntervalMath::hull(children_range, this->nodes[first + c].range);
+            }
+            this->nodes[node].range = children_range;
+            return;
+        }
+
+        // Sample the brick, one z-row at a time
+        int brick = this->samples.size() / (brick_samples * brick_samples * brick_samples);
+        size_t base = this->samples.size();
+        this->samples.resize(base + brick_samples * brick_samples * brick_samples);
+
+        falg::Vec3 node_min = node_mid - falg::Vec3(node_span, node_span, node_span);
+        float xs[brick_samples], ys[brick_samples], zs[brick_samples];
+        for (int x = 0; x < brick_samples; x++) {
+            for (int y = 0; y < brick_samples; y++) {
+                for (int z = 0; z < brick_samples; z++) {
+                    xs[z] = node_min.x() + x * this->voxel_size;
+                    ys[z] = node_min.y() + y * this->voxel_size;
+                    zs[z] = node_min.z() + z * this->voxel_size;
+                }
+                specialized->signedDistBatch(xs, ys, zs,
+                                             &this->samples[base + (x * brick_samples + y) * brick_samples],
+                                             brick_samples);
+            }
+        }
+
+        // The interpolated distances lie between the smallest and largest sample
+        auto minmax = std::minmax_element(this->samples.begin() + base, this->samples.end());
+        this->nodes[node].range = Interval(*minmax.first, *minmax.second);
+        this->nodes[node].brick = brick;
+    }
+
+    bool GBrickMap::inside(const falg::Vec3& pos) const {
+        falg::Vec3 d = pos - this->mid;
+        return std::abs(d.x()) <= this->span && std::abs(d.y()) <= this->span && std::abs(d.z()) <= this->span;
+    }
+
+    const GBrickMap::Node& GBrickMap::findLeaf(const falg::Vec3& pos, falg::Vec3& leaf_min) const {
+        int node = 0;
+        float node_span = this->span;
+        falg::Vec3 node_mid = this->mid;
+
+        while (this->nodes[node].children >= 0) {
+            int child = (pos.x() >= node_mid.x()) * 4 + (pos.y() >= node_mid.y()) * 2 + (pos.z() >= node_mid.z());
+            node_span /= 2;
+            node_mid = childMid(node_mid, node_span, child);
+            node = this->nodes[node].children + child;
+        }
+
+        leaf_min = node_mid - falg::Vec3(node_span, node_span, node_span);
+        return this->nodes[node];
+    }
+
+    float GBrickMap::lookup(const falg::Vec3& pos, falg::Vec3* grad) const {
+        if (!this->inside(pos)) {
+            return grad ? this->source->signedDistGrad(pos, *grad) : this->source->signedDist(pos);
+        }
+
+        falg::Vec3 leaf_min;
+        const Node& leaf = this->findLeaf(pos, leaf_min);
+
+        if (leaf.brick < 0) {
+            // Only a bound is stored here, far from the surface. Normals are not expected to be needed
+            // this far out, so the gradient is taken from the source
+            if (grad) {
+                this->source->signedDistGrad(pos, *grad);
+            }
+            return leaf.range.lo > 0 ? leaf.range.lo : leaf.range.hi;
+        }
+
+        // Voxel containing pos, and the position within it
+        int v[3];
+        float f[3];
+        for (int i = 0; i < 3; i++) {
+            float local = (pos[i] - leaf_min[i]) / this->voxel_size;
+            v[i] = std::min(std::max((int)std::floor(local), 0), brick_voxels - 1);
+            f[i] = std::min(std::max(local - v[i], 0.0f), 1.0f);
+        }
+
+        const float* s = &this->samples[leaf.brick * brick_samples * brick_samples * brick_samples];
+        auto sample = [s, &v](int dx, int dy, int dz) {
+            return s[((v[0] + dx) * brick_samples + v[1] + dy) * brick_samples + v[2] + dz];
+        };
+
+        // Interpolate along z, then y, then x, keeping the derivatives
+        float c[2][2], dcz[2][2];
+        for (int dx = 0; dx < 2; dx++) {
+            for (int dy = 0; dy < 2; dy++) {
+                float s0 = sample(dx, dy, 0), s1 = sample(dx, dy, 1);
+                c[dx][dy] = s0 + (s1 - s0) * f[2];
+                dcz[dx][dy] = s1 - s0;
+            }
+        }
+
+        float b[2], dby[2], dbz[2];
+        for (int dx = 0; dx < 2; dx++) {
+            b[dx] = c[dx][0] + (c[dx][1] - c[dx][0]) * f[1];
+            dby[dx] = c[dx][1] - c[dx][0];
+            dbz[dx] = dcz[dx][0] + (dcz[dx][1] - dcz[dx][0]) * f[1];
+        }
+
+        if (grad) {
+            *grad = falg::Vec3(b[1] - b[0],
+                               dby[0] + (dby[1] - dby[0]) * f[0],
+                               dbz[0] + (dbz[1] - dbz[0]) * f[0]) / this->voxel_size;
+        }
+        return b[0] + (b[1] - b[0]) * f[0];
+    }
+
+    float GBrickMap::signedDist(const falg::Vec3& pos) const {
+        return this->lookup(pos, nullptr);
+    }
+
+    float GBrickMap::signedDistGrad(const falg::Vec3& pos, falg::Vec3& grad) const {
+        return this->lookup(pos, &grad);
+    }
+
+    void GBrickMap::signedDistBatch(const float* xs, const float* ys, const float* zs,
+                                    float* out, size_t n) const {
+        // Points outside the cube are gathered and evaluated by the source in one batch per chunk
+        float oxs[batch_chunk_size], oys[batch_chunk_size], ozs[batch_chunk_size], odists[batch_chunk_size];
+        size_t outside[batch_chunk_size];
+
+        for (size_t base = 0; base < n; base += batch_chunk_size) {
+            size_t m = std::min(batch_chunk_size, n - base);
+            size_t num_outside = 0;
+
+            for (size_t i = base; i < base + m; i++) {
+                falg::Vec3 pos(xs[i], ys[i], zs[i]);
+                if (this->inside(pos)) {
+                    out[i] = this->lookup(pos, nullptr);
+                } else {
+                    oxs[num_outside] = xs[i];
+                    oys[num_outside] = ys[i];
+                    ozs[num_outside] = zs[i];
+                    outside[num_outside++] = i;
+                }
+            }
+
+            if (num_outside > 0) {
+                this->source->signedDistBatch(oxs, oys, ozs, odists, num_outside);
+                for (size_t i = 0; i < num_outside; i++) {
+                    out[outside[i]] = odists[i];
+                }
+            }
+        }
+    }
+
+    void GBrickMap::intervalOver(int node, float node_span, const falg::Vec3& node_mid,
+                                 const IntervalBox& box, Interval& range, bool& found) const {
+        if (box.x.hi < node_mid.x() - node_span || box.x.lo > node_mid.x() + node_span ||
+            box.y.hi < node_mid.y() - node_span || box.y.lo > node_mid.y() + node_span ||
+            box.z.hi < node_mid.z() - node_span || box.z.lo > node_mid.z() + node_span) {
+            return;
+        }
+
+        bool contained = box.x.lo <= node_mid.x() - node_span && box.x.hi >= node_mid.x() + node_span &&
+            box.y.lo <= node_mid.y() - node_span && box.y.hi >= node_mid.y() + node_span &&
+            box.z.lo <= node_mid.z() - node_span && box.z.hi >= node_mid.z() + node_span;
+
+        const Node& n = this->nodes[node];
+        if (n.brick >= 0 && !contained) {
+            // Only the voxels overlapping the box matter, and each interpolates between its corner samples
+            falg::Vec3 node_min = node_mid - falg::Vec3(node_span, node_span, node_span);
+            const Interval* axes[3] = { &box.x, &box.y, &box.z };
+            int lo[3], hi[3];
+            for (int i = 0; i < 3; i++) {
+                lo[i] = std::min(std::max((int)std::floor((axes[i]->lo - node_min[i]) / this->voxel_size), 0), brick_voxels - 1);
+                hi[i] = std::min(std::max((int)std::floor((axes[i]->hi - node_min[i]) / this->voxel_size), 0), brick_voxels - 1) + 1;
+            }
+
+            const float* s = &this->samples[n.brick * brick_samples * brick_samples * brick_samples];
+            Interval voxels(s[(lo[0] * brick_samples + lo[1]) * brick_samples + lo[2]]);
+            for (int x = lo[0]; x <= hi[0]; x++) {
+                for (int y = lo[1]; y <= hi[1]; y++) {
+                    for (int z = lo[2]; z <= hi[2]; z++) {
+                        float v = s[(x * brick_samples + y) * brick_samples + z];
+                        voxels = Interval(std::min(voxels.lo, v), std::max(voxels.hi, v));
+                    }
+                }
+            }
+
+            range = found ? IntervalMath::hull(range, voxels) : voxels;
+            found = true;
+            return;
+        }
+
+        if (n.children < 0 || contained) {
+            range = found ? IntervalMath::hull(range, n.range) : n.range;
+            found = true;
+            return;
+        }
+
+        for (int c = 0; c < 8; c++) {
+            this->intervalOver(n.children + c, node_span / 2, childMid(node_mid, node_span / 2, c), box, range, found);
+        }
+    }
+
+    Interval GBrickMap::signedDistInterval(const IntervalBox& box) const {
+        Interval range;
+        bool found = false;
+        this->intervalOver(0, this->span, this->mid, box, range, found);
+
+        bool box_inside = this->inside(falg::Vec3(box.x.lo, box.y.lo, box.z.lo)) &&
+            this->inside(falg::Vec3(box.x.hi, box.y.hi, box.z.hi));
+        if (!box_inside) {
+            Interval outside = this->source->signedDistInterval(box);
+            range = found ? IntervalMath::hull(range, outside) : outside;
+        }
+
+        return range;
+    }
+
+    size_t GBrickMap::getMemorySize() const {
+        return this->nodes.size() * sizeof(Node) + this->samples.size() * sizeof(float);
+    }
+};
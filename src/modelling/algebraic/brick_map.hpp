@@ -0,0 +1,64 @@
+#pragma once
+
+#include "algebraic.hpp"
+
+#include <FlatAlg.hpp>
+
+#include <vector>
+
+namespace generelle {
+
+    /*
+     * GBrickMap - an expression baked into a sparse voxel cache over the cube mid +- span
+     *
+     * The cube is subdivided as an octree. Where interval arithmetic shows the surface may be near, the leaves
+     * are bricks of sampled distances that are interpolated trilinearly. Other leaves store only an interval
+     * bounding the distance, and return its end closest to zero, which is a safe sphere tracing step. Outside
+     * the cube, the source expression is evaluated
+     */
+
+    class GBrickMap : public InnerGeometricExpression {
+        struct Node {
+            // Bounds every value returned inside the node
+            Interval range;
+
+            // Index of the first of eight consecutive children, or -1 for a leaf
+            int children;
+
+            // Index of the brick of a leaf, or -1 for leaves storing only range
+            int brick;
+        };
+
+        const IGE source;
+        falg::Vec3 mid;
+        float span;
+        float voxel_size;
+
+        std::vector<Node> nodes;
+        std::vector<float> samples;
+
+        void build(int node, const IGE& local, float node_span, const falg::Vec3& node_mid, int levels, float band);
+        bool inside(const falg::Vec3& pos) const;
+
+        // Finds the leaf containing pos, which must be inside the cube, and the minimum corner of the leaf
+        const Node& findLeaf(const falg::Vec3& pos, falg::Vec3& leaf_min) const;
+        // Also stores the gradient in grad, unless it is null
+        float lookup(const falg::Vec3& pos, falg::Vec3* grad) const;
+
+        void intervalOver(int node, float node_span, const falg::Vec3& node_mid,
+                          const IntervalBox& box, Interval& range, bool& found) const;
+
+    public:
+        // Bakes source with voxels of at most voxel_size
+        GBrickMap(const IGE& source, float voxel_size, float span, const falg::Vec3& mid);
+
+        virtual float signedDist(const falg::Vec3& pos) const;
+        virtual float signedDistGrad(const falg::Vec3& pos, falg::Vec3& grad) const;
+        virtual void signedDistBatch(const float* xs, const float* ys, const float* zs,
+                                     float* out, size_t n) const;
+        virtual Interval signedDistInterval(const IntervalBox& box) const;
+
+        // Memory used by the octree and bricks, in bytes
+        size_t getMemorySize() const;
+    };
+};
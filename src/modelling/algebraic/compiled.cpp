@@ -0,0 +1,362 @@
+#include "compiled.hpp"
+#include "kernels.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+namespace generelle {
+
+    // Register files up to this many floats live on the stack during evaluation
+    static const size_t stack_register_floats = 4096;
+
+
+    /*
+     * Tape member functions
+     */
+
+    void Tape::evaluateChunk(const float* xs, const float* ys, const float* zs, float* out,
+                             size_t n, float* registers, size_t lanes) const {
+        float* points = registers + this->num_value_registers * lanes;
+
+        auto value = [registers, lanes](int reg) { return registers + reg * lanes; };
+        auto px = [points, lanes](int reg) { return points + (3 * reg + 0) * lanes; };
+        auto py = [points, lanes](int reg) { return points + (3 * reg + 1) * lanes; };
+        auto pz = [points, lanes](int reg) { return points + (3 * reg + 2) * lanes; };
+
+        if (this->input_register >= 0) {
+            memcpy(px(this->input_register), xs, n * sizeof(float));
+            memcpy(py(this->input_register), ys, n * sizeof(float));
+            memcpy(pz(this->input_register), zs, n * sizeof(float));
+        }
+
+        for (const TapeInstruction& ins : this->instructions) {
+            float* o = value(ins.out);
+            const float* p = ins.params;
+
+            switch (ins.op) {
+            case TAPE_SPHERE:
+                Kernels::sphereDist(px(ins.p0), py(ins.p0), pz(ins.p0), o, n, p[0]);
+                break;
+            case TAPE_BOX:
+                Kernels::boxDist(px(ins.p0), py(ins.p0), pz(ins.p0), o, n, p[0], p[1], p[2]);
+                break;
+            case TAPE_CYLINDER:
+                Kernels::cylinderDist(px(ins.p0), py(ins.p0), pz(ins.p0), o, n, p[0], p[1]);
+                break;
+            case TAPE_MIN:
+            case TAPE_MAX:
+            case TAPE_SMOOTH_MIN:
+                // The output may alias operand a, but never operand b
+                if (o != value(ins.a)) {
+                    memcpy(o, value(ins.a), n * sizeof(float));
+                }
+
+                if (ins.op == TAPE_MIN) {
+                    Kernels::minInPlace(o, value(ins.b), n);
+                } else if (ins.op == TAPE_MAX) {
+                    Kernels::maxInPlace(o, value(ins.b), n);
+                } else {
+                    Kernels::smoothMinInPlace(o, value(ins.b), n, p[0]);
+                }
+                break;
+            case TAPE_AFFINE:
+                if (o != value(ins.a)) {
+                    memcpy(o, value(ins.a), n * sizeof(float));
+                }
+                Kernels::affineInPlace(o, n, p[0], p[1]);
+                break;
+            case TAPE_TRANSFORM:
+                Kernels::transformPoints(px(ins.p0), py(ins.p0), pz(ins.p0),
+                                         px(ins.out), py(ins.out), pz(ins.out), n,
+                                         p[0], p[1], p[2], p[3], p[4], p[5]);
+                break;
+            case TAPE_BACK_SCALE:
+                if (o != value(ins.a)) {
+                    memcpy(o, value(ins.a), n * sizeof(float));
+                }
+                Kernels::backScaleInPlace(px(ins.p0), py(ins.p0), pz(ins.p0),
+                                          px(ins.p1), py(ins.p1), pz(ins.p1), o, n, ins.params[0]);
+                break;
+            case TAPE_CALL:
+                this->calls[ins.a]->signedDistBatch(px(ins.p0), py(ins.p0), pz(ins.p0), o, n);
+                break;
+            }
+        }
+
+        memcpy(out, value(this->result_register), n * sizeof(float));
+    }
+
+    float Tape::signedDist(const falg::Vec3& pos) const {
+        float x = pos.x(), y = pos.y(), z = pos.z();
+        float res;
+        this->signedDistBatch(&x, &y, &z, &res, 1);
+        return res;
+    }
+
+    void Tape::signedDistBatch(const float* xs, const float* ys, const float* zs,
+                               float* out, size_t n) const {
+        size_t per_lane = this->num_value_registers + 3 * this->num_point_registers;
+        size_t lanes = std::min(n, batch_chunk_size);
+
+        float stack_registers[stack_register_floats];
+        std::vector<float> heap_registers;
+        float* registers = stack_registers;
+
+        if (per_lane * lanes > stack_register_floats) {
+            lanes = std::max(stack_register_floats / per_lane, (size_t)1);
+            if (per_lane * lanes > stack_register_floats) {
+                heap_registers.resize(per_lane * lanes);
+                registers = heap_registers.data();
+            }
+        }
+
+        for (size_t base = 0; base < n; base += lanes) {
+            size_t m = std::min(lanes, n - base);
+            this->evaluateChunk(xs + base, ys + base, zs + base, out + base, m, registers, lanes);
+        }
+    }
+
+    size_t Tape::getSize() const {
+        return this->instructions.size();
+    }
+
+
+    /*
+     * TapeBuilder member functions
+     */
+
+    TapeBuilder::TapeBuilder() {
+        // SSA id 0 is the input point
+        this->is_point.push_back(true);
+    }
+
+    int TapeBuilder::input() const {
+        return 0;
+    }
+
+    int TapeBuilder::push(const SsaInstruction& instruction, bool point_result) {
+        InstructionKey key = { instruction.instruction.op, instruction.instruction.a,
+                               (uint32_t)instruction.a, (uint32_t)instruction.b,
+                               (uint32_t)instruction.p0, (uint32_t)instruction.p1 };
+        memcpy(&key[6], instruction.instruction.params, sizeof(instruction.instruction.params));
+
+        auto it = this->numbered.find(key);
+        if (it != this->numbered.end()) {
+            return it->second;
+        }
+
+        SsaInstruction ins = instruction;
+        ins.out = this->is_point.size();
+        this->is_point.push_back(point_result);
+        this->instructions.push_back(ins);
+        this->numbered[key] = ins.out;
+        return ins.out;
+    }
+
+    int TapeBuilder::compile(const InnerGeometricExpression* node, int pos) {
+        // Nodes shared within the tree are walked once per point
+        auto key = std::make_pair(node, pos);
+        auto it = this->compiled.find(key);
+        if (it != this->compiled.end()) {
+            return it->second;
+        }
+
+        int result = node->compile(*this, pos);
+        this->compiled[key] = result;
+        return result;
+    }
+
+    int TapeBuilder::emitSphere(int pos, float radius) {
+        SsaInstruction ins = { { TAPE_SPHERE, 0, 0, 0, 0, 0, { radius } }, -1, -1, -1, pos, -1 };
+        return this->push(ins, false);
+    }
+
+    int TapeBuilder::emitBox(int pos, const falg::Vec3& span) {
+        SsaInstruction ins = { { TAPE_BOX, 0, 0, 0, 0, 0,
+                                 { std::abs(span.x()), std::abs(span.y()), std::abs(span.z()) } },
+                               -1, -1, -1, pos, -1 };
+        return this->push(ins, false);
+    }
+
+    int TapeBuilder::emitCylinder(int pos, float radius, float half_length) {
+        SsaInstruction ins = { { TAPE_CYLINDER, 0, 0, 0, 0, 0, { radius, half_length } }, -1, -1, -1, pos, -1 };
+        return this->push(ins, false);
+    }
+
+    int TapeBuilder::emitMin(int a, int b) {
+        SsaInstruction ins = { { TAPE_MIN, 0, 0, 0, 0, 0, { } }, -1, a, b, -1, -1 };
+        return this->push(ins, false);
+    }
+
+    int TapeBuilder::emitMax(int a, int b) {
+        SsaInstruction ins = { { TAPE_MAX, 0, 0, 0, 0, 0, { } }, -1, a, b, -1, -1 };
+        return this->push(ins, false);
+    }
+
+    int TapeBuilder::emitSmoothMin(int a, int b, float k) {
+        SsaInstruction ins = { { TAPE_SMOOTH_MIN, 0, 0, 0, 0, 0, { k } }, -1, a, b, -1, -1 };
+        return this->push(ins, false);
+    }
+
+    int TapeBuilder::emitAffine(int a, float scale, float offset) {
+        SsaInstruction ins = { { TAPE_AFFINE, 0, 0, 0, 0, 0, { scale, offset } }, -1, a, -1, -1, -1 };
+        return this->push(ins, false);
+    }
+
+    int TapeBuilder::emitTransform(int pos, const falg::Vec3& scale, const falg::Vec3& offset) {
+        SsaInstruction ins = { { TAPE_TRANSFORM, 0, 0, 0, 0, 0,
+                                 { scale.x(), scale.y(), scale.z(), offset.x(), offset.y(), offset.z() } },
+                               -1, -1, -1, pos, -1 };
+        return this->push(ins, true);
+    }
+
+    int TapeBuilder::emitBackScale(int a, int pos, int scaled_pos, float at_origin) {
+        SsaInstruction ins = { { TAPE_BACK_SCALE, 0, 0, 0, 0, 0, { at_origin } }, -1, a, -1, pos, scaled_pos };
+        return this->push(ins, false);
+    }
+
+    int TapeBuilder::emitCall(const InnerGeometricExpression* node, int pos) {
+        auto it = this->call_indices.find(node);
+        if (it == this->call_indices.end()) {
+            it = this->call_indices.emplace(node, this->calls.size()).first;
+            this->calls.push_back(node);
+        }
+
+        SsaInstruction ins = { { TAPE_CALL, 0, it->second, 0, 0, 0, { } }, -1, -1, -1, pos, -1 };
+        return this->push(ins, false);
+    }
+
+    Tape TapeBuilder::build(int result) const {
+        int num_ssa = this->is_point.size();
+
+        // Index of the last instruction reading each SSA value
+        std::vector<int> last_use(num_ssa, -1);
+        for (unsigned int i = 0; i < this->instructions.size(); i++) {
+            const SsaInstruction& ins = this->instructions[i];
+            for (int operand : { ins.a, ins.b, ins.p0, ins.p1 }) {
+                if (operand >= 0) {
+                    last_use[operand] = i;
+                }
+            }
+        }
+        last_use[result] = INT_MAX;
+
+        // Linear scan allocation, separately for value and point registers
+        std::vector<int> assigned(num_ssa, -1);
+        std::vector<int> free_registers[2];
+        int num_registers[2] = { 0, 0 };
+
+        auto allocate = [&](int ssa) {
+            std::vector<int>& free_list = free_registers[this->is_point[ssa]];
+            if (free_list.empty()) {
+                assigned[ssa] = num_registers[this->is_point[ssa]]++;
+            } else {
+                assigned[ssa] = free_list.back();
+                free_list.pop_back();
+            }
+        };
+
+        auto release = [&](int ssa) {
+            free_registers[this->is_point[ssa]].push_back(assigned[ssa]);
+        };
+
+        Tape tape;
+        tape.calls = this->calls;
+        tape.input_register = -1;
+
+        if (last_use[this->input()] >= 0) {
+            allocate(this->input());
+            tape.input_register = assigned[this->input()];
+        }
+
+        for (unsigned int i = 0; i < this->instructions.size(); i++) {
+            const SsaInstruction& ins = this->instructions[i];
+            TapeInstruction out_ins = ins.instruction;
+
+            int operands[4] = { ins.a, ins.b, ins.p0, ins.p1 };
+            uint16_t* fields[4] = { &out_ins.a, &out_ins.b, &out_ins.p0, &out_ins.p1 };
+            for (int j = 0; j < 4; j++) {
+                if (operands[j] >= 0) {
+                    *fields[j] = assigned[operands[j]];
+                }
+            }
+
+            // Release operands dying here before allocating the output, so that it may reuse their
+            // registers. Operand b is released afterwards, since the interpreter computes in place in a
+            auto releaseDying = [&](int first, int last) {
+                for (int j = first; j < last; j++) {
+                    bool repeated = false;
+                    for (int k = 0; k < j; k++) {
+                        repeated |= operands[k] == operands[j];
+                    }
+
+                    if (operands[j] >= 0 && !repeated && last_use[operands[j]] == (int)i) {
+                        release(operands[j]);
+                    }
+                }
+            };
+
+            std::swap(operands[1], operands[3]);
+            releaseDying(0, 3);
+
+            allocate(ins.out);
+            out_ins.out = assigned[ins.out];
+
+            releaseDying(3, 4);
+
+            if (last_use[ins.out] < 0) {
+                release(ins.out);
+            }
+
+            tape.instructions.push_back(out_ins);
+        }
+
+        tape.num_value_registers = num_registers[0];
+        tape.num_point_registers = num_registers[1];
+        tape.result_register = assigned[result];
+
+        return tape;
+    }
+
+
+    /*
+     * GCompiled member functions
+     */
+
+    GCompiled::GCompiled(const IGE& source) : source(source) {
+        TapeBuilder builder;
+        int result = builder.compile(source.get(), builder.input());
+        this->tape = builder.build(result);
+    }
+
+    float GCompiled::signedDist(const falg::Vec3& pos) const {
+        return this->tape.signedDist(pos);
+    }
+
+    float GCompiled::signedDistGrad(const falg::Vec3& pos, falg::Vec3& grad) const {
+        return this->source->signedDistGrad(pos, grad);
+    }
+
+    void GCompiled::signedDistBatch(const float* xs, const float* ys, const float* zs,
+                                    float* out, size_t n) const {
+        this->tape.signedDistBatch(xs, ys, zs, out, n);
+    }
+
+    Interval GCompiled::signedDistInterval(const IntervalBox& box) const {
+        return this->source->signedDistInterval(box);
+    }
+
+    IGE GCompiled::specialize(const IGE& self, const IntervalBox& box, Interval& range) const {
+        IGE specialized = this->source->specialize(this->source, box, range);
+        if (specialized == this->source) {
+            return self;
+        }
+
+        return IGE(new GCompiled(specialized));
+    }
+
+    bool GCompiled::bounds(falg::Vec3& min, falg::Vec3& max) const {
+        return this->source->bounds(min, max);
+    }
+};
@@ -0,0 +1,146 @@
+#pragma once
+
+#include "algebraic.hpp"
+
+#include <FlatAlg.hpp>
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <utility>
+#include <vector>
+
+namespace generelle {
+
+    /*
+     * TapeOp - operations of the tape interpreter. Value registers hold one distance per point,
+     * point registers hold one position per point
+     */
+
+    enum TapeOp : uint8_t {
+        TAPE_SPHERE,      // value out = sphere(point p0), params: radius
+        TAPE_BOX,         // value out = box(point p0), params: absolute half edge lengths
+        TAPE_CYLINDER,    // value out = cylinder(point p0), params: radius, half length
+        TAPE_MIN,         // value out = min(value a, value b)
+        TAPE_MAX,         // value out = max(value a, value b)
+        TAPE_SMOOTH_MIN,  // value out = smoothMin(value a, value b), params: k
+        TAPE_AFFINE,      // value out = value a * params[0] + params[1]
+        TAPE_TRANSFORM,   // point out = point p0 * params[0..2] + params[3..5]
+        TAPE_BACK_SCALE,  // value out = value a * backScale(point p0, point p1, params[0])
+        TAPE_CALL         // value out = calls[a]->signedDistBatch(point p0)
+    };
+
+    struct TapeInstruction {
+        TapeOp op;
+        uint16_t out, a, b, p0, p1;
+        float params[6];
+    };
+
+
+    /*
+     * Tape - a GeometricExpression lowered to a linear list of instructions on a small register file
+     */
+
+    class Tape {
+        std::vector<TapeInstruction> instructions;
+
+        // Nodes evaluated through TAPE_CALL. Not owned, the compiled expression keeps them alive
+        std::vector<const InnerGeometricExpression*> calls;
+
+        int num_value_registers;
+        int num_point_registers;
+        int input_register;
+        int result_register;
+
+        void evaluateChunk(const float* xs, const float* ys, const float* zs, float* out,
+                           size_t n, float* registers, size_t lanes) const;
+
+    public:
+        float signedDist(const falg::Vec3& pos) const;
+        void signedDistBatch(const float* xs, const float* ys, const float* zs,
+                             float* out, size_t n) const;
+
+        size_t getSize() const;
+
+        friend class TapeBuilder;
+    };
+
+
+    /*
+     * TapeBuilder - collects instructions in SSA form while the expression tree is walked,
+     * then assigns registers such that registers are reused once their value is dead
+     *
+     * Instructions equal to an earlier one are not emitted again, the earlier result is reused
+     *
+     * All emit functions take and return SSA ids
+     */
+
+    class TapeBuilder {
+        struct SsaInstruction {
+            TapeInstruction instruction;
+            int out, a, b, p0, p1;
+        };
+
+        std::vector<SsaInstruction> instructions;
+        std::vector<bool> is_point;
+        std::vector<const InnerGeometricExpression*> calls;
+
+        // Operation, call index, operands and parameter bits of an instruction
+        typedef std::array<uint32_t, 12> InstructionKey;
+
+        std::map<InstructionKey, int> numbered;
+        std::map<const InnerGeometricExpression*, uint16_t> call_indices;
+
+        // SSA id of the result of each node compiled at each point
+        std::map<std::pair<const InnerGeometricExpression*, int>, int> compiled;
+
+        int push(const SsaInstruction& instruction, bool point_result);
+
+    public:
+        TapeBuilder();
+
+        // The SSA id of the point the whole expression is evaluated at
+        int input() const;
+
+        // Compiles the given node at the given point, returns the SSA id of the resulting distance
+        int compile(const InnerGeometricExpression* node, int pos);
+
+        int emitSphere(int pos, float radius);
+        int emitBox(int pos, const falg::Vec3& span);
+        int emitCylinder(int pos, float radius, float half_length);
+
+        int emitMin(int a, int b);
+        int emitMax(int a, int b);
+        int emitSmoothMin(int a, int b, float k);
+        int emitAffine(int a, float scale, float offset);
+
+        int emitTransform(int pos, const falg::Vec3& scale, const falg::Vec3& offset);
+        int emitBackScale(int a, int pos, int scaled_pos, float at_origin);
+
+        // Fallback for nodes without a tape representation
+        int emitCall(const InnerGeometricExpression* node, int pos);
+
+        Tape build(int result) const;
+    };
+
+
+    /*
+     * GCompiled - evaluates an expression through its tape. The original tree is kept for the
+     * operations that the tape does not cover
+     */
+
+    class GCompiled : public InnerGeometricExpression {
+        const IGE source;
+        Tape tape;
+    public:
+        GCompiled(const IGE& source);
+
+        virtual float signedDist(const falg::Vec3& pos) const;
+        virtual float signedDistGrad(const falg::Vec3& pos, falg::Vec3& grad) const;
+        virtual void signedDistBatch(const float* xs, const float* ys, const float* zs,
+                                     float* out, size_t n) const;
+        virtual Interval signedDistInterval(const IntervalBox& box) const;
+        virtual IGE specialize(const IGE& self, const IntervalBox& box, Interval& range) const;
+        virtual bool bounds(falg::Vec3& min, falg::Vec3& max) const;
+    };
+};
@@ -5,6 +5,12 @@ namespace generelle {
 
     class InnerGeometricExpression;
 
+    class TapeBuilder;
+
+    class ExpressionPool;
+
+    class Simplifier;
+
     typedef GeometricExpression GE;
     typedef std::shared_ptr<InnerGeometricExpression> IGE;
 };
@@ -0,0 +1,867 @@
+#include "dual_contouring.hpp"
+#include "marching_cubes.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+namespace generelle {
+    namespace DualContouring {
+
+        // Cells along each axis of a densely sampled block at the bottom of the octree
+        static const int block_cells = 8;
+
+        // False position steps refining the surface crossing on an edge, and the distance, in cells, at which the
+        // crossing is considered found
+        static const int crossing_iterations = 8;
+        static const float crossing_tolerance = 1e-4f;
+
+        // Cells along each axis of the lattice probing a cube for planarity
+        static const int probe_cells = 4;
+
+        // Eigenvalues of the QEF below this fraction of the largest are treated as zero, which keeps vertices
+        // near the mass point along directions the tangent planes do not constrain
+        static const double qef_truncation = 0.1;
+
+
+        /*
+         * Octree tables, with children and corners numbered 4 * x + 2 * y + z
+         */
+
+        // The two corners of each cell edge, four edges along each axis
+        static const int edge_corners[12][2] = {
+            { 0, 4 }, { 1, 5 }, { 2, 6 }, { 3, 7 },
+            { 0, 2 }, { 1, 3 }, { 4, 6 }, { 5, 7 },
+            { 0, 1 }, { 2, 3 }, { 4, 5 }, { 6, 7 }
+        };
+
+        // Pairs of children sharing a face inside a cell, and the axis of the face normal
+        static const int cell_proc_faces[12][3] = {
+            { 0, 4, 0 }, { 1, 5, 0 }, { 2, 6, 0 }, { 3, 7, 0 },
+            { 0, 2, 1 }, { 4, 6, 1 }, { 1, 3, 1 }, { 5, 7, 1 },
+            { 0, 1, 2 }, { 2, 3, 2 }, { 4, 5, 2 }, { 6, 7, 2 }
+        };
+
+        // Groups of four children sharing an edge inside a cell, and the axis of the edge
+        static const int cell_proc_edges[6][5] = {
+            { 0, 1, 2, 3, 0 }, { 4, 5, 6, 7, 0 },
+            { 0, 4, 1, 5, 1 }, { 2, 6, 3, 7, 1 },
+            { 0, 2, 4, 6, 2 }, { 1, 3, 5, 7, 2 }
+        };
+
+        // For a face between two cells, the pairs of their children sharing a face
+        static const int face_proc_faces[3][4][3] = {
+            { { 4, 0, 0 }, { 5, 1, 0 }, { 6, 2, 0 }, { 7, 3, 0 } },
+            { { 2, 0, 1 }, { 6, 4, 1 }, { 3, 1, 1 }, { 7, 5, 1 } },
+            { { 1, 0, 2 }, { 3, 2, 2 }, { 5, 4, 2 }, { 7, 6, 2 } }
+        };
+
+        // For a face between two cells, the groups of four children sharing an edge: the order of the two cells,
+        // the child of each, and the axis of the edge
+        static const int face_proc_edges[3][4][6] = {
+            { { 1, 4, 0, 5, 1, 1 }, { 1, 6, 2, 7, 3, 1 }, { 0, 4, 6, 0, 2, 2 }, { 0, 5, 7, 1, 3, 2 } },
+            { { 0, 2, 3, 0, 1, 0 }, { 0, 6, 7, 4, 5, 0 }, { 1, 2, 0, 6, 4, 2 }, { 1, 3, 1, 7, 5, 2 } },
+            { { 1, 1, 0, 3, 2, 0 }, { 1, 5, 4, 7, 6, 0 }, { 0, 1, 5, 0, 4, 1 }, { 0, 3, 7, 2, 6, 1 } }
+        };
+
+        static const int face_edge_orders[2][4] = { { 0, 0, 1, 1 }, { 0, 1, 0, 1 } };
+
+        // For an edge between four cells, the two groups of their children sharing an edge
+        static const int edge_proc_edges[3][2][5] = {
+            { { 3, 2, 1, 0, 0 }, { 7, 6, 5, 4, 0 } },
+            { { 5, 1, 4, 0, 1 }, { 7, 3, 6, 2, 1 } },
+            { { 6, 4, 2, 0, 2 }, { 7, 5, 3, 1, 2 } }
+        };
+
+        // For an edge between four cells, the edge as numbered in each cell
+        static const int process_edges[3][4] = {
+            { 3, 2, 1, 0 }, { 7, 5, 6, 4 }, { 11, 10, 9, 8 }
+        };
+
+
+        /*
+         * Qef - the sum of squared distances to a set of planes, minimized to place cell vertices
+         */
+
+        struct Qef {
+            // Upper triangle of A^T A, in the order xx, xy, xz, yy, yz, zz, for planes n . x = n . p
+            double ata[6] = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+            double atb[3] = { 0.0, 0.0, 0.0 };
+            double btb = 0.0;
+
+            double mass[3] = { 0.0, 0.0, 0.0 };
+            int count = 0;
+
+            void add(const falg::Vec3& point, const falg::Vec3& normal) {
+                double n[3] = { normal.x(), normal.y(), normal.z() };
+                double b = n[0] * point.x() + n[1] * point.y() + n[2] * point.z();
+
+                ata[0] += n[0] * n[0]; ata[1] += n[0] * n[1]; ata[2] += n[0] * n[2];
+                ata[3] += n[1] * n[1]; ata[4] += n[1] * n[2];
+                ata[5] += n[2] * n[2];
+                for (int d = 0; d < 3; d++) {
+                    atb[d] += n[d] * b;
+                    mass[d] += point[d];
+                }
+                btb += b * b;
+                count++;
+            }
+
+            void merge(const Qef& other) {
+                for (int i = 0; i < 6; i++) {
+                    ata[i] += other.ata[i];
+                }
+                for (int d = 0; d < 3; d++) {
+                    atb[d] += other.atb[d];
+                    mass[d] += other.mass[d];
+                }
+                btb += other.btb;
+                count += other.count;
+            }
+
+            // The squared distance sum at x
+            double error(const double x[3]) const {
+                double ax[3] = { ata[0] * x[0] + ata[1] * x[1] + ata[2] * x[2],
+                                 ata[1] * x[0] + ata[3] * x[1] + ata[4] * x[2],
+                                 ata[2] * x[0] + ata[4] * x[1] + ata[5] * x[2] };
+                double e = btb;
+                for (int d = 0; d < 3; d++) {
+                    e += x[d] * ax[d] - 2 * x[d] * atb[d];
+                }
+                return std::max(e, 0.0);
+            }
+
+            // The minimizer closest to the mass point, through the truncated pseudo inverse of A^T A
+            void solve(double x[3]) const;
+        };
+
+        // Eigen decomposition of a symmetric matrix by Jacobi rotations. On return, a holds the eigenvalues on its
+        // diagonal, and the columns of v are the eigenvectors
+        static void symmetricEigen(double a[3][3], double v[3][3]) {
+            for (int i = 0; i < 3; i++) {
+                for (int j = 0; j < 3; j++) {
+                    v[i][j] = i == j ? 1.0 : 0.0;
+                }
+            }
+
+            for (int sweep = 0; sweep < 16; sweep++) {
+                double off = a[0][1] * a[0][1] + a[0][2] * a[0][2] + a[1][2] * a[1][2];
+                if (off < 1e-24) {
+                    break;
+                }
+
+                for (int p = 0; p < 2; p++) {
+                    for (int q = p + 1; q < 3; q++) {
+                        if (std::abs(a[p][q]) < 1e-30) {
+                            continue;
+                        }
+
+                        double theta = (a[q][q] - a[p][p]) / (2 * a[p][q]);
+                        double t = (theta >= 0 ? 1.0 : -1.0) / (std::abs(theta) + std::sqrt(theta * theta + 1));
+                        double c = 1 / std::sqrt(t * t + 1);
+                        double s = t * c;
+
+                        for (int k = 0; k < 3; k++) {
+                            double akp = a[k][p], akq = a[k][q];
+                            a[k][p] = c * akp - s * akq;
+                            a[k][q] = s * akp + c * akq;
+                        }
+                        for (int k = 0; k < 3; k++) {
+                            double apk = a[p][k], aqk = a[q][k];
+                            a[p][k] = c * apk - s * aqk;
+                            a[q][k] = s * apk + c * aqk;
+                        }
+                        for (int k = 0; k < 3; k++) {
+                            double vkp = v[k][p], vkq = v[k][q];
+                            v[k][p] = c * vkp - s * vkq;
+                            v[k][q] = s * vkp + c * vkq;
+                        }
+                    }
+                }
+            }
+        }
+
+        void Qef::solve(double x[3]) const {
+            double c[3];
+            for (int d = 0; d < 3; d++) {
+                c[d] = mass[d] / std::max(count, 1);
+            }
+
+            // Solve A^T A (x - c) = A^T b - A^T A c
+            double a[3][3] = { { ata[0], ata[1], ata[2] },
+                               { ata[1], ata[3], ata[4] },
+                               { ata[2], ata[4], ata[5] } };
+            double r[3];
+            for (int i = 0; i < 3; i++) {
+                r[i] = atb[i] - (a[i][0] * c[0] + a[i][1] * c[1] + a[i][2] * c[2]);
+            }
+
+            double v[3][3];
+            symmetricEigen(a, v);
+
+            double largest = std::max(std::max(std::abs(a[0][0]), std::abs(a[1][1])), std::abs(a[2][2]));
+            for (int d = 0; d < 3; d++) {
+                x[d] = c[d];
+            }
+
+            for (int k = 0; k < 3; k++) {
+                double eigenvalue = a[k][k];
+                if (std::abs(eigenvalue) <= qef_truncation * largest || eigenvalue == 0.0) {
+                    continue;
+                }
+
+                double projection = (v[0][k] * r[0] + v[1][k] * r[1] + v[2][k] * r[2]) / eigenvalue;
+                for (int d = 0; d < 3; d++) {
+                    x[d] += v[d][k] * projection;
+                }
+            }
+        }
+
+
+        /*
+         * Octree construction - the octree is culled by interval arithmetic down to blocks of block_cells^3 leaf
+         * cells, which are sampled densely so that every corner is evaluated once. Leaves crossed by the surface
+         * get a vertex, and subtrees without any are dropped
+         */
+
+        struct Node {
+            // Children, -1 where there is no surface. Unused for leaves
+            int children[8];
+
+            // Minimum lattice corner and edge length in cells
+            int64_t x, y, z;
+            int64_t size;
+
+            bool leaf;
+
+            // Bit i is set if corner i is outside
+            uint8_t corners;
+
+            // The QEF of the crossings in the cube, and for leaves the vertex placed by it
+            Qef qef;
+            falg::Vec3 position;
+
+            // Index of the vertex in the output, -1 until a triangle uses it
+            int vertex;
+        };
+
+        struct Extraction {
+            // Lattice point (0, 0, 0) and the distance between lattice points, in double to keep
+            // positions exact far from the origin
+            double origin[3];
+            double cell;
+
+            // Cells are merged where the surface is within max_error of planar, 0 for a uniform octree
+            float max_error;
+
+            std::vector<Node> nodes;
+
+            // Nodes of at most leaf_size cells are contoured as leaves, giving a coarser mesh from the same octree
+            int64_t leaf_size;
+            std::vector<falg::Vec3>* positions;
+            std::vector<unsigned int>* indices;
+
+            falg::Vec3 latticePosition(int64_t x, int64_t y, int64_t z) const {
+                return falg::Vec3(origin[0] + cell * x, origin[1] + cell * y, origin[2] + cell * z);
+            }
+
+            bool isLeaf(const Node& node) const {
+                return node.leaf || node.size <= leaf_size;
+            }
+        };
+
+        // A surface crossing on a lattice edge, with the surface normal there
+        struct Crossing {
+            falg::Vec3 point;
+            falg::Vec3 normal;
+        };
+
+        struct Block {
+            int64_t x, y, z;
+            int n1;
+            std::vector<float> values;
+
+            // Index into crossings for the edge from each lattice point along each axis, or -1
+            std::vector<int> edges[3];
+            std::vector<Crossing> crossings;
+
+            Block(int64_t x, int64_t y, int64_t z, int size) : x(x), y(y), z(z), n1(size + 1) {
+                values.resize(n1 * n1 * n1);
+                for (int d = 0; d < 3; d++) {
+                    edges[d].assign(n1 * n1 * n1, -1);
+                }
+            }
+
+            int index(int lx, int ly, int lz) const {
+                return (lz * n1 + ly) * n1 + lx;
+            }
+        };
+
+        static const Crossing& blockCrossing(const Extraction& ext, Block& block, const GeometricExpression& local_ge,
+                                             int lx, int ly, int lz, int axis) {
+            int i0 = block.index(lx, ly, lz);
+            int& cached = block.edges[axis][i0];
+            if (cached >= 0) {
+                return block.crossings[cached];
+            }
+
+            int l1[3] = { lx, ly, lz };
+            l1[axis]++;
+            float val0 = block.values[i0];
+            float val1 = block.values[block.index(l1[0], l1[1], l1[2])];
+
+            falg::Vec3 p0 = ext.latticePosition(block.x + lx, block.y + ly, block.z + lz);
+            falg::Vec3 p1 = ext.latticePosition(block.x + l1[0], block.y + l1[1], block.z + l1[2]);
+
+            // Near edges and corners of the surface the field is not linear along the edge, so the linear estimate
+            // is refined by false position (Illinois variant), keeping the root bracketed in [lo, hi]
+            float lo = 0.0f, hi = 1.0f, val_lo = val0, val_hi = val1;
+            float mu = val0 / (val0 - val1);
+            int side = 0;
+            for (int i = 0; i < crossing_iterations; i++) {
+                float val = local_ge.signedDist(p0 + (p1 - p0) * mu);
+                if (std::abs(val) < crossing_tolerance * ext.cell) {
+                    break;
+                }
+
+                if ((val > 0) == (val_lo > 0)) {
+                    lo = mu;
+                    val_lo = val;
+                    val_hi = side == -1 ? val_hi / 2 : val_hi;
+                    side = -1;
+                } else {
+                    hi = mu;
+                    val_hi = val;
+                    val_lo = side == 1 ? val_lo / 2 : val_lo;
+                    side = 1;
+                }
+                mu = lo + (hi - lo) * val_lo / (val_lo - val_hi);
+            }
+
+            Crossing crossing;
+            crossing.point = p0 + (p1 - p0) * mu;
+
+            falg::Vec3 grad;
+            local_ge.signedDistGrad(crossing.point, grad);
+            float norm = grad.norm();
+            if (norm == 0.0f) {
+                // Analytic gradients may vanish exactly on the surface, fall back to central differences
+                float h = crossing_tolerance * ext.cell;
+                for (int d = 0; d < 3; d++) {
+                    falg::Vec3 step(0.0f, 0.0f, 0.0f);
+                    step[d] = h;
+                    grad[d] = local_ge.signedDist(crossing.point + step) - local_ge.signedDist(crossing.point - step);
+                }
+                norm = grad.norm();
+            }
+            crossing.normal = norm > 0 ? grad / norm : falg::Vec3(0.0f, 0.0f, 0.0f);
+
+            cached = block.crossings.size();
+            block.crossings.push_back(crossing);
+            return block.crossings[cached];
+        }
+
+        // Places the vertex of a leaf cell crossed by the surface
+        static falg::Vec3 leafVertex(const Extraction& ext, const Qef& qef, int64_t x, int64_t y, int64_t z, int64_t size) {
+            double solution[3];
+            qef.solve(solution);
+
+            // Vertices that end up outside the cell are moved to the mass point, which keeps the mesh from folding
+            double min[3] = { ext.origin[0] + ext.cell * x, ext.origin[1] + ext.cell * y, ext.origin[2] + ext.cell * z };
+            for (int d = 0; d < 3; d++) {
+                if (solution[d] < min[d] || solution[d] > min[d] + ext.cell * size) {
+                    for (int k = 0; k < 3; k++) {
+                        solution[k] = qef.mass[k] / qef.count;
+                    }
+                    break;
+                }
+            }
+
+            return falg::Vec3(solution[0], solution[1], solution[2]);
+        }
+
+        static Node makeNode(int64_t x, int64_t y, int64_t z, int64_t size) {
+            Node node;
+            std::fill(node.children, node.children + 8, -1);
+            node.x = x;
+            node.y = y;
+            node.z = z;
+            node.size = size;
+            node.leaf = false;
+            node.corners = 0;
+            node.vertex = -1;
+            return node;
+        }
+
+        // Replaces the children of node by a single leaf, if they are all leaves, the error of the node's QEF is
+        // within max_error, and the signs at the corners of the children can't hide surface inside the merged cell.
+        // The signs are those of the 3 x 3 x 3 lattice points at the children's corners, of which the node's corners
+        // are the outer ones. Along every edge and across every face of the node whose corners agree in sign, the
+        // points in between must have that sign too, otherwise merging would lose a piece of surface
+        static bool collapseChildren(Extraction& ext, const Block& block, Node& node, int lx, int ly, int lz) {
+            int half = node.size / 2;
+            int num_children = 0;
+            for (int c = 0; c < 8; c++) {
+                if (node.children[c] < 0) {
+                    continue;
+                }
+
+                if (!ext.nodes[node.children[c]].leaf) {
+                    return false;
+                }
+                num_children++;
+            }
+
+            auto sign = [&](int i, int j, int k) {
+                return block.values[block.index(lx + i * half, ly + j * half, lz + k * half)] > 0;
+            };
+
+            uint8_t corners = node.corners;
+            if (corners == 0 || corners == 0xff) {
+                return false;
+            }
+
+            for (int e = 0; e < 12; e++) {
+                int c0 = edge_corners[e][0], c1 = edge_corners[e][1];
+                bool s0 = (corners >> c0) & 1, s1 = (corners >> c1) & 1;
+                if (s0 == s1 && sign((c0 / 4) + (c1 / 4), ((c0 / 2) % 2) + ((c1 / 2) % 2), (c0 % 2) + (c1 % 2)) != s0) {
+                    return false;
+                }
+            }
+
+            for (int axis = 0; axis < 3; axis++) {
+                for (int side = 0; side < 2; side++) {
+                    int face_signs = 0, num_corners = 0;
+                    for (int c = 0; c < 8; c++) {
+                        int coordinates[3] = { c / 4, (c / 2) % 2, c % 2 };
+                        if (coordinates[axis] == side) {
+                            face_signs += (corners >> c) & 1;
+                            num_corners++;
+                        }
+                    }
+
+                    int center[3] = { 1, 1, 1 };
+                    center[axis] = 2 * side;
+                    bool center_sign = sign(center[0], center[1], center[2]);
+                    if ((face_signs == 0 && center_sign) || (face_signs == num_corners && !center_sign)) {
+                        return false;
+                    }
+                }
+            }
+
+            falg::Vec3 position = leafVertex(ext, node.qef, node.x, node.y, node.z, node.size);
+            double solution[3] = { position.x(), position.y(), position.z() };
+            if (node.qef.error(solution) > (double)ext.max_error * ext.max_error * node.qef.count) {
+                return false;
+            }
+
+            // The children are leaves, so they are the last nodes added
+            ext.nodes.resize(ext.nodes.size() - num_children);
+            std::fill(node.children, node.children + 8, -1);
+            node.leaf = true;
+            node.position = position;
+            return true;
+        }
+
+        // Builds the subtree of the cube at local lattice position (lx, ly, lz) in the block, returns its index or -1
+        static int buildBlockNode(Extraction& ext, Block& block, const GeometricExpression& local_ge,
+                                  int lx, int ly, int lz, int size) {
+            Node node = makeNode(block.x + lx, block.y + ly, block.z + lz, size);
+
+            if (size > 1) {
+                int nsize = size / 2;
+                bool any = false;
+                for (int c = 0; c < 8; c++) {
+                    node.children[c] = buildBlockNode(ext, block, local_ge,
+                                                      lx + (c / 4) * nsize, ly + ((c / 2) % 2) * nsize, lz + (c % 2) * nsize,
+                                                      nsize);
+                    any = any || node.children[c] >= 0;
+                }
+
+                if (!any) {
+                    return -1;
+                }
+
+                for (int c = 0; c < 8; c++) {
+                    float val = block.values[block.index(lx + (c / 4) * size, ly + ((c / 2) % 2) * size, lz + (c % 2) * size)];
+                    node.corners |= (val > 0) << c;
+                    if (node.children[c] >= 0) {
+                        node.qef.merge(ext.nodes[node.children[c]].qef);
+                    }
+                }
+
+                if (ext.max_error > 0) {
+                    collapseChildren(ext, block, node, lx, ly, lz);
+                }
+
+                ext.nodes.push_back(node);
+                return ext.nodes.size() - 1;
+            }
+
+            for (int c = 0; c < 8; c++) {
+                float val = block.values[block.index(lx + (c / 4), ly + ((c / 2) % 2), lz + (c % 2))];
+                node.corners |= (val > 0) << c;
+            }
+
+            if (node.corners == 0 || node.corners == 0xff) {
+                return -1;
+            }
+
+            for (int e = 0; e < 12; e++) {
+                int c0 = edge_corners[e][0], c1 = edge_corners[e][1];
+                if (((node.corners >> c0) & 1) == ((node.corners >> c1) & 1)) {
+                    continue;
+                }
+
+                const Crossing& crossing = blockCrossing(ext, block, local_ge,
+                                                         lx + (c0 / 4), ly + ((c0 / 2) % 2), lz + (c0 % 2), e / 4);
+                node.qef.add(crossing.point, crossing.normal);
+            }
+
+            node.leaf = true;
+            node.position = leafVertex(ext, node.qef, node.x, node.y, node.z, 1);
+
+            ext.nodes.push_back(node);
+            return ext.nodes.size() - 1;
+        }
+
+        static int buildBlock(Extraction& ext, const GeometricExpression& local_ge,
+                              int64_t x, int64_t y, int64_t z, int size) {
+            Block block(x, y, z, size);
+            int n1 = block.n1;
+
+            std::vector<float> xs(n1 * n1 * n1), ys(n1 * n1 * n1), zs(n1 * n1 * n1);
+            for (int lz = 0; lz < n1; lz++) {
+                for (int ly = 0; ly < n1; ly++) {
+                    for (int lx = 0; lx < n1; lx++) {
+                        falg::Vec3 p = ext.latticePosition(x + lx, y + ly, z + lz);
+                        int i = block.index(lx, ly, lz);
+                        xs[i] = p.x();
+                        ys[i] = p.y();
+                        zs[i] = p.z();
+                    }
+                }
+            }
+            local_ge.signedDistBatch(xs.data(), ys.data(), zs.data(), block.values.data(), n1 * n1 * n1);
+
+            return buildBlockNode(ext, block, local_ge, 0, 0, 0, size);
+        }
+
+        // Tests whether the field is linear over the cube to within max_error, by comparing a lattice of probe_cells^3
+        // cells against the tangent plane at the center. If so, node is made a leaf, with its vertex on that plane
+        static bool planarLeaf(const Extraction& ext, const GeometricExpression& local_ge, Node& node) {
+            int n1 = probe_cells + 1;
+            int64_t stride = node.size / probe_cells;
+
+            std::vector<float> xs(n1 * n1 * n1), ys(n1 * n1 * n1), zs(n1 * n1 * n1), values(n1 * n1 * n1);
+            auto index = [n1](int i, int j, int k) { return (k * n1 + j) * n1 + i; };
+            for (int k = 0; k < n1; k++) {
+                for (int j = 0; j < n1; j++) {
+                    for (int i = 0; i < n1; i++) {
+                        falg::Vec3 p = ext.latticePosition(node.x + i * stride, node.y + j * stride, node.z + k * stride);
+                        xs[index(i, j, k)] = p.x();
+                        ys[index(i, j, k)] = p.y();
+                        zs[index(i, j, k)] = p.z();
+                    }
+                }
+            }
+            local_ge.signedDistBatch(xs.data(), ys.data(), zs.data(), values.data(), n1 * n1 * n1);
+
+            float half = ext.cell * node.size / 2;
+            falg::Vec3 center = ext.latticePosition(node.x, node.y, node.z) + falg::Vec3(half, half, half);
+            falg::Vec3 grad;
+            float center_value = local_ge.signedDistGrad(center, grad);
+            float norm = grad.norm();
+            if (norm == 0.0f) {
+                return false;
+            }
+
+            for (int i = 0; i < n1 * n1 * n1; i++) {
+                float linear = center_value + falg::dot(grad, falg::Vec3(xs[i], ys[i], zs[i]) - center);
+                if (std::abs(values[i] - linear) > ext.max_error) {
+                    return false;
+                }
+            }
+
+            uint8_t corners = 0;
+            for (int c = 0; c < 8; c++) {
+                corners |= (values[index((c / 4) * probe_cells, ((c / 2) % 2) * probe_cells, (c % 2) * probe_cells)] > 0) << c;
+            }
+            if (corners == 0 || corners == 0xff) {
+                return false;
+            }
+
+            // The crossings of the probe lattice edges all lie on the plane, so their mass point is a vertex inside the cell
+            falg::Vec3 normal = grad / norm;
+            for (int k = 0; k < n1; k++) {
+                for (int j = 0; j < n1; j++) {
+                    for (int i = 0; i < n1; i++) {
+                        int i0 = index(i, j, k);
+                        int next[3] = { i + 1 < n1 ? index(i + 1, j, k) : -1,
+                                        j + 1 < n1 ? index(i, j + 1, k) : -1,
+                                        k + 1 < n1 ? index(i, j, k + 1) : -1 };
+                        for (int d = 0; d < 3; d++) {
+                            int i1 = next[d];
+                            if (i1 < 0 || (values[i0] > 0) == (values[i1] > 0)) {
+                                continue;
+                            }
+
+                            float mu = values[i0] / (values[i0] - values[i1]);
+                            falg::Vec3 p0(xs[i0], ys[i0], zs[i0]), p1(xs[i1], ys[i1], zs[i1]);
+                            node.qef.add(p0 + (p1 - p0) * mu, normal);
+                        }
+                    }
+                }
+            }
+
+            node.leaf = true;
+            node.corners = corners;
+            node.position = leafVertex(ext, node.qef, node.x, node.y, node.z, node.size);
+            return true;
+        }
+
+        // Octree over lattice cubes given by their minimum corner and size in cells, returns the node index or -1
+        static int buildNode(Extraction& ext, const GeometricExpression& ge,
+                             int64_t x, int64_t y, int64_t z, int64_t size) {
+            float span = ext.cell * size / 2;
+            falg::Vec3 mid = ext.latticePosition(x, y, z) + falg::Vec3(span, span, span);
+
+            GeometricExpression local_ge = ge;
+            if (!MarchingCubes::specializeCube(ge, span, mid, local_ge)) {
+                return -1;
+            }
+
+            if (size <= block_cells) {
+                return buildBlock(ext, local_ge, x, y, z, size);
+            }
+
+            Node node = makeNode(x, y, z, size);
+            if (ext.max_error > 0 && planarLeaf(ext, local_ge, node)) {
+                ext.nodes.push_back(node);
+                return ext.nodes.size() - 1;
+            }
+
+            int64_t nsize = size / 2;
+            bool any = false;
+            for (int c = 0; c < 8; c++) {
+                node.children[c] = buildNode(ext, local_ge,
+                                             x + (c / 4) * nsize, y + ((c / 2) % 2) * nsize, z + (c % 2) * nsize, nsize);
+                any = any || node.children[c] >= 0;
+            }
+
+            if (!any) {
+                return -1;
+            }
+
+            // Corners are shared with the children, except in those without surface, which were never sampled
+            for (int c = 0; c < 8; c++) {
+                if (node.children[c] >= 0) {
+                    const Node& child = ext.nodes[node.children[c]];
+                    node.corners |= child.corners & (1 << c);
+                    node.qef.merge(child.qef);
+                } else {
+                    falg::Vec3 corner = ext.latticePosition(x + (c / 4) * size, y + ((c / 2) % 2) * size, z + (c % 2) * size);
+                    node.corners |= (local_ge.signedDist(corner) > 0) << c;
+                }
+            }
+
+            ext.nodes.push_back(node);
+            return ext.nodes.size() - 1;
+        }
+
+
+        /*
+         * Contouring - a quad is made around every crossed edge from the vertices of the four leaves sharing it.
+         * The recursion visits each edge once, from the smallest leaves around it
+         */
+
+        // The node itself if it is a leaf, otherwise its child
+        static int descend(const Extraction& ext, int node, int child) {
+            return ext.isLeaf(ext.nodes[node]) ? node : ext.nodes[node].children[child];
+        }
+
+        // Index of the vertex of a leaf, added to the output on first use. Nodes that are leaves only at a coarser
+        // level of detail get the vertex of their QEF
+        static int leafIndex(Extraction& ext, int node_index) {
+            Node& node = ext.nodes[node_index];
+            if (node.vertex < 0) {
+                node.vertex = ext.positions->size();
+                ext.positions->push_back(node.leaf ? node.position :
+                                         leafVertex(ext, node.qef, node.x, node.y, node.z, node.size));
+            }
+
+            return node.vertex;
+        }
+
+        static void processEdge(Extraction& ext, const int nodes[4], int dir) {
+            int64_t min_size = INT64_MAX;
+            int min_index = 0;
+            bool flip = false;
+            bool sign_change[4];
+
+            for (int i = 0; i < 4; i++) {
+                const Node& node = ext.nodes[nodes[i]];
+                int edge = process_edges[dir][i];
+                int s0 = (node.corners >> edge_corners[edge][0]) & 1;
+                int s1 = (node.corners >> edge_corners[edge][1]) & 1;
+
+                // The signs on the edge are those of the smallest cell, the others only see its end points
+                if (node.size < min_size) {
+                    min_size = node.size;
+                    min_index = i;
+                    flip = s0 == 0;
+                }
+
+                sign_change[i] = s0 != s1;
+            }
+
+            if (!sign_change[min_index]) {
+                return;
+            }
+
+            int tris[2][3] = { { 0, 1, 3 }, { 0, 3, 2 } };
+            for (int t = 0; t < 2; t++) {
+                int n0 = nodes[tris[t][0]], n1 = nodes[tris[t][1]], n2 = nodes[tris[t][2]];
+
+                // Leaves larger than their neighbours appear more than once
+                if (n0 == n1 || n1 == n2 || n2 == n0) {
+                    continue;
+                }
+
+                int i0 = leafIndex(ext, n0), i1 = leafIndex(ext, n1), i2 = leafIndex(ext, n2);
+                ext.indices->push_back(i0);
+                ext.indices->push_back(flip ? i2 : i1);
+                ext.indices->push_back(flip ? i1 : i2);
+            }
+        }
+
+        static void edgeProc(Extraction& ext, const int nodes[4], int dir) {
+            bool all_leaves = true;
+            for (int i = 0; i < 4; i++) {
+                if (nodes[i] < 0) {
+                    return;
+                }
+                all_leaves = all_leaves && ext.isLeaf(ext.nodes[nodes[i]]);
+            }
+
+            if (all_leaves) {
+                processEdge(ext, nodes, dir);
+                return;
+            }
+
+            for (int i = 0; i < 2; i++) {
+                int children[4];
+                for (int j = 0; j < 4; j++) {
+                    children[j] = descend(ext, nodes[j], edge_proc_edges[dir][i][j]);
+                }
+                edgeProc(ext, children, edge_proc_edges[dir][i][4]);
+            }
+        }
+
+        static void faceProc(Extraction& ext, const int nodes[2], int dir) {
+            if (nodes[0] < 0 || nodes[1] < 0) {
+                return;
+            }
+            if (ext.isLeaf(ext.nodes[nodes[0]]) && ext.isLeaf(ext.nodes[nodes[1]])) {
+                return;
+            }
+
+            for (int i = 0; i < 4; i++) {
+                int children[2] = { descend(ext, nodes[0], face_proc_faces[dir][i][0]),
+                                    descend(ext, nodes[1], face_proc_faces[dir][i][1]) };
+                faceProc(ext, children, face_proc_faces[dir][i][2]);
+            }
+
+            for (int i = 0; i < 4; i++) {
+                const int* mask = face_proc_edges[dir][i];
+                const int* order = face_edge_orders[mask[0]];
+                int children[4];
+                for (int j = 0; j < 4; j++) {
+                    children[j] = descend(ext, nodes[order[j]], mask[1 + j]);
+                }
+                edgeProc(ext, children, mask[5]);
+            }
+        }
+
+        static void cellProc(Extraction& ext, int node) {
+            if (node < 0 || ext.isLeaf(ext.nodes[node])) {
+                return;
+            }
+
+            const int* children = ext.nodes[node].children;
+
+            for (int c = 0; c < 8; c++) {
+                cellProc(ext, children[c]);
+            }
+
+            for (int i = 0; i < 12; i++) {
+                int face[2] = { children[cell_proc_faces[i][0]], children[cell_proc_faces[i][1]] };
+                faceProc(ext, face, cell_proc_faces[i][2]);
+            }
+
+            for (int i = 0; i < 6; i++) {
+                int edge[4];
+                for (int j = 0; j < 4; j++) {
+                    edge[j] = children[cell_proc_edges[i][j]];
+                }
+                edgeProc(ext, edge, cell_proc_edges[i][4]);
+            }
+        }
+
+        // Builds the octree of the cube mid +- span into ext, returns the root or -1
+        static int buildOctree(Extraction& ext, const GeometricExpression& ge,
+                               float target_span, float span, const falg::Vec3& mid, float max_error) {
+            // Halve the cube until the leaf span is within the target, as the marching cubes octree does
+            int64_t cells = 1;
+            double leaf_span = span;
+            while (leaf_span > target_span) {
+                leaf_span /= 2;
+                cells *= 2;
+            }
+
+            ext.max_error = max_error;
+            ext.cell = 2 * leaf_span;
+            for (int d = 0; d < 3; d++) {
+                ext.origin[d] = (double)mid[d] - span;
+            }
+
+            return buildNode(ext, ge, 0, 0, 0, cells);
+        }
+
+        static void contour(Extraction& ext, int root, int64_t leaf_size,
+                            std::vector<falg::Vec3>& positions, std::vector<unsigned int>& indices) {
+            for (Node& node : ext.nodes) {
+                node.vertex = -1;
+            }
+
+            ext.leaf_size = leaf_size;
+            ext.positions = &positions;
+            ext.indices = &indices;
+            cellProc(ext, root);
+        }
+
+        void dualContouring(const GeometricExpression& ge,
+                            std::vector<falg::Vec3>& positions,
+                            std::vector<unsigned int>& indices,
+                            float target_span, float span, const falg::Vec3& mid, float max_error) {
+            Extraction ext;
+            int root = buildOctree(ext, ge, target_span, span, mid, max_error);
+            contour(ext, root, 1, positions, indices);
+        }
+
+        void dualContouringLevels(const GeometricExpression& ge,
+                                  std::vector<std::vector<falg::Vec3>>& positions,
+                                  std::vector<std::vector<unsigned int>>& indices,
+                                  int num_levels, float target_span, float span, const falg::Vec3& mid,
+                                  float max_error) {
+            Extraction ext;
+            int root = buildOctree(ext, ge, target_span, span, mid, max_error);
+
+            positions.resize(num_levels);
+            indices.resize(num_levels);
+            for (int level = 0; level < num_levels; level++) {
+                contour(ext, root, (int64_t)1 << level, positions[level], indices[level]);
+            }
+        }
+    };
+};
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "algebraic.hpp"
+
+#include <FlatAlg.hpp>
+
+#include <vector>
+
+namespace generelle {
+    namespace DualContouring {
+
+        // Extracts the surface of the cube mid +- span as an indexed mesh, on an octree with leaves of at most
+        // target_span, the same lattice as MarchingCubes. Every leaf crossed by the surface gets one vertex,
+        // placed by minimizing the squared distances to the tangent planes at the crossings of its edges. Vertices
+        // therefore land on sharp edges and corners, and the mesh is built from quads around every crossed edge
+        //
+        // With max_error > 0 the octree is adaptive: cubes where the field is linear to within max_error are not
+        // subdivided further, and leaves whose merged vertex stays within max_error of their tangent planes are
+        // merged. Leaves of different sizes are joined without cracks
+        void dualContouring(const GeometricExpression& ge,
+                            std::vector<falg::Vec3>& positions,
+                            std::vector<unsigned int>& indices,
+                            float target_span, float span, const falg::Vec3& mid, float max_error = 0.0f);
+
+        // Extracts num_levels meshes of the surface from a single octree. Level 0 is the mesh of dualContouring,
+        // and every following level has leaves twice as large, placing their vertices by the merged QEFs of the
+        // leaves below. The field is only sampled for the finest level
+        void dualContouringLevels(const GeometricExpression& ge,
+                                  std::vector<std::vector<falg::Vec3>>& positions,
+                                  std::vector<std::vector<unsigned int>>& indices,
+                                  int num_levels, float target_span, float span, const falg::Vec3& mid,
+                                  float max_error = 0.0f);
+    };
+};
@@ -0,0 +1,72 @@
+#include "expression_pool.hpp"
+
+#include <cstring>
+
+namespace generelle {
+
+    /*
+     * NodeKey member functions
+     */
+
+    NodeKey::NodeKey(const std::type_info& type, std::initializer_list<float> params,
+                     const std::vector<IGE>& children) : type(type) {
+        for (float param : params) {
+            uint32_t bits;
+            memcpy(&bits, &param, sizeof(bits));
+            this->params.push_back(bits);
+        }
+
+        for (const IGE& child : children) {
+            this->children.push_back(child.get());
+        }
+    }
+
+    bool NodeKey::operator==(const NodeKey& other) const {
+        return this->type == other.type && this->params == other.params && this->children == other.children;
+    }
+
+    size_t NodeKeyHash::operator()(const NodeKey& key) const {
+        size_t hash = key.type.hash_code();
+        auto combine = [&hash](size_t value) {
+            hash ^= value + 0x9e3779b97f4a7c15ull + (hash << 6) + (hash >> 2);
+        };
+
+        for (uint32_t param : key.params) {
+            combine(param);
+        }
+        for (const InnerGeometricExpression* child : key.children) {
+            combine(std::hash<const InnerGeometricExpression*>()(child));
+        }
+        return hash;
+    }
+
+
+    /*
+     * ExpressionPool member functions
+     */
+
+    IGE ExpressionPool::deduplicate(const IGE& node) {
+        auto it = this->visited.find(node);
+        if (it != this->visited.end()) {
+            return it->second;
+        }
+
+        IGE canonical = node->deduplicate(node, *this);
+        this->visited[node] = canonical;
+        return canonical;
+    }
+
+    IGE ExpressionPool::intern(const IGE& node, const NodeKey& key) {
+        auto it = this->interned.find(key);
+        if (it != this->interned.end()) {
+            return it->second;
+        }
+
+        this->interned.emplace(key, node);
+        return node;
+    }
+
+    size_t ExpressionPool::getSize() const {
+        return this->interned.size();
+    }
+};
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "algebraic.hpp"
+
+#include <initializer_list>
+#include <typeindex>
+#include <unordered_map>
+#include <vector>
+
+namespace generelle {
+
+    /*
+     * NodeKey - identifies a node by its type, its parameters and its (already deduplicated) children.
+     * Parameters are compared by their bits
+     */
+
+    struct NodeKey {
+        std::type_index type;
+        std::vector<uint32_t> params;
+        std::vector<const InnerGeometricExpression*> children;
+
+        NodeKey(const std::type_info& type, std::initializer_list<float> params,
+                const std::vector<IGE>& children);
+
+        bool operator==(const NodeKey& other) const;
+    };
+
+    struct NodeKeyHash {
+        size_t operator()(const NodeKey& key) const;
+    };
+
+
+    /*
+     * ExpressionPool - hash-conses expression trees, such that structurally equal subtrees become one shared node
+     *
+     * Nodes take part through InnerGeometricExpression::deduplicate. Nodes that do not implement it are kept as
+     * they are, and are only shared where the input already shared them
+     */
+
+    class ExpressionPool {
+        // Canonical node of every node passed to deduplicate, so that shared input subtrees are visited once
+        std::unordered_map<IGE, IGE> visited;
+        std::unordered_map<NodeKey, IGE, NodeKeyHash> interned;
+
+    public:
+        // Returns the canonical node equal to node
+        IGE deduplicate(const IGE& node);
+
+        // Returns the node previously interned under key, or interns node and returns it
+        IGE intern(const IGE& node, const NodeKey& key);
+
+        // Number of distinct nodes interned
+        size_t getSize() const;
+    };
+};
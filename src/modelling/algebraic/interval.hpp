@@ -0,0 +1,117 @@
+#pragma once
+
+#include <FlatAlg.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+namespace generelle {
+
+    /*
+     * Interval - a closed range [lo, hi] of real numbers, used to bound a function over a region
+     */
+
+    struct Interval {
+        float lo, hi;
+
+        Interval() : lo(0.0f), hi(0.0f) { }
+        Interval(float v) : lo(v), hi(v) { }
+        Interval(float lo, float hi) : lo(lo), hi(hi) { }
+
+        bool contains(float v) const {
+            return lo <= v && v <= hi;
+        }
+    };
+
+    inline Interval operator+(const Interval& a, const Interval& b) {
+        return Interval(a.lo + b.lo, a.hi + b.hi);
+    }
+
+    inline Interval operator-(const Interval& a, const Interval& b) {
+        return Interval(a.lo - b.hi, a.hi - b.lo);
+    }
+
+    inline Interval operator-(const Interval& a) {
+        return Interval(- a.hi, - a.lo);
+    }
+
+    inline Interval operator*(const Interval& a, float f) {
+        return f >= 0 ? Interval(a.lo * f, a.hi * f) : Interval(a.hi * f, a.lo * f);
+    }
+
+    inline Interval operator*(const Interval& a, const Interval& b) {
+        float p[4] = { a.lo * b.lo, a.lo * b.hi, a.hi * b.lo, a.hi * b.hi };
+        return Interval(*std::min_element(p, p + 4), *std::max_element(p, p + 4));
+    }
+
+    namespace IntervalMath {
+
+        inline Interval min(const Interval& a, const Interval& b) {
+            return Interval(std::min(a.lo, b.lo), std::min(a.hi, b.hi));
+        }
+
+        inline Interval max(const Interval& a, const Interval& b) {
+            return Interval(std::max(a.lo, b.lo), std::max(a.hi, b.hi));
+        }
+
+        inline Interval abs(const Interval& a) {
+            if (a.lo >= 0) {
+                return a;
+            } else if (a.hi <= 0) {
+                return - a;
+            }
+            return Interval(0.0f, std::max(- a.lo, a.hi));
+        }
+
+        inline Interval sqr(const Interval& a) {
+            Interval b = abs(a);
+            return Interval(b.lo * b.lo, b.hi * b.hi);
+        }
+
+        inline Interval sqrt(const Interval& a) {
+            return Interval(sqrtf(std::max(a.lo, 0.0f)), sqrtf(std::max(a.hi, 0.0f)));
+        }
+
+        // Smallest interval containing both
+        inline Interval hull(const Interval& a, const Interval& b) {
+            return Interval(std::min(a.lo, b.lo), std::max(a.hi, b.hi));
+        }
+    };
+
+
+    /*
+     * IntervalBox - an axis-aligned box, one interval per axis
+     */
+
+    struct IntervalBox {
+        Interval x, y, z;
+
+        IntervalBox(const Interval& x, const Interval& y, const Interval& z) : x(x), y(y), z(z) { }
+
+        // The cube centered at mid, extending span in each direction
+        IntervalBox(const falg::Vec3& mid, float span) :
+            x(mid.x() - span, mid.x() + span),
+            y(mid.y() - span, mid.y() + span),
+            z(mid.z() - span, mid.z() + span) { }
+
+        falg::Vec3 center() const {
+            return falg::Vec3((x.lo + x.hi) / 2, (y.lo + y.hi) / 2, (z.lo + z.hi) / 2);
+        }
+
+        float halfDiagonal() const {
+            return falg::Vec3(x.hi - x.lo, y.hi - y.lo, z.hi - z.lo).norm() / 2;
+        }
+
+        // Interval of the distance to the origin over the box
+        Interval norm() const {
+            return IntervalMath::sqrt(IntervalMath::sqr(x) + IntervalMath::sqr(y) + IntervalMath::sqr(z));
+        }
+
+        // The box mapped by p -> p * scale + offset
+        IntervalBox transformed(const falg::Vec3& scale, const falg::Vec3& offset) const {
+            return IntervalBox(x * scale.x() + Interval(offset.x()),
+                               y * scale.y() + Interval(offset.y()),
+                               z * scale.z() + Interval(offset.z()));
+        }
+    };
+};
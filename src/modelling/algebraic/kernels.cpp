@@ -0,0 +1,313 @@
+#include "kernels.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define GENERELLE_X86
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+// Allows the AVX paths to be compiled regardless of global flags, they are only entered after the runtime check
+#define GENERELLE_TARGET_AVX __attribute__((target("avx")))
+#else
+#define GENERELLE_TARGET_AVX
+#endif
+
+namespace generelle {
+
+    namespace Kernels {
+
+        static const size_t lanes = 8;
+
+        bool avxSupported() {
+#if defined(GENERELLE_X86) && (defined(__GNUC__) || defined(__clang__))
+            static const bool supported = __builtin_cpu_supports("avx");
+            return supported;
+#elif defined(GENERELLE_X86) && defined(__AVX__)
+            // MSVC builds with /arch:AVX2 and would crash earlier without it
+            return true;
+#else
+            return false;
+#endif
+        }
+
+
+        /*
+         * AVX implementations, each processes the largest multiple of 8 points
+         * and returns how many points it handled
+         *
+         * _mm256_min_ps(b, a) computes (b < a ? b : a), which is exactly std::min(a, b), also for
+         * NaNs and signed zeros. The same holds for max, hence the swapped operands below
+         */
+
+#ifdef GENERELLE_X86
+
+        GENERELLE_TARGET_AVX static inline __m256 abs8(__m256 v) {
+            return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), v);
+        }
+
+        GENERELLE_TARGET_AVX static inline __m256 norm8(__m256 x, __m256 y, __m256 z) {
+            return _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, x),
+                                                              _mm256_mul_ps(y, y)),
+                                                _mm256_mul_ps(z, z)));
+        }
+
+        GENERELLE_TARGET_AVX static size_t sphereDistAvx(const float* xs, const float* ys, const float* zs, float* out, size_t n,
+                                                         float radius) {
+            __m256 r = _mm256_set1_ps(radius);
+            size_t i = 0;
+            for (; i + lanes <= n; i += lanes) {
+                __m256 d = norm8(_mm256_loadu_ps(xs + i), _mm256_loadu_ps(ys + i), _mm256_loadu_ps(zs + i));
+                _mm256_storeu_ps(out + i, _mm256_sub_ps(d, r));
+            }
+            return i;
+        }
+
+        GENERELLE_TARGET_AVX static size_t boxDistAvx(const float* xs, const float* ys, const float* zs, float* out, size_t n,
+                                                      float spx, float spy, float spz) {
+            __m256 vspx = _mm256_set1_ps(spx), vspy = _mm256_set1_ps(spy), vspz = _mm256_set1_ps(spz);
+            __m256 zero = _mm256_setzero_ps();
+            size_t i = 0;
+            for (; i + lanes <= n; i += lanes) {
+                __m256 adx = _mm256_sub_ps(abs8(_mm256_loadu_ps(xs + i)), vspx);
+                __m256 ady = _mm256_sub_ps(abs8(_mm256_loadu_ps(ys + i)), vspy);
+                __m256 adz = _mm256_sub_ps(abs8(_mm256_loadu_ps(zs + i)), vspz);
+
+                __m256 dd = norm8(_mm256_max_ps(adx, zero), _mm256_max_ps(ady, zero), _mm256_max_ps(adz, zero));
+                __m256 di = _mm256_max_ps(adz, _mm256_max_ps(ady, adx));
+
+                __m256 inside = _mm256_cmp_ps(di, zero, _CMP_LT_OQ);
+                _mm256_storeu_ps(out + i, _mm256_blendv_ps(dd, di, inside));
+            }
+            return i;
+        }
+
+        GENERELLE_TARGET_AVX static size_t cylinderDistAvx(const float* xs, const float* ys, const float* zs, float* out, size_t n,
+                                                           float radius, float half_length) {
+            __m256 r = _mm256_set1_ps(radius), hl = _mm256_set1_ps(half_length);
+            size_t i = 0;
+            for (; i + lanes <= n; i += lanes) {
+                __m256 y = _mm256_loadu_ps(ys + i), z = _mm256_loadu_ps(zs + i);
+                __m256 dr = _mm256_sub_ps(_mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(y, y), _mm256_mul_ps(z, z))), r);
+                __m256 dx = _mm256_sub_ps(abs8(_mm256_loadu_ps(xs + i)), hl);
+
+                __m256 len = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dr, dr)));
+                _mm256_storeu_ps(out + i, _mm256_min_ps(len, _mm256_max_ps(dr, dx)));
+            }
+            return i;
+        }
+
+        GENERELLE_TARGET_AVX static size_t minInPlaceAvx(float* out, const float* other, size_t n) {
+            size_t i = 0;
+            for (; i + lanes <= n; i += lanes) {
+                _mm256_storeu_ps(out + i, _mm256_min_ps(_mm256_loadu_ps(other + i), _mm256_loadu_ps(out + i)));
+            }
+            return i;
+        }
+
+        GENERELLE_TARGET_AVX static size_t maxInPlaceAvx(float* out, const float* other, size_t n) {
+            size_t i = 0;
+            for (; i + lanes <= n; i += lanes) {
+                _mm256_storeu_ps(out + i, _mm256_max_ps(_mm256_loadu_ps(other + i), _mm256_loadu_ps(out + i)));
+            }
+            return i;
+        }
+
+        GENERELLE_TARGET_AVX static size_t smoothMinInPlaceAvx(float* out, const float* other, size_t n, float k) {
+            __m256 vk = _mm256_set1_ps(k), div = _mm256_set1_ps(6 * k * k), zero = _mm256_setzero_ps();
+            size_t i = 0;
+            for (; i + lanes <= n; i += lanes) {
+                __m256 c1 = _mm256_loadu_ps(out + i), c2 = _mm256_loadu_ps(other + i);
+                __m256 h = _mm256_max_ps(zero, _mm256_sub_ps(vk, abs8(_mm256_sub_ps(c1, c2))));
+                __m256 h3 = _mm256_mul_ps(_mm256_mul_ps(h, h), h);
+                _mm256_storeu_ps(out + i, _mm256_sub_ps(_mm256_min_ps(c2, c1), _mm256_div_ps(h3, div)));
+            }
+            return i;
+        }
+
+        GENERELLE_TARGET_AVX static size_t affineInPlaceAvx(float* out, size_t n, float a, float b) {
+            __m256 va = _mm256_set1_ps(a), vb = _mm256_set1_ps(b);
+            size_t i = 0;
+            for (; i + lanes <= n; i += lanes) {
+                _mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(out + i), va), vb));
+            }
+            return i;
+        }
+
+        GENERELLE_TARGET_AVX static size_t scaleInPlaceAvx(float* out, size_t n, float a) {
+            __m256 va = _mm256_set1_ps(a);
+            size_t i = 0;
+            for (; i + lanes <= n; i += lanes) {
+                _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_loadu_ps(out + i), va));
+            }
+            return i;
+        }
+
+        GENERELLE_TARGET_AVX static size_t transformPointsAvx(const float* xs, const float* ys, const float* zs,
+                                                              float* txs, float* tys, float* tzs, size_t n,
+                                                              float sx, float sy, float sz,
+                                                              float dx, float dy, float dz) {
+            __m256 vsx = _mm256_set1_ps(sx), vsy = _mm256_set1_ps(sy), vsz = _mm256_set1_ps(sz);
+            __m256 vdx = _mm256_set1_ps(dx), vdy = _mm256_set1_ps(dy), vdz = _mm256_set1_ps(dz);
+            size_t i = 0;
+            for (; i + lanes <= n; i += lanes) {
+                _mm256_storeu_ps(txs + i, _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(xs + i), vsx), vdx));
+                _mm256_storeu_ps(tys + i, _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(ys + i), vsy), vdy));
+                _mm256_storeu_ps(tzs + i, _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(zs + i), vsz), vdz));
+            }
+            return i;
+        }
+
+        GENERELLE_TARGET_AVX static size_t backScaleInPlaceAvx(const float* xs, const float* ys, const float* zs,
+                                                               const float* nxs, const float* nys, const float* nzs,
+                                                               float* out, size_t n, float at_origin) {
+            size_t i = 0;
+            for (; i + lanes <= n; i += lanes) {
+                __m256 x = _mm256_loadu_ps(xs + i), y = _mm256_loadu_ps(ys + i), z = _mm256_loadu_ps(zs + i);
+                __m256 nx = _mm256_loadu_ps(nxs + i), ny = _mm256_loadu_ps(nys + i), nz = _mm256_loadu_ps(nzs + i);
+                __m256 sq = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(y, y)), _mm256_mul_ps(z, z));
+                __m256 nsq = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, nx), _mm256_mul_ps(ny, ny)), _mm256_mul_ps(nz, nz));
+                __m256 bs = _mm256_sqrt_ps(_mm256_div_ps(sq, nsq));
+                bs = _mm256_blendv_ps(_mm256_set1_ps(at_origin), bs, _mm256_cmp_ps(nsq, _mm256_setzero_ps(), _CMP_GT_OQ));
+                _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_loadu_ps(out + i), bs));
+            }
+            return i;
+        }
+
+#endif // GENERELLE_X86
+
+
+        /*
+         * Dispatching array kernels, the scalar loops handle the tail (or everything, without AVX)
+         */
+
+        void sphereDist(const float* xs, const float* ys, const float* zs, float* out, size_t n,
+                        float radius) {
+            size_t i = 0;
+#ifdef GENERELLE_X86
+            if (avxSupported()) {
+                i = sphereDistAvx(xs, ys, zs, out, n, radius);
+            }
+#endif
+            for (; i < n; i++) {
+                out[i] = sphereDist(xs[i], ys[i], zs[i], radius);
+            }
+        }
+
+        void boxDist(const float* xs, const float* ys, const float* zs, float* out, size_t n,
+                     float spx, float spy, float spz) {
+            size_t i = 0;
+#ifdef GENERELLE_X86
+            if (avxSupported()) {
+                i = boxDistAvx(xs, ys, zs, out, n, spx, spy, spz);
+            }
+#endif
+            for (; i < n; i++) {
+                out[i] = boxDist(xs[i], ys[i], zs[i], spx, spy, spz);
+            }
+        }
+
+        void cylinderDist(const float* xs, const float* ys, const float* zs, float* out, size_t n,
+                          float radius, float half_length) {
+            size_t i = 0;
+#ifdef GENERELLE_X86
+            if (avxSupported()) {
+                i = cylinderDistAvx(xs, ys, zs, out, n, radius, half_length);
+            }
+#endif
+            for (; i < n; i++) {
+                out[i] = cylinderDist(xs[i], ys[i], zs[i], radius, half_length);
+            }
+        }
+
+        void minInPlace(float* out, const float* other, size_t n) {
+            size_t i = 0;
+#ifdef GENERELLE_X86
+            if (avxSupported()) {
+                i = minInPlaceAvx(out, other, n);
+            }
+#endif
+            for (; i < n; i++) {
+                out[i] = std::min(out[i], other[i]);
+            }
+        }
+
+        void maxInPlace(float* out, const float* other, size_t n) {
+            size_t i = 0;
+#ifdef GENERELLE_X86
+            if (avxSupported()) {
+                i = maxInPlaceAvx(out, other, n);
+            }
+#endif
+            for (; i < n; i++) {
+                out[i] = std::max(out[i], other[i]);
+            }
+        }
+
+        void smoothMinInPlace(float* out, const float* other, size_t n, float k) {
+            size_t i = 0;
+#ifdef GENERELLE_X86
+            if (avxSupported()) {
+                i = smoothMinInPlaceAvx(out, other, n, k);
+            }
+#endif
+            for (; i < n; i++) {
+                out[i] = smoothMin(out[i], other[i], k);
+            }
+        }
+
+        void affineInPlace(float* out, size_t n, float a, float b) {
+            size_t i = 0;
+#ifdef GENERELLE_X86
+            if (avxSupported()) {
+                i = affineInPlaceAvx(out, n, a, b);
+            }
+#endif
+            for (; i < n; i++) {
+                out[i] = out[i] * a + b;
+            }
+        }
+
+        void scaleInPlace(float* out, size_t n, float a) {
+            size_t i = 0;
+#ifdef GENERELLE_X86
+            if (avxSupported()) {
+                i = scaleInPlaceAvx(out, n, a);
+            }
+#endif
+            for (; i < n; i++) {
+                out[i] = out[i] * a;
+            }
+        }
+
+        void transformPoints(const float* xs, const float* ys, const float* zs,
+                             float* txs, float* tys, float* tzs, size_t n,
+                             float sx, float sy, float sz,
+                             float dx, float dy, float dz) {
+            size_t i = 0;
+#ifdef GENERELLE_X86
+            if (avxSupported()) {
+                i = transformPointsAvx(xs, ys, zs, txs, tys, tzs, n, sx, sy, sz, dx, dy, dz);
+            }
+#endif
+            for (; i < n; i++) {
+                txs[i] = xs[i] * sx + dx;
+                tys[i] = ys[i] * sy + dy;
+                tzs[i] = zs[i] * sz + dz;
+            }
+        }
+
+        void backScaleInPlace(const float* xs, const float* ys, const float* zs,
+                              const float* nxs, const float* nys, const float* nzs,
+                              float* out, size_t n, float at_origin) {
+            size_t i = 0;
+#ifdef GENERELLE_X86
+            if (avxSupported()) {
+                i = backScaleInPlaceAvx(xs, ys, zs, nxs, nys, nzs, out, n, at_origin);
+            }
+#endif
+            for (; i < n; i++) {
+                out[i] *= backScale(xs[i], ys[i], zs[i], nxs[i], nys[i], nzs[i], at_origin);
+            }
+        }
+    };
+};
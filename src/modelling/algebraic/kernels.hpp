@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <algorithm>
+
+namespace generelle {
+
+    /*
+     * Kernels - the arithmetic of the expression nodes, shared between scalar and batched evaluation
+     *
+     * The scalar functions define the result of each node. The array functions compute the same thing
+     * over SoA arrays, using AVX (8 lanes per instruction) when the CPU supports it, and a scalar loop
+     * otherwise. The AVX paths perform the same IEEE operations in the same order as the scalar
+     * functions, so results are bit for bit identical
+     */
+
+    namespace Kernels {
+
+        bool avxSupported();
+
+
+        /*
+         * Scalar kernels
+         */
+
+        inline float sphereDist(float x, float y, float z, float radius) {
+            return sqrtf(x * x + y * y + z * z) - radius;
+        }
+
+        inline float boxDist(float x, float y, float z, float spx, float spy, float spz) {
+            float adx = std::abs(x) - spx;
+            float ady = std::abs(y) - spy;
+            float adz = std::abs(z) - spz;
+
+            float sx = std::max(0.0f, adx);
+            float sy = std::max(0.0f, ady);
+            float sz = std::max(0.0f, adz);
+
+            float dd = sqrtf(sx * sx + sy * sy + sz * sz);
+            float di = std::max(std::max(adx, ady), adz);
+
+            return di < 0 ? di : dd;
+        }
+
+        inline float cylinderDist(float x, float y, float z, float radius, float half_length) {
+            float dr = sqrtf(y * y + z * z) - radius;
+
+            float dx = std::abs(x) - half_length;
+
+            return std::min(std::max(dx, dr), sqrtf(dx * dx + dr * dr));
+        }
+
+        inline float smoothMin(float c1, float c2, float k) {
+            float h = std::max(k - std::abs(c1 - c2), 0.f);
+            return std::min(c1, c2) - h * h * h / (6 * k * k);
+        }
+
+        // Factor bringing a distance measured in non-uniformly scaled space back to the original space
+        // It has no limit at the origin, where it returns at_origin, which must lie between the smallest and
+        // largest absolute scale for interval bounds to hold
+        inline float backScale(float x, float y, float z, float nx, float ny, float nz, float at_origin) {
+            float nsq = nx * nx + ny * ny + nz * nz;
+            return nsq > 0 ? sqrtf((x * x + y * y + z * z) / nsq) : at_origin;
+        }
+
+        // The back scale factor used at the origin, the smallest absolute scale
+        inline float backScaleAtOrigin(float sx, float sy, float sz) {
+            return std::min(std::min(std::abs(sx), std::abs(sy)), std::abs(sz));
+        }
+
+
+        /*
+         * Array kernels, all arrays have length n
+         */
+
+        void sphereDist(const float* xs, const float* ys, const float* zs, float* out, size_t n,
+                        float radius);
+        void boxDist(const float* xs, const float* ys, const float* zs, float* out, size_t n,
+                     float spx, float spy, float spz);
+        void cylinderDist(const float* xs, const float* ys, const float* zs, float* out, size_t n,
+                          float radius, float half_length);
+
+        // out[i] = min(out[i], other[i]), and similarly for the rest
+        void minInPlace(float* out, const float* other, size_t n);
+        void maxInPlace(float* out, const float* other, size_t n);
+        void smoothMinInPlace(float* out, const float* other, size_t n, float k);
+
+        // out[i] = a * out[i] + b
+        void affineInPlace(float* out, size_t n, float a, float b);
+
+        // out[i] = a * out[i]. Unlike affineInPlace with b = 0, this keeps the sign of zeros, like the scalar product
+        void scaleInPlace(float* out, size_t n, float a);
+
+        // (txs, tys, tzs)[i] = (xs, ys, zs)[i] * (sx, sy, sz) + (dx, dy, dz)
+        void transformPoints(const float* xs, const float* ys, const float* zs,
+                             float* txs, float* tys, float* tzs, size_t n,
+                             float sx, float sy, float sz,
+                             float dx, float dy, float dz);
+
+        // out[i] *= backScale(original point i, scaled point i, at_origin)
+        void backScaleInPlace(const float* xs, const float* ys, const float* zs,
+                              const float* nxs, const float* nys, const float* nzs,
+                              float* out, size_t n, float at_origin);
+    };
+};
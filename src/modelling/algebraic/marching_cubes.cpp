@@ -2,13 +2,19 @@
 
 
 #include "marching_cube_info.hpp"
+#include "marching_cubes.hpp"
 
 #include <HGraf.hpp>
 
+#include <cstdint>
+#include <map>
+#include <unordered_map>
+
 namespace generelle {
     namespace MarchingCubes {
 	
-        static const float sqrt3_ceil = sqrt(3) + 1.01f;
+        // Relative slack on interval culling, so that rounding never culls a cell whose corners straddle zero
+        static const float interval_slack = 1e-4f;
         static const float target_span = 0.1f;
         static const float epsilon = 1e-5;
         const float vertex_epsilon = 1e-3;
@@ -29,45 +35,42 @@ namespace generelle {
             return v0 + (v1 - v0) * mu;
         }
 
-        // Assumes minBounds and maxBounds contain cubes
-        void marchingCubes(const GeometricExpression& ge,
-                           std::vector<falg::Vec3>& vertices,
-                           float target_span, float span, const falg::Vec3& mid) {
-            float dist = ge.signedDist(mid);
-
-            if (std::abs(dist) > span * sqrt3_ceil) {
-                // This cube can't possibly intersect the geometry, return
-                return;
-            }
-
-            if (span > target_span) {
-                float nspan = span / 2;
+        bool specializeCube(const GeometricExpression& ge, float span, const falg::Vec3& mid,
+                                   GeometricExpression& local_ge) {
+            Interval range;
+            local_ge = ge.specialize(IntervalBox(mid, span), range);
 
-                for (int i = 0; i < 2; i++) {
-                    for (int j = 0; j < 2; j++) {
-                        for (int k = 0; k < 2; k++) {
-                            marchingCubes(ge, vertices, target_span, nspan,
-                                          mid + falg::Vec3((2 * i - 1) * nspan,
-                                                           (2 * j - 1) * nspan,
-                                                           (2 * k - 1) * nspan));
-                        }
-                    }
-                }
-                return;
-            }
+            // If the distance has the same sign in the whole cube, there is no surface here
+            return !(range.lo > span * interval_slack || range.hi < - span * interval_slack);
+        }
 
-            // The span of this cube is sufficiently small, create mesh here
+        static falg::Vec3 childMid(const falg::Vec3& mid, float nspan, int child) {
+            int i = child / 4, j = (child / 2) % 2, k = child % 2;
+            return mid + falg::Vec3((2 * i - 1) * nspan,
+                                    (2 * j - 1) * nspan,
+                                    (2 * k - 1) * nspan);
+        }
 
+        // Emits the triangles of a leaf cube
+        static void polygonizeCube(const GeometricExpression& local_ge,
+                                   std::vector<falg::Vec3>& vertices,
+                                   float span, const falg::Vec3& mid) {
             uint8_t corns = 0;
             float vals[8];
+            float cxs[8], cys[8], czs[8];
             for (int i = 0; i < 8; i++) {
                 int fx = (i / 2) % 2;
                 int fy = i / 4;
                 int fz = i % 4 == 1 || i % 4 == 2;
-                falg::Vec3 corn = mid + falg::Vec3((2 * fx - 1) * span,
-                                                   (2 * fy - 1) * span,
-                                                   (2 * fz - 1) * span);
-                vals[i] = ge.signedDist(corn);
+                cxs[i] = mid.x() + (2 * fx - 1) * span;
+                cys[i] = mid.y() + (2 * fy - 1) * span;
+                czs[i] = mid.z() + (2 * fz - 1) * span;
+            }
+
+            // Evaluate all corners in one call, to pay for tree traversal only once
+            local_ge.signedDistBatch(cxs, cys, czs, vals, 8);
+
+            for (int i = 0; i < 8; i++) {
                 corns |= (vals[i] > 0) << i;
             }
 
@@ -104,5 +107,489 @@ namespace generelle {
                 vertices.push_back(v1);
             }
         }
+
+        // Continues the octree below a cube that has already been specialized and found to intersect the geometry
+        static void marchSpecializedCube(const GeometricExpression& local_ge,
+                                         std::vector<falg::Vec3>& vertices,
+                                         float target_span, float span, const falg::Vec3& mid) {
+            if (span > target_span) {
+                float nspan = span / 2;
+
+                for (int c = 0; c < 8; c++) {
+                    marchingCubes(local_ge, vertices, target_span, nspan, childMid(mid, nspan, c));
+                }
+                return;
+            }
+
+            // The span of this cube is sufficiently small, create mesh here
+            polygonizeCube(local_ge, vertices, span, mid);
+        }
+
+        // Assumes minBounds and maxBounds contain cubes
+        void marchingCubes(const GeometricExpression& ge,
+                           std::vector<falg::Vec3>& vertices,
+                           float target_span, float span, const falg::Vec3& mid) {
+            GeometricExpression local_ge = ge;
+            if (!specializeCube(ge, span, mid, local_ge)) {
+                return;
+            }
+
+            marchSpecializedCube(local_ge, vertices, target_span, span, mid);
+        }
+
+
+        /*
+         * Parallel octree - every cube larger than parallel_task_spans target spans spawns a task per child.
+         * Each task writes into its own output node, and the nodes are concatenated in the order of the
+         * serial traversal, so the result does not depend on the number of threads
+         */
+
+        static const float parallel_task_spans = 8.0f;
+
+        struct CubeOutput {
+            std::vector<falg::Vec3> vertices;
+            std::unique_ptr<CubeOutput> children[8];
+        };
+
+        static void marchingCubesTask(ThreadPool& pool, const GeometricExpression& ge, CubeOutput* output,
+                                      float target_span, float span, const falg::Vec3& mid) {
+            GeometricExpression local_ge = ge;
+            if (!specializeCube(ge, span, mid, local_ge)) {
+                return;
+            }
+
+            if (span <= target_span * parallel_task_spans) {
+                marchSpecializedCube(local_ge, output->vertices, target_span, span, mid);
+                return;
+            }
+
+            float nspan = span / 2;
+            for (int c = 0; c < 8; c++) {
+                output->children[c] = std::unique_ptr<CubeOutput>(new CubeOutput());
+                CubeOutput* child_output = output->children[c].get();
+                falg::Vec3 child_mid = childMid(mid, nspan, c);
+
+                pool.submit([&pool, local_ge, child_output, target_span, nspan, child_mid] {
+                    marchingCubesTask(pool, local_ge, child_output, target_span, nspan, child_mid);
+                });
+            }
+        }
+
+        static void gatherOutput(const CubeOutput& output, std::vector<falg::Vec3>& vertices) {
+            vertices.insert(vertices.end(), output.vertices.begin(), output.vertices.end());
+            for (int c = 0; c < 8; c++) {
+                if (output.children[c]) {
+                    gatherOutput(*output.children[c], vertices);
+                }
+            }
+        }
+
+        void marchingCubes(const GeometricExpression& ge,
+                           std::vector<falg::Vec3>& vertices,
+                           float target_span, float span, const falg::Vec3& mid,
+                           ThreadPool& pool) {
+            CubeOutput root;
+            pool.submit([&pool, &ge, &root, target_span, span, mid] {
+                marchingCubesTask(pool, ge, &root, target_span, span, mid);
+            });
+            pool.wait();
+
+            gatherOutput(root, vertices);
+        }
+
+
+        /*
+         * Block extraction - the octree stops at blocks of block_cells^3 leaf cells, which are sampled densely
+         * one z-slab at a time. Corner values are evaluated once per block, and every vertex is created once
+         * through per-slab index caches. Vertices on block faces are shared with neighbouring blocks through
+         * a map keyed on their lattice position, so the output is an indexed mesh without duplicates
+         */
+
+        static const int block_cells = 8;
+
+        // Corner offsets for the vertex numbering of MarchingCubesInfo
+        static const int corner_offsets[8][3] = {
+            { 0, 0, 0 }, { 0, 0, 1 }, { 1, 0, 1 }, { 1, 0, 0 },
+            { 0, 1, 0 }, { 0, 1, 1 }, { 1, 1, 1 }, { 1, 1, 0 }
+        };
+
+        // A lattice corner (axis = 3), or the edge from a lattice corner along an axis
+        struct LatticeKey {
+            int64_t x, y, z;
+            int axis;
+
+            bool operator==(const LatticeKey& other) const {
+                return x == other.x && y == other.y && z == other.z && axis == other.axis;
+            }
+        };
+
+        struct LatticeKeyHash {
+            size_t operator()(const LatticeKey& key) const {
+                uint64_t h = (uint64_t)key.x * 0x9E3779B97F4A7C15ull;
+                h ^= (uint64_t)key.y * 0xC2B2AE3D27D4EB4Full + (h << 6) + (h >> 2);
+                h ^= (uint64_t)key.z * 0x165667B19E3779F9ull + (h << 6) + (h >> 2);
+                return h ^ key.axis;
+            }
+        };
+
+        // Chunk coordinates, compared in the order of their Morton codes without building them, so that no lattice is
+        // too large: the coordinate with the highest differing bit decides, x before y before z at the same bit
+        struct ChunkOrder {
+            int64_t coords[3];
+
+            bool operator<(const ChunkOrder& other) const {
+                uint64_t diffs[3];
+                for (int d = 0; d < 3; d++) {
+                    diffs[d] = coords[d] ^ other.coords[d];
+                }
+
+                int axis = 0;
+                for (int d = 1; d < 3; d++) {
+                    // Whether the highest bit of diffs[d] is above that of diffs[axis]
+                    if (diffs[axis] < diffs[d] && diffs[axis] < (diffs[axis] ^ diffs[d])) {
+                        axis = d;
+                    }
+                }
+
+                return coords[axis] < other.coords[axis];
+            }
+        };
+
+        struct BlockExtraction {
+            // Lattice point (0, 0, 0) and the distance between lattice points, in double to keep
+            // positions exact far from the origin
+            double origin[3];
+            double cell;
+
+            std::vector<falg::Vec3>& positions;
+            std::vector<unsigned int>& indices;
+            std::unordered_map<LatticeKey, unsigned int, LatticeKeyHash> border_vertices;
+
+            // Index of positions[0], nonzero when earlier chunks have been streamed out
+            unsigned int first_index = 0;
+
+            // Streaming only - chunk size in cells, chunks per axis, and the border vertices to forget once
+            // the chunk with the given order has been emitted
+            int64_t chunk_cells = 0;
+            int64_t num_chunks = 0;
+            std::map<ChunkOrder, std::vector<LatticeKey>> evictions;
+
+            BlockExtraction(std::vector<falg::Vec3>& positions, std::vector<unsigned int>& indices)
+                : positions(positions), indices(indices) { }
+
+            falg::Vec3 latticePosition(int64_t x, int64_t y, int64_t z) const {
+                return falg::Vec3(origin[0] + cell * x, origin[1] + cell * y, origin[2] + cell * z);
+            }
+        };
+
+        struct BlockCaches {
+            int n1;
+            std::vector<float> values[2];
+            std::vector<int> corners[2], x_edges[2], y_edges[2], z_edges;
+            std::vector<float> xs, ys, zs;
+
+            BlockCaches(int size) : n1(size + 1) {
+                for (int s = 0; s < 2; s++) {
+                    values[s].resize(n1 * n1);
+                }
+                xs.resize(n1 * n1);
+                ys.resize(n1 * n1);
+                zs.resize(n1 * n1);
+            }
+
+            void resetSlab(int s) {
+                corners[s].assign(n1 * n1, -1);
+                x_edges[s].assign(n1 * n1, -1);
+                y_edges[s].assign(n1 * n1, -1);
+            }
+        };
+
+        // Order of the chunk at the given chunk coordinates in the octree traversal, which visits x, then y, then z halves
+        static ChunkOrder chunkOrder(int64_t x, int64_t y, int64_t z) {
+            return { { x, y, z } };
+        }
+
+        // The last chunk in traversal order that contains the lattice point of key. The order grows with every
+        // coordinate, so this is the chunk with the largest coordinates
+        static ChunkOrder lastChunk(const BlockExtraction& ext, const LatticeKey& key) {
+            return chunkOrder(std::min(key.x / ext.chunk_cells, ext.num_chunks - 1),
+                              std::min(key.y / ext.chunk_cells, ext.num_chunks - 1),
+                              std::min(key.z / ext.chunk_cells, ext.num_chunks - 1));
+        }
+
+        // Returns the index of the vertex with the given key, creating it if necessary
+        static int blockVertex(BlockExtraction& ext, int& cached, bool on_border,
+                               const LatticeKey& key, const falg::Vec3& position) {
+            if (cached >= 0) {
+                return cached;
+            }
+
+            if (on_border) {
+                auto it = ext.border_vertices.find(key);
+                if (it != ext.border_vertices.end()) {
+                    cached = it->second;
+                    return cached;
+                }
+            }
+
+            cached = ext.first_index + ext.positions.size();
+            ext.positions.push_back(position);
+
+            if (on_border) {
+                ext.border_vertices[key] = cached;
+
+                if (ext.chunk_cells > 0) {
+                    ext.evictions[lastChunk(ext, key)].push_back(key);
+                }
+            }
+            return cached;
+        }
+
+        static void extractBlock(BlockExtraction& ext, const GeometricExpression& local_ge,
+                                 int64_t bx, int64_t by, int64_t bz, int size) {
+            BlockCaches caches(size);
+            int n1 = caches.n1;
+
+            auto sampleSlab = [&](int s, int z) {
+                for (int y = 0; y < n1; y++) {
+                    for (int x = 0; x < n1; x++) {
+                        falg::Vec3 p = ext.latticePosition(bx + x, by + y, bz + z);
+                        caches.xs[y * n1 + x] = p.x();
+                        caches.ys[y * n1 + x] = p.y();
+                        caches.zs[y * n1 + x] = p.z();
+                    }
+                }
+                local_ge.signedDistBatch(caches.xs.data(), caches.ys.data(), caches.zs.data(),
+                                         caches.values[s].data(), n1 * n1);
+                caches.resetSlab(s);
+            };
+
+            auto onBorder = [size](int c) { return c == 0 || c == size; };
+
+            // Index of the vertex for an edge of the cell at (x, y, z), with endpoints a and b given as corner offsets
+            auto edgeVertex = [&](int x, int y, int z, const int* a, const int* b) {
+                int lo[3], hi[3], axis = 0;
+                for (int d = 0; d < 3; d++) {
+                    lo[d] = std::min(a[d], b[d]);
+                    hi[d] = std::max(a[d], b[d]);
+                    if (lo[d] != hi[d]) {
+                        axis = d;
+                    }
+                }
+
+                float val0 = caches.values[(z + lo[2]) % 2][(y + lo[1]) * n1 + x + lo[0]];
+                float val1 = caches.values[(z + hi[2]) % 2][(y + hi[1]) * n1 + x + hi[0]];
+
+                // Same snapping rules as lerpVertex, in a canonical edge direction so neighbours agree
+                const int* snap = nullptr;
+                float mu = 0.0f;
+                if (std::abs(val0 - val1) < epsilon) {
+                    snap = lo;
+                } else {
+                    mu = ( - val0) / (val1 - val0);
+                    if (mu < vertex_epsilon) {
+                        snap = lo;
+                    } else if (mu > 1 - vertex_epsilon) {
+                        snap = hi;
+                    }
+                }
+
+                if (snap) {
+                    int cx = x + snap[0], cy = y + snap[1], cz = z + snap[2];
+                    LatticeKey key = { bx + cx, by + cy, bz + cz, 3 };
+                    return blockVertex(ext, caches.corners[cz % 2][cy * n1 + cx],
+                                       onBorder(cx) || onBorder(cy) || onBorder(cz),
+                                       key, ext.latticePosition(key.x, key.y, key.z));
+                }
+
+                int cx = x + lo[0], cy = y + lo[1], cz = z + lo[2];
+                LatticeKey key = { bx + cx, by + cy, bz + cz, axis };
+                falg::Vec3 v0 = ext.latticePosition(key.x, key.y, key.z);
+                falg::Vec3 v1 = ext.latticePosition(bx + x + hi[0], by + y + hi[1], bz + z + hi[2]);
+                falg::Vec3 position = v0 + (v1 - v0) * mu;
+
+                if (axis == 0) {
+                    return blockVertex(ext, caches.x_edges[cz % 2][cy * n1 + cx],
+                                       onBorder(cy) || onBorder(cz), key, position);
+                } else if (axis == 1) {
+                    return blockVertex(ext, caches.y_edges[cz % 2][cy * n1 + cx],
+                                       onBorder(cx) || onBorder(cz), key, position);
+                }
+                return blockVertex(ext, caches.z_edges[cy * n1 + cx],
+                                   onBorder(cx) || onBorder(cy), key, position);
+            };
+
+            sampleSlab(0, 0);
+
+            for (int z = 0; z < size; z++) {
+                sampleSlab((z + 1) % 2, z + 1);
+                caches.z_edges.assign(n1 * n1, -1);
+
+                for (int y = 0; y < size; y++) {
+                    for (int x = 0; x < size; x++) {
+                        uint8_t corns = 0;
+                        for (int i = 0; i < 8; i++) {
+                            const int* o = corner_offsets[i];
+                            float val = caches.values[(z + o[2]) % 2][(y + o[1]) * n1 + x + o[0]];
+                            corns |= (val > 0) << i;
+                        }
+
+                        if (MarchingCubesInfo::edgeBitmasks[corns] == 0) {
+                            continue;
+                        }
+
+                        int edgeVerts[12];
+                        for (int i = 0; i < 12; i++) {
+                            if (MarchingCubesInfo::edgeBitmasks[corns] & MarchingCubesInfo::edges[i].edgeFlag) {
+                                edgeVerts[i] = edgeVertex(x, y, z,
+                                                          corner_offsets[MarchingCubesInfo::edges[i].vert0],
+                                                          corner_offsets[MarchingCubesInfo::edges[i].vert1]);
+                            }
+                        }
+
+                        const int *tri = MarchingCubesInfo::triangleIndices[corns];
+                        for (int i = 0; tri[i] != -1; i += 3) {
+                            int i0 = edgeVerts[tri[i + 0]];
+                            int i1 = edgeVerts[tri[i + 1]];
+                            int i2 = edgeVerts[tri[i + 2]];
+
+                            // Snapped vertices may collapse a triangle
+                            if (i0 == i1 || i1 == i2 || i2 == i0) {
+                                continue;
+                            }
+
+                            ext.indices.push_back(i0);
+                            ext.indices.push_back(i2);
+                            ext.indices.push_back(i1);
+                        }
+                    }
+                }
+            }
+        }
+
+        // Octree over lattice cubes given by their minimum corner and size in cells
+        static void extractBlocks(BlockExtraction& ext, const GeometricExpression& ge,
+                                  int64_t x, int64_t y, int64_t z, int64_t size) {
+            float span = ext.cell * size / 2;
+            falg::Vec3 mid = ext.latticePosition(x, y, z) + falg::Vec3(span, span, span);
+
+            GeometricExpression local_ge = ge;
+            if (!specializeCube(ge, span, mid, local_ge)) {
+                return;
+            }
+
+            if (size > block_cells) {
+                int64_t nsize = size / 2;
+                for (int c = 0; c < 8; c++) {
+                    extractBlocks(ext, local_ge,
+                                  x + (c / 4) * nsize, y + ((c / 2) % 2) * nsize, z + (c % 2) * nsize, nsize);
+                }
+                return;
+            }
+
+            extractBlock(ext, local_ge, x, y, z, size);
+        }
+
+        // Octree down to chunks. Every chunk is extracted, emitted to the sink and dropped before the next one, keeping
+        // only the border vertices that later chunks can still share
+        static void extractChunks(BlockExtraction& ext, const GeometricExpression& ge, const ChunkSink& sink,
+                                  int64_t x, int64_t y, int64_t z, int64_t size) {
+            float span = ext.cell * size / 2;
+            falg::Vec3 mid = ext.latticePosition(x, y, z) + falg::Vec3(span, span, span);
+
+            GeometricExpression local_ge = ge;
+            if (!specializeCube(ge, span, mid, local_ge)) {
+                return;
+            }
+
+            if (size > ext.chunk_cells) {
+                int64_t nsize = size / 2;
+                for (int c = 0; c < 8; c++) {
+                    extractChunks(ext, local_ge, sink,
+                                  x + (c / 4) * nsize, y + ((c / 2) % 2) * nsize, z + (c % 2) * nsize, nsize);
+                }
+                return;
+            }
+
+            extractBlocks(ext, local_ge, x, y, z, size);
+
+            if (!ext.indices.empty() || !ext.positions.empty()) {
+                sink(ext.positions, ext.indices);
+            }
+            ext.first_index += ext.positions.size();
+            ext.positions.clear();
+            ext.indices.clear();
+
+            ChunkOrder order = chunkOrder(x / size, y / size, z / size);
+            while (!ext.evictions.empty() && !(order < ext.evictions.begin()->first)) {
+                for (const LatticeKey& key : ext.evictions.begin()->second) {
+                    ext.border_vertices.erase(key);
+                }
+                ext.evictions.erase(ext.evictions.begin());
+            }
+        }
+
+        // Number of leaf cells along each axis of the cube, and the distance between lattice points
+        static int64_t latticeCells(float target_span, float span, double& cell) {
+            // Halve the cube until the leaf span is within the target, as the octree does
+            int64_t cells = 1;
+            double leaf_span = span;
+            while (leaf_span > target_span) {
+                leaf_span /= 2;
+                cells *= 2;
+            }
+
+            cell = 2 * leaf_span;
+            return cells;
+        }
+
+        void marchingCubesIndexed(const GeometricExpression& ge,
+                                  std::vector<falg::Vec3>& positions,
+                                  std::vector<unsigned int>& indices,
+                                  float target_span, float span, const falg::Vec3& mid) {
+            BlockExtraction ext(positions, indices);
+            int64_t cells = latticeCells(target_span, span, ext.cell);
+            for (int d = 0; d < 3; d++) {
+                ext.origin[d] = (double)mid[d] - span;
+            }
+
+            extractBlocks(ext, ge, 0, 0, 0, cells);
+        }
+
+        void marchingCubesRegion(const GeometricExpression& ge,
+                                 std::vector<falg::Vec3>& positions,
+                                 std::vector<unsigned int>& indices,
+                                 float target_span, float span, const falg::Vec3& mid,
+                                 int64_t x, int64_t y, int64_t z, int64_t size) {
+            BlockExtraction ext(positions, indices);
+            latticeCells(target_span, span, ext.cell);
+            for (int d = 0; d < 3; d++) {
+                ext.origin[d] = (double)mid[d] - span;
+            }
+
+            extractBlocks(ext, ge, x, y, z, size);
+        }
+
+        void marchingCubesStreamed(const GeometricExpression& ge, const ChunkSink& sink,
+                                   float target_span, float span, const falg::Vec3& mid, int chunk_cells) {
+            std::vector<falg::Vec3> positions;
+            std::vector<unsigned int> indices;
+
+            BlockExtraction ext(positions, indices);
+            int64_t cells = latticeCells(target_span, span, ext.cell);
+            for (int d = 0; d < 3; d++) {
+                ext.origin[d] = (double)mid[d] - span;
+            }
+
+            // Chunks are octree cubes, so their size is a power of two, and whole blocks
+            ext.chunk_cells = block_cells;
+            while (ext.chunk_cells < chunk_cells && ext.chunk_cells < cells) {
+                ext.chunk_cells *= 2;
+            }
+            ext.chunk_cells = std::min(ext.chunk_cells, cells);
+            ext.num_chunks = cells / ext.chunk_cells;
+
+            extractChunks(ext, ge, sink, 0, 0, 0, cells);
+        }
     }
 };
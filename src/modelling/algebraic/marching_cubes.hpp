@@ -1,11 +1,55 @@
+#pragma once
+
 #include "algebraic.hpp"
+#include "../../parallel/thread_pool.hpp"
 
 #include <HGraf.hpp>
 
+#include <cstdint>
+#include <functional>
+
 namespace generelle {
     namespace MarchingCubes {
+        // Bounds the distance over the cube of half side span around mid and specializes the expression to it.
+        // Returns false if the cube can't possibly intersect the geometry, with some slack for rounding
+        bool specializeCube(const GeometricExpression& ge, float span, const falg::Vec3& mid,
+                            GeometricExpression& local_ge);
+
 	void marchingCubes(const GeometricExpression& ge,
                            std::vector<falg::Vec3>& vertices,
                            float target_span, float span, const falg::Vec3& mid);
+
+        // Same output as above, with the octree spread over the threads of the pool
+        void marchingCubes(const GeometricExpression& ge,
+                           std::vector<falg::Vec3>& vertices,
+                           float target_span, float span, const falg::Vec3& mid,
+                           ThreadPool& pool);
+
+        // Extracts the same surface as an indexed mesh. The SDF is sampled densely on blocks of cells, so every
+        // corner is evaluated once, and vertices are shared between triangles without a deduplication pass
+        void marchingCubesIndexed(const GeometricExpression& ge,
+                                  std::vector<falg::Vec3>& positions,
+                                  std::vector<unsigned int>& indices,
+                                  float target_span, float span, const falg::Vec3& mid);
+
+        // Extracts the part of the marchingCubesIndexed surface in the lattice cells [x, x + size) along each axis,
+        // where size is a power of two dividing the cells per axis. Neighbouring regions share the lattice, so the
+        // vertices on their common border coincide, up to rounding where the expression is specialized differently
+        void marchingCubesRegion(const GeometricExpression& ge,
+                                 std::vector<falg::Vec3>& positions,
+                                 std::vector<unsigned int>& indices,
+                                 float target_span, float span, const falg::Vec3& mid,
+                                 int64_t x, int64_t y, int64_t z, int64_t size);
+
+        // Receives an extracted chunk: the vertices created in it, and its triangles. Indices count all vertices
+        // passed to the sink so far, so the chunks concatenate into one indexed mesh
+        typedef std::function<void(const std::vector<falg::Vec3>& positions,
+                                   const std::vector<unsigned int>& indices)> ChunkSink;
+
+        // Same surface as marchingCubesIndexed, extracted in cubic chunks of about chunk_cells cells per axis that are
+        // passed to the sink one at a time. Vertices on chunk borders are shared between chunks, and forgotten once
+        // every chunk touching them has been emitted, so memory is bounded by a chunk and its borders
+        void marchingCubesStreamed(const GeometricExpression& ge, const ChunkSink& sink,
+                                   float target_span, float span, const falg::Vec3& mid, int chunk_cells);
     };
 };
@@ -1,9 +1,17 @@
 #include "mesh_constructor.hpp"
 
 #include "marching_cubes.hpp"
+#include "dual_contouring.hpp"
 
 #include <HGraf.hpp>
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <queue>
+#include <unordered_map>
+
 namespace generelle {
 
     namespace MeshConstructor {
@@ -52,39 +60,192 @@ namespace generelle {
         }
 
 
-        // Remove all triangles s.t. at least two of the corners in the triangle refers to the same vertex (by index)
-        // NB: Does not preserve triangle order
-        void removeDegenerateTriangles(Mesh& mesh) {
+        // Vertices per parallel chunk when building the hash grid
+        static const size_t weld_grain = 1 << 14;
 
-            // Remove degenerate triangles (where two indices are the same)
-            int num_removed = 0;
-            for (unsigned int i = 0; i < mesh.indices.size() - 3 * num_removed; i++) {
-                int tbase = (i / 3) * 3;
-                int nextInd = ((i - tbase) + 1) % 3 + tbase;
+        static int64_t weldCell(float coordinate, float cell_size) {
+            return (int64_t)std::floor(coordinate / cell_size);
+        }
 
-                if (mesh.indices[i] == mesh.indices[nextInd]) {
-                    // If degenerate, replace with last triangle in list that has not already been used as replacement
-                    for (int j = 0; j < 3; j++) {
-                        mesh.indices[tbase + j] = mesh.indices[mesh.indices.size() - 3 * (num_removed + 1) + j];
+        static size_t weldHash(int64_t x, int64_t y, int64_t z) {
+            uint64_t h = (uint64_t)x * 0x9E3779B97F4A7C15ull;
+            h ^= (uint64_t)y * 0xC2B2AE3D27D4EB4Full + (h << 6) + (h >> 2);
+            h ^= (uint64_t)z * 0x165667B19E3779F9ull + (h << 6) + (h >> 2);
+            return h ^ (h >> 29);
+        }
+
+        // Same mapping as deduplicateMapPoints, but with vertices bucketed in a hash grid with cells of size closest_distance,
+        // so every query only looks at the 27 surrounding cells. The grid is built in parallel as a counting sort
+        // of vertex indices by bucket, and queries read directly from the sorted array
+        void deduplicateMapPointsHashed(const std::vector<falg::Vec3>& vertices, std::vector<int>& indexMap, float closest_distance,
+                                        ThreadPool& pool) {
+
+            size_t num_vertices = vertices.size();
+            indexMap = std::vector<int>(num_vertices, -1);
+
+            size_t num_buckets = 1;
+            while (num_buckets < 2 * num_vertices) {
+                num_buckets *= 2;
+            }
+            size_t bucket_mask = num_buckets - 1;
+
+            auto bucketOf = [bucket_mask](int64_t x, int64_t y, int64_t z) {
+                return weldHash(x, y, z) & bucket_mask;
+            };
+
+            std::vector<unsigned int> buckets(num_vertices);
+            std::unique_ptr<std::atomic<unsigned int>[]> counts(new std::atomic<unsigned int>[num_buckets + 1]);
+            for (size_t i = 0; i <= num_buckets; i++) {
+                counts[i] = 0;
+            }
+
+            pool.parallelFor(0, num_vertices, weld_grain, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++) {
+                    buckets[i] = bucketOf(weldCell(vertices[i].x(), closest_distance),
+                                          weldCell(vertices[i].y(), closest_distance),
+                                          weldCell(vertices[i].z(), closest_distance));
+                    counts[buckets[i] + 1]++;
+                }
+            });
+
+            // counts[b] becomes the start of bucket b in the sorted array
+            for (size_t i = 1; i <= num_buckets; i++) {
+                counts[i] = counts[i] + counts[i - 1];
+            }
+
+            std::vector<unsigned int> starts(num_buckets + 1);
+            for (size_t i = 0; i <= num_buckets; i++) {
+                starts[i] = counts[i];
+            }
+
+            std::vector<unsigned int> sorted(num_vertices);
+            pool.parallelFor(0, num_vertices, weld_grain, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++) {
+                    sorted[counts[buckets[i]]++] = i;
+                }
+            });
+
+            // Scattering is unordered across threads, so order each bucket by vertex index
+            pool.parallelFor(0, num_buckets, weld_grain, [&](size_t begin, size_t end) {
+                for (size_t b = begin; b < end; b++) {
+                    std::sort(sorted.begin() + starts[b], sorted.begin() + starts[b + 1]);
+                }
+            });
+
+            float sq_distance = closest_distance * closest_distance;
+
+            for (unsigned int i = 0; i < num_vertices; i++) {
+                if (indexMap[i] >= 0) {
+                    // This vertex has already been mapped to another vertex. Don't merge neighbor points to this
+                    continue;
+                }
+
+                int64_t cx = weldCell(vertices[i].x(), closest_distance);
+                int64_t cy = weldCell(vertices[i].y(), closest_distance);
+                int64_t cz = weldCell(vertices[i].z(), closest_distance);
+
+                for (int dx = -1; dx <= 1; dx++) {
+                    for (int dy = -1; dy <= 1; dy++) {
+                        for (int dz = -1; dz <= 1; dz++) {
+                            size_t b = bucketOf(cx + dx, cy + dy, cz + dz);
+                            for (unsigned int j = starts[b]; j < starts[b + 1]; j++) {
+                                unsigned int other = sorted[j];
+                                if (indexMap[other] < 0 && (vertices[other] - vertices[i]).sqNorm() <= sq_distance) {
+                                    indexMap[other] = i;
+                                }
+                            }
+                        }
                     }
-                    num_removed++;
+                }
+            }
+        }
+
+
+        // Weight of the planes keeping open borders in place during decimation, relative to surface planes
+        static const double border_weight = 100.0;
+
+        // Collapses may not turn any remaining triangle further than this, as the cosine of the angle
+        static const float min_normal_cos = 0.2f;
+
+        // Vertices or triangles per parallel chunk in the post-processing stages
+        static const size_t post_process_grain = 1 << 12;
 
-                    // Re-evaluate this triangle
-                    i = tbase;
+        static bool isDegenerate(const Mesh& mesh, size_t triangle) {
+            int i0 = mesh.indices[3 * triangle], i1 = mesh.indices[3 * triangle + 1], i2 = mesh.indices[3 * triangle + 2];
+            return i0 == i1 || i1 == i2 || i2 == i0;
+        }
+
+        // Remove all triangles s.t. at least two of the corners in the triangle refers to the same vertex (by index)
+        // The remaining triangles keep their order. Done as a parallel stable partition: every chunk counts its kept
+        // triangles, a prefix sum over the chunks gives their output offsets, and the chunks are copied in parallel
+        void removeDegenerateTriangles(Mesh& mesh, ThreadPool& pool) {
+            size_t num_triangles = mesh.indices.size() / 3;
+            size_t num_chunks = (num_triangles + post_process_grain - 1) / post_process_grain;
+
+            std::vector<size_t> offsets(num_chunks + 1, 0);
+            pool.parallelFor(0, num_triangles, post_process_grain, [&](size_t begin, size_t end) {
+                size_t kept = 0;
+                for (size_t i = begin; i < end; i++) {
+                    kept += !isDegenerate(mesh, i);
                 }
+                offsets[begin / post_process_grain + 1] = kept;
+            });
+
+            for (size_t i = 1; i <= num_chunks; i++) {
+                offsets[i] += offsets[i - 1];
             }
 
-            mesh.indices.resize(mesh.indices.size() - 3 * num_removed);
+            if (offsets[num_chunks] == num_triangles) {
+                return;
+            }
+
+            decltype(mesh.indices) indices(3 * offsets[num_chunks]);
+            pool.parallelFor(0, num_triangles, post_process_grain, [&](size_t begin, size_t end) {
+                size_t out = offsets[begin / post_process_grain];
+                for (size_t i = begin; i < end; i++) {
+                    if (!isDegenerate(mesh, i)) {
+                        for (int j = 0; j < 3; j++) {
+                            indices[3 * out + j] = mesh.indices[3 * i + j];
+                        }
+                        out++;
+                    }
+                }
+            });
+
+            mesh.indices = std::move(indices);
         }
 
         /*
          * reprojectMesh - make sure each vertex on the surface lies on the GE boundary (e.g. signedDist = 0)
          */
-        void reprojectMesh(const GeometricExpression& ge, Mesh& original_mesh) {
-            for (unsigned int i = 0; i < original_mesh.positions.size(); i++) {
-                float dist = ge.signedDist(original_mesh.positions[i]);
-                original_mesh.positions[i] -= original_mesh.normals[i] * dist;
-            }
+        void reprojectMesh(const GeometricExpression& ge, Mesh& original_mesh, ThreadPool& pool) {
+            unsigned int num_positions = original_mesh.positions.size();
+            std::vector<float> xs(num_positions), ys(num_positions), zs(num_positions), dists(num_positions);
+
+            pool.parallelFor(0, num_positions, post_process_grain, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++) {
+                    xs[i] = original_mesh.positions[i].x();
+                    ys[i] = original_mesh.positions[i].y();
+                    zs[i] = original_mesh.positions[i].z();
+                }
+
+                ge.signedDistBatch(xs.data() + begin, ys.data() + begin, zs.data() + begin, dists.data() + begin, end - begin);
+
+                for (size_t i = begin; i < end; i++) {
+                    original_mesh.positions[i] -= original_mesh.normals[i] * dists[i];
+                }
+            });
+        }
+
+        // Sets the normals of all vertices from the expression gradient
+        static void computeNormals(const GeometricExpression& ge, Mesh& mesh, ThreadPool& pool) {
+            mesh.normals.resize(mesh.positions.size());
+
+            pool.parallelFor(0, mesh.positions.size(), post_process_grain, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++) {
+                    mesh.normals[i] = ge.normal(mesh.positions[i]);
+                }
+            });
         }
 
 
@@ -215,39 +376,404 @@ namespace generelle {
             }
         }
 
-        hg::NormalMesh constructMesh(const GeometricExpression& ge, float target_resolution, float span, const falg::Vec3& mid,
-                                     const ConstructMeshSetup& setup) {
+        /*
+         * Quadric error decimation - edges are collapsed cheapest first, each to the point minimizing the sum of
+         * squared distances to the planes of the original triangles merged into it. A heap holds candidate
+         * collapses, entries made stale by earlier collapses are recognized by vertex version stamps
+         */
 
-            std::vector<falg::Vec3> temp_positions;
-	    MarchingCubes::marchingCubes(ge,
-					 temp_positions,
-					 target_resolution / 2, span, mid);
+        // Symmetric 4x4 matrix of the sum of squared distances to a set of planes, upper triangle row by row
+        struct Quadric {
+            double q[10] = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 };
 
+            void addPlane(double a, double b, double c, double d, double weight) {
+                double p[4] = { a, b, c, d };
+                int k = 0;
+                for (int i = 0; i < 4; i++) {
+                    for (int j = i; j < 4; j++) {
+                        q[k++] += weight * p[i] * p[j];
+                    }
+                }
+            }
 
-            std::vector<int> indMap;
-            deduplicateMapPoints(temp_positions, indMap, 1e-3);
+            void add(const Quadric& other) {
+                for (int i = 0; i < 10; i++) {
+                    q[i] += other.q[i];
+                }
+            }
 
-            // Yet another map, to map indices in the original vertex list
-            // to indices in this reduced vertex list
-            std::vector<int> newMap(indMap.size());
+            double error(const falg::Vec3& v) const {
+                double x = v.x(), y = v.y(), z = v.z();
+                return std::max(0.0, q[0] * x * x + 2 * q[1] * x * y + 2 * q[2] * x * z + 2 * q[3] * x
+                                + q[4] * y * y + 2 * q[5] * y * z + 2 * q[6] * y
+                                + q[7] * z * z + 2 * q[8] * z
+                                + q[9]);
+            }
 
-            hg::NormalMesh mesh;
-            for (unsigned int i = 0; i < temp_positions.size(); i++) {
-                if (indMap[i] == (int)i) {
-                    mesh.indices.push_back(mesh.positions.size());
-                    newMap[indMap[i]] = mesh.positions.size();
+            // The minimizer, if the quadric is well conditioned
+            bool minimizer(falg::Vec3& v) const {
+                double a[3][3] = { { q[0], q[1], q[2] }, { q[1], q[4], q[5] }, { q[2], q[5], q[7] } };
+                double b[3] = { - q[3], - q[6], - q[8] };
+
+                double det = a[0][0] * (a[1][1] * a[2][2] - a[1][2] * a[2][1])
+                    - a[0][1] * (a[1][0] * a[2][2] - a[1][2] * a[2][0])
+                    + a[0][2] * (a[1][0] * a[2][1] - a[1][1] * a[2][0]);
+                double scale = std::max(std::max(a[0][0], a[1][1]), a[2][2]);
+                if (std::abs(det) <= 1e-6 * scale * scale * scale) {
+                    return false;
+                }
 
-                    mesh.positions.push_back(temp_positions[i]);
-                    mesh.normals.push_back(ge.normal(temp_positions[i]));
-                } else {
-                    mesh.indices.push_back(newMap[indMap[i]]);
+                for (int d = 0; d < 3; d++) {
+                    double m[3][3];
+                    for (int i = 0; i < 3; i++) {
+                        for (int j = 0; j < 3; j++) {
+                            m[i][j] = j == d ? b[i] : a[i][j];
+                        }
+                    }
+                    v[d] = (m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+                            - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+                            + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0])) / det;
+                }
+                return true;
+            }
+        };
+
+        struct Collapse {
+            double cost;
+            int v0, v1;
+            unsigned int stamp0, stamp1;
+            falg::Vec3 position;
+
+            bool operator>(const Collapse& other) const {
+                return cost > other.cost;
+            }
+        };
+
+        struct Decimation {
+            std::vector<falg::Vec3> positions;
+            std::vector<Quadric> quadrics;
+            std::vector<unsigned int> stamps;
+            std::vector<bool> removed_vertices;
+
+            std::vector<int> triangles;
+            std::vector<bool> removed_triangles;
+            std::vector<std::vector<int>> vertex_triangles;
+
+            void neighbours(int v, std::vector<int>& out) const {
+                out.clear();
+                for (int t : this->vertex_triangles[v]) {
+                    for (int j = 0; j < 3; j++) {
+                        int w = this->triangles[3 * t + j];
+                        if (w != v && std::find(out.begin(), out.end(), w) == out.end()) {
+                            out.push_back(w);
+                        }
+                    }
+                }
+            }
+
+            falg::Vec3 triangleNormal(int t, int moved, const falg::Vec3& moved_position) const {
+                falg::Vec3 p[3];
+                for (int j = 0; j < 3; j++) {
+                    int v = this->triangles[3 * t + j];
+                    p[j] = v == moved ? moved_position : this->positions[v];
+                }
+                return falg::cross(p[1] - p[0], p[2] - p[0]);
+            }
+        };
+
+        // The collapse of the edge v0 - v1, to the quadric minimizer or else the best of the end points and midpoint
+        static Collapse planCollapse(const Decimation& dec, int v0, int v1) {
+            Quadric quadric = dec.quadrics[v0];
+            quadric.add(dec.quadrics[v1]);
+
+            Collapse collapse;
+            collapse.v0 = v0;
+            collapse.v1 = v1;
+            collapse.stamp0 = dec.stamps[v0];
+            collapse.stamp1 = dec.stamps[v1];
+
+            falg::Vec3 candidates[3] = { dec.positions[v0], dec.positions[v1], (dec.positions[v0] + dec.positions[v1]) / 2 };
+            collapse.position = candidates[0];
+            collapse.cost = quadric.error(candidates[0]);
+            for (int i = 1; i < 3; i++) {
+                double cost = quadric.error(candidates[i]);
+                if (cost < collapse.cost) {
+                    collapse.cost = cost;
+                    collapse.position = candidates[i];
+                }
+            }
+
+            falg::Vec3 minimizer;
+            if (quadric.minimizer(minimizer)) {
+                // Keep the vertex near the edge, far minimizers come from nearly parallel planes
+                float length = (dec.positions[v1] - dec.positions[v0]).norm();
+                if ((minimizer - candidates[2]).norm() <= length) {
+                    collapse.position = minimizer;
+                    collapse.cost = quadric.error(minimizer);
+                }
+            }
+            return collapse;
+        }
+
+        // Rejects collapses that would make the surface non-manifold or fold triangles over
+        static bool collapseAllowed(const Decimation& dec, const Collapse& collapse, std::vector<int>& n0, std::vector<int>& n1) {
+            int v0 = collapse.v0, v1 = collapse.v1;
+
+            // Link condition: the only common neighbours are the opposite corners of the triangles on the edge
+            dec.neighbours(v0, n0);
+            dec.neighbours(v1, n1);
+            int common = 0;
+            for (int w : n0) {
+                common += std::find(n1.begin(), n1.end(), w) != n1.end();
+            }
+
+            int edge_triangles = 0;
+            for (int t : dec.vertex_triangles[v0]) {
+                const int* tri = &dec.triangles[3 * t];
+                edge_triangles += tri[0] == v1 || tri[1] == v1 || tri[2] == v1;
+            }
+            if (common != edge_triangles) {
+                return false;
+            }
+
+            for (int v : { v0, v1 }) {
+                for (int t : dec.vertex_triangles[v]) {
+                    const int* tri = &dec.triangles[3 * t];
+                    if ((tri[0] == v0 || tri[1] == v0 || tri[2] == v0) && (tri[0] == v1 || tri[1] == v1 || tri[2] == v1)) {
+                        continue;
+                    }
+
+                    falg::Vec3 before = dec.triangleNormal(t, -1, collapse.position);
+                    falg::Vec3 after = dec.triangleNormal(t, v, collapse.position);
+                    float before_norm = before.norm(), after_norm = after.norm();
+                    if (before_norm == 0.0f) {
+                        continue;
+                    }
+                    if (falg::dot(before, after) <= min_normal_cos * before_norm * after_norm) {
+                        return false;
+                    }
+                }
+            }
+            return true;
+        }
+
+        // Checks the distance to the surface of ge at the new vertex, and at the centers and the new edges' midpoints
+        // of the triangles around it
+        static bool fieldErrorAllowed(const GeometricExpression& ge, const Decimation& dec, const Collapse& collapse,
+                                      float max_error) {
+            if (std::abs(ge.signedDist(collapse.position)) > max_error) {
+                return false;
+            }
+
+            for (int v : { collapse.v0, collapse.v1 }) {
+                for (int t : dec.vertex_triangles[v]) {
+                    const int* tri = &dec.triangles[3 * t];
+                    if ((tri[0] == collapse.v0 || tri[1] == collapse.v0 || tri[2] == collapse.v0) &&
+                        (tri[0] == collapse.v1 || tri[1] == collapse.v1 || tri[2] == collapse.v1)) {
+                        // Removed by the collapse
+                        continue;
+                    }
+
+                    falg::Vec3 center = collapse.position;
+                    for (int j = 0; j < 3; j++) {
+                        int w = tri[j];
+                        if (w == collapse.v0 || w == collapse.v1) {
+                            continue;
+                        }
+
+                        center += dec.positions[w];
+                        if (std::abs(ge.signedDist((collapse.position + dec.positions[w]) / 2)) > max_error) {
+                            return false;
+                        }
+                    }
+
+                    if (std::abs(ge.signedDist(center / 3)) > max_error) {
+                        return false;
+                    }
+                }
+            }
+            return true;
+        }
+
+        void decimateMesh(const GeometricExpression& ge, Mesh& mesh, int target_triangles, float max_error, bool field_error) {
+            Decimation dec;
+            int num_vertices = mesh.positions.size();
+            int num_triangles = mesh.indices.size() / 3;
+
+            dec.positions = mesh.positions;
+            dec.quadrics.resize(num_vertices);
+            dec.stamps.assign(num_vertices, 0);
+            dec.removed_vertices.assign(num_vertices, false);
+            dec.triangles.assign(mesh.indices.begin(), mesh.indices.end());
+            dec.removed_triangles.assign(num_triangles, false);
+            dec.vertex_triangles.resize(num_vertices);
+
+            // Undirected edge counts; edges used by one triangle are open borders
+            std::unordered_map<uint64_t, int> edge_counts;
+            auto edgeKey = [](int a, int b) { return ((uint64_t)(uint32_t)std::min(a, b) << 32) | (uint32_t)std::max(a, b); };
+
+            for (int t = 0; t < num_triangles; t++) {
+                const int* tri = &dec.triangles[3 * t];
+                falg::Vec3 normal = falg::cross(dec.positions[tri[1]] - dec.positions[tri[0]],
+                                                dec.positions[tri[2]] - dec.positions[tri[0]]);
+                float norm = normal.norm();
+                if (norm > 0) {
+                    normal = normal / norm;
+                    double d = - falg::dot(normal, dec.positions[tri[0]]);
+                    for (int j = 0; j < 3; j++) {
+                        dec.quadrics[tri[j]].addPlane(normal.x(), normal.y(), normal.z(), d, 1.0);
+                    }
+                }
+
+                for (int j = 0; j < 3; j++) {
+                    dec.vertex_triangles[tri[j]].push_back(t);
+                    edge_counts[edgeKey(tri[j], tri[(j + 1) % 3])]++;
+                }
+            }
+
+            // Border edges get a heavily weighted plane through them, perpendicular to their triangle
+            for (int t = 0; t < num_triangles; t++) {
+                const int* tri = &dec.triangles[3 * t];
+                falg::Vec3 normal = falg::cross(dec.positions[tri[1]] - dec.positions[tri[0]],
+                                                dec.positions[tri[2]] - dec.positions[tri[0]]);
+                for (int j = 0; j < 3; j++) {
+                    int a = tri[j], b = tri[(j + 1) % 3];
+                    if (edge_counts[edgeKey(a, b)] != 1) {
+                        continue;
+                    }
+
+                    falg::Vec3 side = falg::cross(dec.positions[b] - dec.positions[a], normal);
+                    float norm = side.norm();
+                    if (norm > 0) {
+                        side = side / norm;
+                        double d = - falg::dot(side, dec.positions[a]);
+                        dec.quadrics[a].addPlane(side.x(), side.y(), side.z(), d, border_weight);
+                        dec.quadrics[b].addPlane(side.x(), side.y(), side.z(), d, border_weight);
+                    }
+                }
+            }
+
+            std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> heap;
+            for (const auto& edge : edge_counts) {
+                int a = edge.first >> 32, b = edge.first & 0xffffffffu;
+                heap.push(planCollapse(dec, a, b));
+            }
+
+            float sq_error = max_error * max_error;
+            int remaining = num_triangles;
+            std::vector<int> n0, n1;
+
+            while (!heap.empty()) {
+                if (target_triangles > 0 && remaining <= target_triangles) {
+                    break;
+                }
+
+                Collapse collapse = heap.top();
+                heap.pop();
+
+                int v0 = collapse.v0, v1 = collapse.v1;
+                if (dec.removed_vertices[v0] || dec.removed_vertices[v1] ||
+                    collapse.stamp0 != dec.stamps[v0] || collapse.stamp1 != dec.stamps[v1]) {
+                    continue;
+                }
+
+                if (max_error > 0 && !field_error && collapse.cost > sq_error) {
+                    // The heap is ordered by cost, so no later collapse is allowed either
+                    break;
+                }
+                if (!collapseAllowed(dec, collapse, n0, n1)) {
+                    continue;
+                }
+                if (max_error > 0 && field_error && !fieldErrorAllowed(ge, dec, collapse, max_error)) {
+                    continue;
                 }
+
+                // Move v1's triangles to v0, dropping those on the edge
+                for (int t : dec.vertex_triangles[v1]) {
+                    int* tri = &dec.triangles[3 * t];
+                    if (tri[0] == v0 || tri[1] == v0 || tri[2] == v0) {
+                        dec.removed_triangles[t] = true;
+                        remaining--;
+
+                        for (int j = 0; j < 3; j++) {
+                            if (tri[j] != v0 && tri[j] != v1) {
+                                std::vector<int>& opposite = dec.vertex_triangles[tri[j]];
+                                opposite.erase(std::find(opposite.begin(), opposite.end(), t));
+                            }
+                        }
+                        continue;
+                    }
+
+                    for (int j = 0; j < 3; j++) {
+                        tri[j] = tri[j] == v1 ? v0 : tri[j];
+                    }
+                    dec.vertex_triangles[v0].push_back(t);
+                }
+
+                std::vector<int>& v0_triangles = dec.vertex_triangles[v0];
+                v0_triangles.erase(std::remove_if(v0_triangles.begin(), v0_triangles.end(),
+                                                  [&dec](int t) { return (bool)dec.removed_triangles[t]; }),
+                                   v0_triangles.end());
+                dec.vertex_triangles[v1].clear();
+
+                dec.positions[v0] = collapse.position;
+                dec.quadrics[v0].add(dec.quadrics[v1]);
+                dec.removed_vertices[v1] = true;
+                dec.stamps[v0]++;
+
+                dec.neighbours(v0, n0);
+                for (int w : n0) {
+                    heap.push(planCollapse(dec, v0, w));
+                }
+            }
+
+            // Compact, keeping the order of the remaining vertices and triangles
+            std::vector<int> remap(num_vertices, -1);
+            Mesh result;
+            for (int t = 0; t < num_triangles; t++) {
+                if (dec.removed_triangles[t]) {
+                    continue;
+                }
+
+                for (int j = 0; j < 3; j++) {
+                    int v = dec.triangles[3 * t + j];
+                    if (remap[v] < 0) {
+                        remap[v] = 0;
+                    }
+                }
+            }
+
+            for (int v = 0; v < num_vertices; v++) {
+                if (remap[v] < 0) {
+                    continue;
+                }
+
+                remap[v] = result.positions.size();
+                result.positions.push_back(dec.positions[v]);
+                result.normals.push_back(dec.stamps[v] == 0 && v < (int)mesh.normals.size() ?
+                                         mesh.normals[v] : ge.normal(dec.positions[v]));
             }
 
-            removeDegenerateTriangles(mesh);
+            for (int t = 0; t < num_triangles; t++) {
+                if (dec.removed_triangles[t]) {
+                    continue;
+                }
 
+                for (int j = 0; j < 3; j++) {
+                    result.indices.push_back(remap[dec.triangles[3 * t + j]]);
+                }
+            }
 
-            reprojectMesh(ge, mesh);
+            mesh = std::move(result);
+        }
+
+        // Everything constructMesh does after extraction
+        static void postProcessMesh(const GeometricExpression& ge, hg::NormalMesh& mesh, float target_resolution,
+                                    const ConstructMeshSetup& setup, ThreadPool& pool) {
+            computeNormals(ge, mesh, pool);
+            removeDegenerateTriangles(mesh, pool);
+
+            reprojectMesh(ge, mesh, pool);
             hg::HalfEdgeMesh hem(mesh);
             for (int i = 0; i < setup.numRectify; i++) {
                 rectifyMesh(ge, mesh, hem);
@@ -259,6 +785,333 @@ namespace generelle {
 
             hem.reconstructMesh(mesh);
 
+            if (setup.decimateTriangles > 0 || setup.decimateError > 0) {
+                decimateMesh(ge, mesh, setup.decimateTriangles, setup.decimateError, setup.decimateFieldError);
+            }
+        }
+
+        hg::NormalMesh constructMesh(const GeometricExpression& ge, float target_resolution, float span, const falg::Vec3& mid,
+                                     const ConstructMeshSetup& setup) {
+
+            hg::NormalMesh mesh;
+            ThreadPool pool(std::max(setup.numThreads, 1));
+
+            if (setup.extractor == EXTRACTOR_BLOCKS) {
+                MarchingCubes::marchingCubesIndexed(ge,
+                                                    mesh.positions, mesh.indices,
+                                                    target_resolution / 2, span, mid);
+            } else if (setup.extractor == EXTRACTOR_DUAL_CONTOURING) {
+                DualContouring::dualContouring(ge,
+                                               mesh.positions, mesh.indices,
+                                               target_resolution / 2, span, mid, setup.adaptiveError);
+            } else {
+                std::vector<falg::Vec3> temp_positions;
+                if (setup.numThreads > 1) {
+                    MarchingCubes::marchingCubes(ge,
+                                                 temp_positions,
+                                                 target_resolution / 2, span, mid,
+                                                 pool);
+                } else {
+                    MarchingCubes::marchingCubes(ge,
+                                                 temp_positions,
+                                                 target_resolution / 2, span, mid);
+                }
+
+
+                std::vector<int> indMap;
+                if (setup.weld == WELD_BVH) {
+                    deduplicateMapPoints(temp_positions, indMap, 1e-3);
+                } else {
+                    deduplicateMapPointsHashed(temp_positions, indMap, 1e-3, pool);
+                }
+
+                // Yet another map, to map indices in the original vertex list
+                // to indices in this reduced vertex list
+                std::vector<int> newMap(indMap.size());
+
+                for (unsigned int i = 0; i < temp_positions.size(); i++) {
+                    if (indMap[i] == (int)i) {
+                        mesh.indices.push_back(mesh.positions.size());
+                        newMap[indMap[i]] = mesh.positions.size();
+
+                        mesh.positions.push_back(temp_positions[i]);
+                    } else {
+                        mesh.indices.push_back(newMap[indMap[i]]);
+                    }
+                }
+            }
+
+            postProcessMesh(ge, mesh, target_resolution, setup, pool);
+
+            return mesh;
+        }
+
+        std::vector<hg::NormalMesh> constructMeshLevels(const GeometricExpression& ge, int num_levels,
+                                                        float target_resolution, float span, const falg::Vec3& mid,
+                                                        const ConstructMeshSetup& setup) {
+
+            ThreadPool pool(std::max(setup.numThreads, 1));
+
+            std::vector<std::vector<falg::Vec3>> positions;
+            std::vector<std::vector<unsigned int>> indices;
+            DualContouring::dualContouringLevels(ge, positions, indices, num_levels,
+                                                 target_resolution / 2, span, mid, setup.adaptiveError);
+
+            std::vector<hg::NormalMesh> meshes(num_levels);
+            for (int level = 0; level < num_levels; level++) {
+                meshes[level].positions = std::move(positions[level]);
+                meshes[level].indices.assign(indices[level].begin(), indices[level].end());
+
+                postProcessMesh(ge, meshes[level], target_resolution * (1 << level), setup, pool);
+            }
+
+            return meshes;
+        }
+
+        void constructMeshStreamed(const GeometricExpression& ge, const MeshSink& sink,
+                                   float target_resolution, float span, const falg::Vec3& mid,
+                                   const ConstructMeshSetup& setup) {
+
+            ThreadPool pool(std::max(setup.numThreads, 1));
+            hg::NormalMesh chunk;
+
+            // Every vertex is emitted with the first chunk that uses it, so it is reprojected exactly once
+            MarchingCubes::marchingCubesStreamed(ge, [&](const std::vector<falg::Vec3>& positions,
+                                                         const std::vector<unsigned int>& indices) {
+                chunk.positions = positions;
+                chunk.indices.assign(indices.begin(), indices.end());
+
+                computeNormals(ge, chunk, pool);
+                reprojectMesh(ge, chunk, pool);
+
+                sink(chunk);
+            }, target_resolution / 2, span, mid, setup.streamChunkCells);
+        }
+
+        // Border vertices of neighbouring fragments closer than this, in cells, are the same vertex
+        static const float fragment_weld_distance = 1e-3f;
+
+        IncrementalMesher::IncrementalMesher(const GeometricExpression& ge, float target_resolution, float span,
+                                             const falg::Vec3& mid, const ConstructMeshSetup& setup)
+            : ge(ge), setup(setup), target_resolution(target_resolution), span(span), mid(mid),
+              mesh_valid(false), pool(std::max(setup.numThreads, 1)) {
+
+            // The lattice of marchingCubesIndexed
+            int64_t cells = 1;
+            double leaf_span = span;
+            while (leaf_span > target_resolution / 2) {
+                leaf_span /= 2;
+                cells *= 2;
+            }
+
+            cell = 2 * leaf_span;
+            for (int d = 0; d < 3; d++) {
+                origin[d] = (double)mid[d] - span;
+            }
+
+            chunk_cells = 1;
+            while (chunk_cells < setup.streamChunkCells && chunk_cells < cells) {
+                chunk_cells *= 2;
+            }
+            num_chunks = cells / chunk_cells;
+
+            ChunkRange all;
+            for (int d = 0; d < 3; d++) {
+                all.min[d] = 0;
+                all.max[d] = num_chunks - 1;
+            }
+            extractChunks({ all });
+        }
+
+        IncrementalMesher::ChunkRange IncrementalMesher::chunkRange(const falg::Vec3& min, const falg::Vec3& max) const {
+            // Lattice values within a cell of the box enter the interpolation of vertices inside it
+            double extent = cell * chunk_cells;
+            ChunkRange range;
+            for (int d = 0; d < 3; d++) {
+                double lo = std::floor((min[d] - cell - origin[d]) / extent);
+                double hi = std::floor((max[d] + cell - origin[d]) / extent);
+                range.min[d] = (int64_t)std::clamp(lo, 0.0, (double)(num_chunks - 1));
+                range.max[d] = (int64_t)std::clamp(hi, 0.0, (double)(num_chunks - 1));
+            }
+
+            return range;
+        }
+
+        // Octree over cubes of size chunks, down to the chunks in the ranges that the surface may cross
+        void IncrementalMesher::collectChunks(const GeometricExpression& local_ge, int64_t x, int64_t y, int64_t z,
+                                              int64_t size, const std::vector<ChunkRange>& ranges,
+                                              std::vector<std::pair<ChunkIndex, GeometricExpression>>& chunks) const {
+            int64_t position[3] = { x, y, z };
+            bool overlaps = false;
+            for (const ChunkRange& range : ranges) {
+                bool inside = true;
+                for (int d = 0; d < 3; d++) {
+                    inside = inside && position[d] <= range.max[d] && position[d] + size > range.min[d];
+                }
+                overlaps = overlaps || inside;
+            }
+
+            if (!overlaps) {
+                return;
+            }
+
+            float half = cell * chunk_cells * size / 2;
+            falg::Vec3 cube_mid(origin[0] + cell * chunk_cells * x + half,
+                                origin[1] + cell * chunk_cells * y + half,
+                                origin[2] + cell * chunk_cells * z + half);
+
+            // Same culling as the extraction, so that no chunk it would find a surface in is skipped
+            GeometricExpression cube_ge = local_ge;
+            if (!MarchingCubes::specializeCube(local_ge, half, cube_mid, cube_ge)) {
+                return;
+            }
+
+            if (size == 1) {
+                chunks.push_back({ { x, y, z }, cube_ge });
+                return;
+            }
+
+            int64_t nsize = size / 2;
+            for (int c = 0; c < 8; c++) {
+                collectChunks(cube_ge, x + (c / 4) * nsize, y + ((c / 2) % 2) * nsize, z + (c % 2) * nsize, nsize,
+                              ranges, chunks);
+            }
+        }
+
+        void IncrementalMesher::extractChunks(const std::vector<ChunkRange>& ranges) {
+            for (auto it = fragments.begin(); it != fragments.end(); ) {
+                bool inside = false;
+                for (const ChunkRange& range : ranges) {
+                    bool in_range = true;
+                    for (int d = 0; d < 3; d++) {
+                        in_range = in_range && it->first[d] >= range.min[d] && it->first[d] <= range.max[d];
+                    }
+                    inside = inside || in_range;
+                }
+
+                it = inside ? fragments.erase(it) : std::next(it);
+            }
+
+            std::vector<std::pair<ChunkIndex, GeometricExpression>> chunks;
+            collectChunks(ge, 0, 0, 0, num_chunks, ranges, chunks);
+
+            // Chunks are extracted in parallel, then post-processed one at a time with the whole pool
+            double extent = cell * chunk_cells;
+            float weld_distance = cell * fragment_weld_distance;
+            std::vector<Fragment> extracted(chunks.size());
+            pool.parallelFor(0, chunks.size(), 1, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++) {
+                    const ChunkIndex& chunk = chunks[i].first;
+                    hg::NormalMesh& fragment = extracted[i].mesh;
+                    std::vector<unsigned int> indices;
+                    MarchingCubes::marchingCubesRegion(chunks[i].second, fragment.positions, indices,
+                                                       target_resolution / 2, span, mid,
+                                                       chunk[0] * chunk_cells, chunk[1] * chunk_cells,
+                                                       chunk[2] * chunk_cells, chunk_cells);
+                    fragment.indices.assign(indices.begin(), indices.end());
+
+                    for (unsigned int v = 0; v < fragment.positions.size(); v++) {
+                        for (int d = 0; d < 3; d++) {
+                            double t = (fragment.positions[v][d] - origin[d]) / extent;
+                            if (std::abs(t - std::round(t)) * extent < weld_distance) {
+                                extracted[i].border.push_back(v);
+                                break;
+                            }
+                        }
+                    }
+                }
+            });
+
+            for (size_t i = 0; i < chunks.size(); i++) {
+                if (extracted[i].mesh.indices.empty()) {
+                    continue;
+                }
+
+                computeNormals(ge, extracted[i].mesh, pool);
+                reprojectMesh(ge, extracted[i].mesh, pool);
+                fragments[chunks[i].first] = std::move(extracted[i]);
+            }
+
+            mesh_valid = false;
+        }
+
+        void IncrementalMesher::update(const GeometricExpression& ge,
+                                       const falg::Vec3& old_min, const falg::Vec3& old_max,
+                                       const falg::Vec3& new_min, const falg::Vec3& new_max) {
+            this->ge = ge;
+            extractChunks({ chunkRange(old_min, old_max), chunkRange(new_min, new_max) });
+        }
+
+        void IncrementalMesher::update(const GeometricExpression& ge,
+                                       const GeometricExpression& old_subexpression,
+                                       const GeometricExpression& new_subexpression) {
+            falg::Vec3 old_min, old_max, new_min, new_max;
+            if (old_subexpression.bounds(old_min, old_max) && new_subexpression.bounds(new_min, new_max)) {
+                update(ge, old_min, old_max, new_min, new_max);
+                return;
+            }
+
+            falg::Vec3 extent(span, span, span);
+            update(ge, mid - extent, mid + extent, mid - extent, mid + extent);
+        }
+
+        const hg::NormalMesh& IncrementalMesher::getMesh() {
+            if (mesh_valid) {
+                return mesh;
+            }
+
+            // Vertices on chunk borders are in every fragment around them. Only those are welded, the fragments
+            // are indexed meshes already
+            hg::NormalMesh joined;
+            std::vector<unsigned int> border;
+            std::vector<falg::Vec3> border_positions;
+            for (const auto& entry : fragments) {
+                const Fragment& fragment = entry.second;
+                unsigned int first = joined.positions.size();
+                joined.positions.insert(joined.positions.end(), fragment.mesh.positions.begin(), fragment.mesh.positions.end());
+                joined.normals.insert(joined.normals.end(), fragment.mesh.normals.begin(), fragment.mesh.normals.end());
+                for (unsigned int index : fragment.mesh.indices) {
+                    joined.indices.push_back(first + index);
+                }
+
+                for (unsigned int v : fragment.border) {
+                    border.push_back(first + v);
+                    border_positions.push_back(fragment.mesh.positions[v]);
+                }
+            }
+
+            std::vector<int> border_map;
+            deduplicateMapPointsHashed(border_positions, border_map, cell * fragment_weld_distance, pool);
+
+            // Merged vertices map to the first of their group, which comes before them
+            std::vector<int> remap(joined.positions.size());
+            for (unsigned int v = 0; v < remap.size(); v++) {
+                remap[v] = v;
+            }
+            for (unsigned int i = 0; i < border.size(); i++) {
+                remap[border[i]] = border[border_map[i]];
+            }
+
+            mesh = hg::NormalMesh();
+            for (unsigned int v = 0; v < remap.size(); v++) {
+                if (remap[v] == (int)v) {
+                    remap[v] = mesh.positions.size();
+                    mesh.positions.push_back(joined.positions[v]);
+                    mesh.normals.push_back(joined.normals[v]);
+                } else {
+                    remap[v] = remap[remap[v]];
+                }
+            }
+
+            mesh.indices.resize(joined.indices.size());
+            for (size_t i = 0; i < joined.indices.size(); i++) {
+                mesh.indices[i] = remap[joined.indices[i]];
+            }
+
+            // Welding may join close vertices of the same fragment
+            removeDegenerateTriangles(mesh, pool);
+
+            mesh_valid = true;
             return mesh;
         }
     };
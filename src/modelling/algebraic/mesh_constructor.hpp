@@ -1,5 +1,10 @@
 #include "algebraic.hpp"
+#include "../../parallel/thread_pool.hpp"
 
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <map>
 #include <vector>
 
 #include <FlatAlg.hpp>
@@ -10,17 +15,162 @@ namespace generelle {
     namespace MeshConstructor {
 
 
+        enum MeshExtractor {
+            // Octree marching cubes producing a triangle soup, welded afterwards
+            EXTRACTOR_OCTREE,
+            // Dense sampling of octree blocks, producing an indexed mesh directly
+            EXTRACTOR_BLOCKS,
+            // Dual contouring on the same octree, placing vertices on sharp edges and corners without numRectify
+            EXTRACTOR_DUAL_CONTOURING
+        };
+
+        enum VertexWeld {
+            // Greedy merge through a spatial hash grid, in expected linear time
+            WELD_HASH_GRID,
+            // Greedy merge through BVH queries
+            WELD_BVH
+        };
+
         struct ConstructMeshSetup {
             int numRectify = 0;
             bool includeSimplify = false;
+
+            // Threads used for meshing, the result is the same for any thread count
+            int numThreads = 1;
+
+            MeshExtractor extractor = EXTRACTOR_OCTREE;
+
+            // How the triangle soup of the octree extractor is welded
+            VertexWeld weld = WELD_HASH_GRID;
+
+            // Lets the dual contouring extractor use larger cells where the surface is planar to within this
+            // distance, 0 keeps the octree uniform
+            float adaptiveError = 0.0f;
+
+            // Cells along each axis of a chunk in constructMeshStreamed and IncrementalMesher
+            int streamChunkCells = 128;
+
+            // Decimates the result down to decimateTriangles triangles, without moving the surface more than
+            // decimateError. A value of 0 removes that limit, decimation is off when both are 0
+            int decimateTriangles = 0;
+            float decimateError = 0.0f;
+
+            // Measures the error as the distance of collapsed vertices to the surface of the expression,
+            // rather than to the planes of the original triangles
+            bool decimateFieldError = false;
         };
 
+        // Receives the streamed mesh one chunk at a time. The chunk holds the vertices created in it, with their
+        // normals, and its triangles, with indices counting all vertices emitted so far
+        typedef std::function<void(const hg::NormalMesh& chunk)> MeshSink;
+
         void deduplicateMapPoints(const std::vector<falg::Vec3>& vertices, std::vector<int>& indexMap, float closest_distance);
+        void deduplicateMapPointsHashed(const std::vector<falg::Vec3>& vertices, std::vector<int>& indexMap, float closest_distance,
+                                        ThreadPool& pool);
+        // Quadric error metric decimation: collapses the cheapest edges first, until at most target_triangles remain
+        // or the next collapse would move the surface more than max_error, with 0 disabling either limit. Vertices
+        // and triangles that are left are compacted, keeping their order. Normals of moved vertices come from ge
+        void decimateMesh(const GeometricExpression& ge, hg::NormalMesh& mesh, int target_triangles, float max_error,
+                          bool field_error = false);
         hg::NormalMesh constructMesh(const GeometricExpression& ge,
                                      float target_resolution = 0.1f,
                                      float start_span = 1e8,
                                      const falg::Vec3& mid = falg::Vec3(0.0f, 0.0f, 0.0f),
                                      const ConstructMeshSetup& meshSetup = ConstructMeshSetup());
+
+        // Meshes the surface at num_levels levels of detail, from target_resolution and doubling from one level to the
+        // next. All levels come from a single dual contouring octree, so the field is sampled once, for the finest
+        // level, and the extractor setting is ignored. The levels are post-processed as in constructMesh
+        std::vector<hg::NormalMesh> constructMeshLevels(const GeometricExpression& ge,
+                                                        int num_levels,
+                                                        float target_resolution = 0.1f,
+                                                        float start_span = 1e8,
+                                                        const falg::Vec3& mid = falg::Vec3(0.0f, 0.0f, 0.0f),
+                                                        const ConstructMeshSetup& meshSetup = ConstructMeshSetup());
+
+        // Meshes the surface in spatial chunks, passing each to the sink as soon as it is done, so the whole mesh is
+        // never held in memory. Vertices are shared across chunk borders, and the chunks together form the same
+        // mesh as the block extractor. Vertices are reprojected, but numRectify and includeSimplify are not
+        // supported, as they need the whole mesh
+        void constructMeshStreamed(const GeometricExpression& ge,
+                                   const MeshSink& sink,
+                                   float target_resolution = 0.1f,
+                                   float start_span = 1e8,
+                                   const falg::Vec3& mid = falg::Vec3(0.0f, 0.0f, 0.0f),
+                                   const ConstructMeshSetup& meshSetup = ConstructMeshSetup());
+
+
+        /*
+         * IncrementalMesher - keeps the mesh of an expression as one fragment per chunk of the lattice, so that after
+         * a local edit only the chunks around it are extracted again and spliced into the mesh
+         *
+         * Fragments are extracted on the lattice of the block extractor and reprojected as in constructMeshStreamed.
+         * numRectify, includeSimplify and decimation are not supported, as they need the whole mesh
+         */
+
+        class IncrementalMesher {
+            GeometricExpression ge;
+            ConstructMeshSetup setup;
+            float target_resolution;
+            float span;
+            falg::Vec3 mid;
+
+            // Lattice point (0, 0, 0), the distance between lattice points, chunk size in cells, chunks per axis
+            double origin[3];
+            double cell;
+            int64_t chunk_cells;
+            int64_t num_chunks;
+
+            typedef std::array<int64_t, 3> ChunkIndex;
+
+            // Chunks from min to max along each axis, inclusive
+            struct ChunkRange {
+                int64_t min[3];
+                int64_t max[3];
+            };
+
+            // The mesh of a chunk, and its vertices on the chunk border, found before they were reprojected
+            struct Fragment {
+                hg::NormalMesh mesh;
+                std::vector<unsigned int> border;
+            };
+
+            // Fragments of the chunks crossed by the surface
+            std::map<ChunkIndex, Fragment> fragments;
+
+            hg::NormalMesh mesh;
+            bool mesh_valid;
+
+            ThreadPool pool;
+
+            ChunkRange chunkRange(const falg::Vec3& min, const falg::Vec3& max) const;
+            void collectChunks(const GeometricExpression& local_ge, int64_t x, int64_t y, int64_t z, int64_t size,
+                               const std::vector<ChunkRange>& ranges,
+                               std::vector<std::pair<ChunkIndex, GeometricExpression>>& chunks) const;
+            void extractChunks(const std::vector<ChunkRange>& ranges);
+
+        public:
+            IncrementalMesher(const GeometricExpression& ge,
+                              float target_resolution = 0.1f,
+                              float start_span = 1e8,
+                              const falg::Vec3& mid = falg::Vec3(0.0f, 0.0f, 0.0f),
+                              const ConstructMeshSetup& meshSetup = ConstructMeshSetup());
+
+            // Replaces the expression after an edit that changed it only within the boxes old_min - old_max and
+            // new_min - new_max, the bounds of the edited subexpression before and after. Where the edit also
+            // changes the field outside its bounds, as the smoothing of a smoothAdd does, the boxes must cover that
+            void update(const GeometricExpression& ge,
+                        const falg::Vec3& old_min, const falg::Vec3& old_max,
+                        const falg::Vec3& new_min, const falg::Vec3& new_max);
+
+            // Same as above, with the boxes taken from the bounds of the edited subexpression before and after.
+            // If either is unbounded, everything is extracted again
+            void update(const GeometricExpression& ge,
+                        const GeometricExpression& old_subexpression, const GeometricExpression& new_subexpression);
+
+            // The mesh of the current expression. Chunks are joined on first call after an update
+            const hg::NormalMesh& getMesh();
+        };
     };
 
     typedef hg::NormalMesh Mesh;
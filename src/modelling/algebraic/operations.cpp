@@ -1,7 +1,35 @@
 #include "operations.hpp"
+#include "kernels.hpp"
+#include "compiled.hpp"
+#include "expression_pool.hpp"
+#include "simplifier.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
 
 namespace generelle {
 
+    /*
+     * Helpers for bounding boxes
+     */
+
+    static void boxUnion(falg::Vec3& min, falg::Vec3& max, const falg::Vec3& min2, const falg::Vec3& max2) {
+        min = falg::Vec3(std::min(min.x(), min2.x()), std::min(min.y(), min2.y()), std::min(min.z(), min2.z()));
+        max = falg::Vec3(std::max(max.x(), max2.x()), std::max(max.y(), max2.y()), std::max(max.z(), max2.z()));
+    }
+
+    static void expandBox(falg::Vec3& min, falg::Vec3& max, float r) {
+        min -= falg::Vec3(r, r, r);
+        max += falg::Vec3(r, r, r);
+    }
+
+    static float boxVolume(const falg::Vec3& min, const falg::Vec3& max) {
+        falg::Vec3 d = max - min;
+        return d.x() * d.y() * d.z();
+    }
+
+
     /*
      * GAdd member functions
      */
@@ -13,14 +41,92 @@ namespace generelle {
         return std::min(this->s1->signedDist(pos), this->s2->signedDist(pos));
     }
 
-    falg::Vec3 GAdd::normal(const falg::Vec3& pos) const {
-        float c1 = this->s1->signedDist(pos);
-        float c2 = this->s2->signedDist(pos);
-        if (std::min(c1, c2) == c1) {
-            return this->s1->normal(pos);
-        } else {
-            return this->s2->normal(pos);
+    float GAdd::signedDistGrad(const falg::Vec3& pos, falg::Vec3& grad) const {
+        falg::Vec3 g1, g2;
+        float c1 = this->s1->signedDistGrad(pos, g1);
+        float c2 = this->s2->signedDistGrad(pos, g2);
+
+        // Follows the choice of std::min
+        grad = c2 < c1 ? g2 : g1;
+        return std::min(c1, c2);
+    }
+
+    void GAdd::signedDistBatch(const float* xs, const float* ys, const float* zs,
+                               float* out, size_t n) const {
+        float tmp[batch_chunk_size];
+        for (size_t base = 0; base < n; base += batch_chunk_size) {
+            size_t m = std::min(batch_chunk_size, n - base);
+            this->s1->signedDistBatch(xs + base, ys + base, zs + base, out + base, m);
+            this->s2->signedDistBatch(xs + base, ys + base, zs + base, tmp, m);
+
+            Kernels::minInPlace(out + base, tmp, m);
+        }
+    }
+
+    Interval GAdd::signedDistInterval(const IntervalBox& box) const {
+        Interval c1 = this->s1->signedDistInterval(box);
+        Interval c2 = this->s2->signedDistInterval(box);
+
+        return IntervalMath::min(c1, c2);
+    }
+
+    IGE GAdd::specialize(const IGE& self, const IntervalBox& box, Interval& range) const {
+        Interval r1, r2;
+        IGE n1 = this->s1->specialize(this->s1, box, r1);
+        IGE n2 = this->s2->specialize(this->s2, box, r2);
+        range = IntervalMath::min(r1, r2);
+
+        // Drop a branch that is larger everywhere in the box
+        if (r1.hi < r2.lo) {
+            return n1;
+        } else if (r2.hi < r1.lo) {
+            return n2;
+        }
+
+        if (n1 == this->s1 && n2 == this->s2) {
+            return self;
+        }
+        return IGE(new GAdd(n1, n2));
+    }
+
+    IGE GAdd::deduplicate(const IGE& self, ExpressionPool& pool) const {
+        IGE n1 = pool.deduplicate(this->s1);
+        IGE n2 = pool.deduplicate(this->s2);
+        IGE node = n1 == this->s1 && n2 == this->s2 ? self : IGE(new GAdd(n1, n2));
+        return pool.intern(node, NodeKey(typeid(GAdd), { }, { n1, n2 }));
+    }
+
+    IGE GAdd::simplify(const IGE& self, Simplifier& simplifier) const {
+        IGE n1 = simplifier.simplify(this->s1);
+        IGE n2 = simplifier.simplify(this->s2);
+
+        std::vector<IGE> children;
+        GUnion::flatten(n1, children);
+        GUnion::flatten(n2, children);
+        if (children.size() > 2) {
+            return IGE(new GUnion(children));
+        }
+
+        if (n1 == this->s1 && n2 == this->s2) {
+            return self;
         }
+        return IGE(new GAdd(n1, n2));
+    }
+
+    int GAdd::compile(TapeBuilder& builder, int pos) const {
+        int c1 = builder.compile(this->s1.get(), pos);
+        int c2 = builder.compile(this->s2.get(), pos);
+        return builder.emitMin(c1, c2);
+    }
+
+    bool GAdd::bounds(falg::Vec3& min, falg::Vec3& max) const {
+        falg::Vec3 min2, max2;
+        if (!this->s1->bounds(min, max) || !this->s2->bounds(min2, max2)) {
+            return false;
+        }
+
+        boxUnion(min, max, min2, max2);
+        return true;
     }
 
 
@@ -35,7 +141,98 @@ namespace generelle {
         float c1 = this->s1->signedDist(pos);
         float c2 = this->s2->signedDist(pos);
 
-        return std::min(c1, c2) - std::pow(std::max(this->k - std::abs(c1 - c2), 0.f), 3) / (6 * this->k * this->k);
+        return Kernels::smoothMin(c1, c2, this->k);
+    }
+
+    float GSmoothAdd::signedDistGrad(const falg::Vec3& pos, falg::Vec3& grad) const {
+        falg::Vec3 g1, g2;
+        float c1 = this->s1->signedDistGrad(pos, g1);
+        float c2 = this->s2->signedDistGrad(pos, g2);
+
+        // d/dx of h^3 / (6k^2), with h = k - |c1 - c2| where positive. Ties take the same branch as the min
+        float h = std::max(this->k - std::abs(c1 - c2), 0.f);
+        falg::Vec3 grad_h = (c2 < c1 ? -1.0f : 1.0f) * (g1 - g2);
+
+        grad = (c2 < c1 ? g2 : g1) - (h * h / (2 * this->k * this->k)) * grad_h;
+        return Kernels::smoothMin(c1, c2, this->k);
+    }
+
+    void GSmoothAdd::signedDistBatch(const float* xs, const float* ys, const float* zs,
+                                     float* out, size_t n) const {
+        float tmp[batch_chunk_size];
+        for (size_t base = 0; base < n; base += batch_chunk_size) {
+            size_t m = std::min(batch_chunk_size, n - base);
+            this->s1->signedDistBatch(xs + base, ys + base, zs + base, out + base, m);
+            this->s2->signedDistBatch(xs + base, ys + base, zs + base, tmp, m);
+
+            Kernels::smoothMinInPlace(out + base, tmp, m, this->k);
+        }
+    }
+
+    Interval GSmoothAdd::signedDistInterval(const IntervalBox& box) const {
+        Interval c1 = this->s1->signedDistInterval(box);
+        Interval c2 = this->s2->signedDistInterval(box);
+
+        // The subtracted term is increasing in h, and h is non-negative
+        Interval h = IntervalMath::max(Interval(0.0f), - IntervalMath::abs(c1 - c2) + this->k);
+        float div = 6 * this->k * this->k;
+        Interval m = IntervalMath::min(c1, c2);
+
+        return Interval(m.lo - h.hi * h.hi * h.hi / div, m.hi - h.lo * h.lo * h.lo / div);
+    }
+
+    IGE GSmoothAdd::specialize(const IGE& self, const IntervalBox& box, Interval& range) const {
+        Interval r1, r2;
+        IGE n1 = this->s1->specialize(this->s1, box, r1);
+        IGE n2 = this->s2->specialize(this->s2, box, r2);
+        range = this->signedDistInterval(box);
+
+        // Farther apart than k, the smoothing term vanishes and the smaller branch is the result
+        if (r1.hi + this->k < r2.lo) {
+            return n1;
+        } else if (r2.hi + this->k < r1.lo) {
+            return n2;
+        }
+
+        if (n1 == this->s1 && n2 == this->s2) {
+            return self;
+        }
+        return IGE(new GSmoothAdd(n1, n2, this->k));
+    }
+
+    IGE GSmoothAdd::deduplicate(const IGE& self, ExpressionPool& pool) const {
+        IGE n1 = pool.deduplicate(this->s1);
+        IGE n2 = pool.deduplicate(this->s2);
+        IGE node = n1 == this->s1 && n2 == this->s2 ? self : IGE(new GSmoothAdd(n1, n2, this->k));
+        return pool.intern(node, NodeKey(typeid(GSmoothAdd), { this->k }, { n1, n2 }));
+    }
+
+    IGE GSmoothAdd::simplify(const IGE& self, Simplifier& simplifier) const {
+        IGE n1 = simplifier.simplify(this->s1);
+        IGE n2 = simplifier.simplify(this->s2);
+
+        if (n1 == this->s1 && n2 == this->s2) {
+            return self;
+        }
+        return IGE(new GSmoothAdd(n1, n2, this->k));
+    }
+
+    int GSmoothAdd::compile(TapeBuilder& builder, int pos) const {
+        int c1 = builder.compile(this->s1.get(), pos);
+        int c2 = builder.compile(this->s2.get(), pos);
+        return builder.emitSmoothMin(c1, c2, this->k);
+    }
+
+    bool GSmoothAdd::bounds(falg::Vec3& min, falg::Vec3& max) const {
+        falg::Vec3 min2, max2;
+        if (!this->s1->bounds(min, max) || !this->s2->bounds(min2, max2)) {
+            return false;
+        }
+
+        // The smoothing subtracts at most k / 6 from the smaller distance
+        boxUnion(min, max, min2, max2);
+        expandBox(min, max, std::abs(this->k) / 6);
+        return true;
     }
 
 
@@ -49,6 +246,69 @@ namespace generelle {
         return this->s1->signedDist(pos) - r;
     }
 
+    float GPad::signedDistGrad(const falg::Vec3& pos, falg::Vec3& grad) const {
+        return this->s1->signedDistGrad(pos, grad) - r;
+    }
+
+    void GPad::signedDistBatch(const float* xs, const float* ys, const float* zs,
+                               float* out, size_t n) const {
+        this->s1->signedDistBatch(xs, ys, zs, out, n);
+        Kernels::affineInPlace(out, n, 1.0f, - r);
+    }
+
+    Interval GPad::signedDistInterval(const IntervalBox& box) const {
+        return this->s1->signedDistInterval(box) - r;
+    }
+
+    IGE GPad::specialize(const IGE& self, const IntervalBox& box, Interval& range) const {
+        Interval r1;
+        IGE n1 = this->s1->specialize(this->s1, box, r1);
+        range = r1 - r;
+
+        if (n1 == this->s1) {
+            return self;
+        }
+        return IGE(new GPad(n1, r));
+    }
+
+    IGE GPad::deduplicate(const IGE& self, ExpressionPool& pool) const {
+        IGE n1 = pool.deduplicate(this->s1);
+        IGE node = n1 == this->s1 ? self : IGE(new GPad(n1, this->r));
+        return pool.intern(node, NodeKey(typeid(GPad), { this->r }, { n1 }));
+    }
+
+    IGE GPad::simplify(const IGE& self, Simplifier& simplifier) const {
+        IGE n1 = simplifier.simplify(this->s1);
+
+        // Nested paddings add up
+        const GPad* nested = dynamic_cast<const GPad*>(n1.get());
+        if (nested) {
+            return IGE(new GPad(nested->s1, nested->r + this->r));
+        }
+
+        if (this->r == 0) {
+            return n1;
+        } else if (n1 == this->s1) {
+            return self;
+        }
+        return IGE(new GPad(n1, this->r));
+    }
+
+    int GPad::compile(TapeBuilder& builder, int pos) const {
+        int c1 = builder.compile(this->s1.get(), pos);
+        return builder.emitAffine(c1, 1.0f, - r);
+    }
+
+    bool GPad::bounds(falg::Vec3& min, falg::Vec3& max) const {
+        if (!this->s1->bounds(min, max)) {
+            return false;
+        }
+
+        // Negative padding only increases the distance, the original box still holds
+        expandBox(min, max, std::max(r, 0.0f));
+        return true;
+    }
+
 
     /*
      * GIntersect member functions
@@ -60,6 +320,97 @@ namespace generelle {
         return std::max(this->s1->signedDist(pos), this->s2->signedDist(pos));
     }
 
+    float GIntersect::signedDistGrad(const falg::Vec3& pos, falg::Vec3& grad) const {
+        falg::Vec3 g1, g2;
+        float c1 = this->s1->signedDistGrad(pos, g1);
+        float c2 = this->s2->signedDistGrad(pos, g2);
+
+        // Follows the choice of std::max
+        grad = c1 < c2 ? g2 : g1;
+        return std::max(c1, c2);
+    }
+
+    void GIntersect::signedDistBatch(const float* xs, const float* ys, const float* zs,
+                                     float* out, size_t n) const {
+        float tmp[batch_chunk_size];
+        for (size_t base = 0; base < n; base += batch_chunk_size) {
+            size_t m = std::min(batch_chunk_size, n - base);
+            this->s1->signedDistBatch(xs + base, ys + base, zs + base, out + base, m);
+            this->s2->signedDistBatch(xs + base, ys + base, zs + base, tmp, m);
+
+            Kernels::maxInPlace(out + base, tmp, m);
+        }
+    }
+
+    Interval GIntersect::signedDistInterval(const IntervalBox& box) const {
+        Interval c1 = this->s1->signedDistInterval(box);
+        Interval c2 = this->s2->signedDistInterval(box);
+
+        return IntervalMath::max(c1, c2);
+    }
+
+    IGE GIntersect::specialize(const IGE& self, const IntervalBox& box, Interval& range) const {
+        Interval r1, r2;
+        IGE n1 = this->s1->specialize(this->s1, box, r1);
+        IGE n2 = this->s2->specialize(this->s2, box, r2);
+        range = IntervalMath::max(r1, r2);
+
+        // Drop a branch that is smaller everywhere in the box
+        if (r1.lo > r2.hi) {
+            return n1;
+        } else if (r2.lo > r1.hi) {
+            return n2;
+        }
+
+        if (n1 == this->s1 && n2 == this->s2) {
+            return self;
+        }
+        return IGE(new GIntersect(n1, n2));
+    }
+
+    IGE GIntersect::deduplicate(const IGE& self, ExpressionPool& pool) const {
+        IGE n1 = pool.deduplicate(this->s1);
+        IGE n2 = pool.deduplicate(this->s2);
+        IGE node = n1 == this->s1 && n2 == this->s2 ? self : IGE(new GIntersect(n1, n2));
+        return pool.intern(node, NodeKey(typeid(GIntersect), { }, { n1, n2 }));
+    }
+
+    IGE GIntersect::simplify(const IGE& self, Simplifier& simplifier) const {
+        IGE n1 = simplifier.simplify(this->s1);
+        IGE n2 = simplifier.simplify(this->s2);
+
+        std::vector<IGE> children;
+        GMultiIntersect::flatten(n1, children);
+        GMultiIntersect::flatten(n2, children);
+        if (children.size() > 2) {
+            return IGE(new GMultiIntersect(children));
+        }
+
+        if (n1 == this->s1 && n2 == this->s2) {
+            return self;
+        }
+        return IGE(new GIntersect(n1, n2));
+    }
+
+    int GIntersect::compile(TapeBuilder& builder, int pos) const {
+        int c1 = builder.compile(this->s1.get(), pos);
+        int c2 = builder.compile(this->s2.get(), pos);
+        return builder.emitMax(c1, c2);
+    }
+
+    bool GIntersect::bounds(falg::Vec3& min, falg::Vec3& max) const {
+        // The distance is at least each of the two, so either box holds. Pick the smaller
+        falg::Vec3 min2, max2;
+        bool bounded1 = this->s1->bounds(min, max);
+        bool bounded2 = this->s2->bounds(min2, max2);
+
+        if (bounded2 && (!bounded1 || boxVolume(min2, max2) < boxVolume(min, max))) {
+            min = min2;
+            max = max2;
+        }
+        return bounded1 || bounded2;
+    }
+
 
     /*
      * GInverse member functions
@@ -70,4 +421,634 @@ namespace generelle {
     float GInverse::signedDist(const falg::Vec3& pos) const {
         return - this->s1->signedDist(pos);
     }
+
+    float GInverse::signedDistGrad(const falg::Vec3& pos, falg::Vec3& grad) const {
+        float dist = this->s1->signedDistGrad(pos, grad);
+        grad = - grad;
+        return - dist;
+    }
+
+    void GInverse::signedDistBatch(const float* xs, const float* ys, const float* zs,
+                                   float* out, size_t n) const {
+        this->s1->signedDistBatch(xs, ys, zs, out, n);
+        Kernels::scaleInPlace(out, n, -1.0f);
+    }
+
+    Interval GInverse::signedDistInterval(const IntervalBox& box) const {
+        return - this->s1->signedDistInterval(box);
+    }
+
+    IGE GInverse::specialize(const IGE& self, const IntervalBox& box, Interval& range) const {
+        Interval r1;
+        IGE n1 = this->s1->specialize(this->s1, box, r1);
+        range = - r1;
+
+        if (n1 == this->s1) {
+            return self;
+        }
+        return IGE(new GInverse(n1));
+    }
+
+    IGE GInverse::deduplicate(const IGE& self, ExpressionPool& pool) const {
+        IGE n1 = pool.deduplicate(this->s1);
+        IGE node = n1 == this->s1 ? self : IGE(new GInverse(n1));
+        return pool.intern(node, NodeKey(typeid(GInverse), { }, { n1 }));
+    }
+
+    IGE GInverse::simplify(const IGE& self, Simplifier& simplifier) const {
+        IGE n1 = simplifier.simplify(this->s1);
+
+        // Two inverses cancel
+        const GInverse* nested = dynamic_cast<const GInverse*>(n1.get());
+        if (nested) {
+            return nested->s1;
+        }
+
+        if (n1 == this->s1) {
+            return self;
+        }
+        return IGE(new GInverse(n1));
+    }
+
+    int GInverse::compile(TapeBuilder& builder, int pos) const {
+        int c1 = builder.compile(this->s1.get(), pos);
+        return builder.emitAffine(c1, -1.0f, 0.0f);
+    }
+
+
+    /*
+     * GUnion member functions
+     */
+
+    // Lower bound on the distance of a child with the given bounds at pos, -inf inside the bounds
+    static float lowerBound(const falg::Vec3& pos, const falg::Vec3& min, const falg::Vec3& max) {
+        float dx = std::max(std::max(min.x() - pos.x(), pos.x() - max.x()), 0.0f);
+        float dy = std::max(std::max(min.y() - pos.y(), pos.y() - max.y()), 0.0f);
+        float dz = std::max(std::max(min.z() - pos.z(), pos.z() - max.z()), 0.0f);
+        float sq = dx * dx + dy * dy + dz * dz;
+
+        return sq > 0 ? sqrtf(sq) : - std::numeric_limits<float>::infinity();
+    }
+
+    // Lower bound on the distance of a child with the given bounds anywhere in the box, -inf if they overlap
+    static float lowerBound(const IntervalBox& box, const falg::Vec3& min, const falg::Vec3& max) {
+        float dx = std::max(std::max(min.x() - box.x.hi, box.x.lo - max.x()), 0.0f);
+        float dy = std::max(std::max(min.y() - box.y.hi, box.y.lo - max.y()), 0.0f);
+        float dz = std::max(std::max(min.z() - box.z.hi, box.z.lo - max.z()), 0.0f);
+        float sq = dx * dx + dy * dy + dz * dz;
+
+        return sq > 0 ? sqrtf(sq) : - std::numeric_limits<float>::infinity();
+    }
+
+    // Deepest BVH supported by the traversal stacks
+    static const int max_bvh_depth = 64;
+
+    // Children per BVH leaf
+    static const int bvh_leaf_size = 2;
+
+    // Batches of at least this many points are culled by the box around each chunk, instead of per point
+    static const size_t union_batch_cull_size = 16;
+
+    void GUnion::flatten(const IGE& node, std::vector<IGE>& children) {
+        const GUnion* u = dynamic_cast<const GUnion*>(node.get());
+        const GAdd* add = dynamic_cast<const GAdd*>(node.get());
+
+        if (u) {
+            children.insert(children.end(), u->children.begin(), u->children.end());
+        } else if (add) {
+            children.push_back(add->s1);
+            children.push_back(add->s2);
+        } else {
+            children.push_back(node);
+        }
+    }
+
+    GUnion::GUnion(const std::vector<IGE>& children) {
+        std::vector<IGE> bounded;
+        std::vector<Bounds> bounded_boxes;
+
+        for (const IGE& child : children) {
+            Bounds b;
+            if (child->bounds(b.min, b.max)) {
+                bounded.push_back(child);
+                bounded_boxes.push_back(b);
+            } else {
+                this->children.push_back(child);
+            }
+        }
+
+        this->addBounded(bounded, bounded_boxes);
+    }
+
+    GUnion::GUnion(const std::vector<IGE>& unbounded, const std::vector<IGE>& bounded,
+                   const std::vector<Bounds>& bounded_boxes) : children(unbounded) {
+        this->addBounded(bounded, bounded_boxes);
+    }
+
+    // Appends the bounded children after the unbounded ones, and builds the BVH over them
+    void GUnion::addBounded(const std::vector<IGE>& bounded, const std::vector<Bounds>& bounded_boxes) {
+        this->num_unbounded = this->children.size();
+        this->child_bounds = std::vector<Bounds>(this->num_unbounded);
+        this->children.insert(this->children.end(), bounded.begin(), bounded.end());
+        this->child_bounds.insert(this->child_bounds.end(), bounded_boxes.begin(), bounded_boxes.end());
+
+        if (!bounded.empty()) {
+            this->buildNode(this->num_unbounded, bounded.size());
+        }
+    }
+
+    // Builds the subtree over children [first, first + count), splitting at the median along the longest axis
+    // of the box centers. Returns the index of the node
+    int GUnion::buildNode(int first, int count) {
+        int index = this->nodes.size();
+        this->nodes.push_back(BvhNode { this->child_bounds[first], -1, first, count });
+
+        falg::Vec3 center_min = (this->child_bounds[first].min + this->child_bounds[first].max) / 2;
+        falg::Vec3 center_max = center_min;
+        for (int i = first; i < first + count; i++) {
+            const Bounds& b = this->child_bounds[i];
+            boxUnion(this->nodes[index].bounds.min, this->nodes[index].bounds.max, b.min, b.max);
+
+            falg::Vec3 center = (b.min + b.max) / 2;
+            boxUnion(center_min, center_max, center, center);
+        }
+
+        if (count <= bvh_leaf_size) {
+            return index;
+        }
+
+        falg::Vec3 extent = center_max - center_min;
+        int axis = extent.x() > extent.y() ? 0 : 1;
+        axis = extent[axis] > extent.z() ? axis : 2;
+
+        // Sort an index permutation, then apply it to the children and their bounds
+        std::vector<int> order(count);
+        for (int i = 0; i < count; i++) {
+            order[i] = first + i;
+        }
+
+        int half = count / 2;
+        std::nth_element(order.begin(), order.begin() + half, order.end(), [this, axis](int a, int b) {
+            return this->child_bounds[a].min[axis] + this->child_bounds[a].max[axis] <
+                this->child_bounds[b].min[axis] + this->child_bounds[b].max[axis];
+        });
+
+        std::vector<IGE> sorted_children(count);
+        std::vector<Bounds> sorted_bounds(count);
+        for (int i = 0; i < count; i++) {
+            sorted_children[i] = this->children[order[i]];
+            sorted_bounds[i] = this->child_bounds[order[i]];
+        }
+        std::copy(sorted_children.begin(), sorted_children.end(), this->children.begin() + first);
+        std::copy(sorted_bounds.begin(), sorted_bounds.end(), this->child_bounds.begin() + first);
+
+        this->nodes[index].count = 0;
+        this->buildNode(first, half);
+        int right = this->buildNode(first + half, count - half);
+        this->nodes[index].right = right;
+
+        return index;
+    }
+
+    const InnerGeometricExpression* GUnion::nearestChild(const falg::Vec3& pos, float& best) const {
+        const InnerGeometricExpression* nearest = nullptr;
+        best = std::numeric_limits<float>::infinity();
+
+        for (int i = 0; i < this->num_unbounded; i++) {
+            float dist = this->children[i]->signedDist(pos);
+            if (nearest == nullptr || dist < best) {
+                best = dist;
+                nearest = this->children[i].get();
+            }
+        }
+
+        if (this->nodes.empty()) {
+            return nearest;
+        }
+
+        int stack[max_bvh_depth];
+        int stack_size = 0;
+        stack[stack_size++] = 0;
+
+        while (stack_size > 0) {
+            const BvhNode& node = this->nodes[stack[--stack_size]];
+            if (lowerBound(pos, node.bounds.min, node.bounds.max) >= best) {
+                continue;
+            }
+
+            if (node.count > 0) {
+                for (int i = node.first; i < node.first + node.count; i++) {
+                    if (lowerBound(pos, this->child_bounds[i].min, this->child_bounds[i].max) >= best) {
+                        continue;
+                    }
+
+                    float dist = this->children[i]->signedDist(pos);
+                    if (nearest == nullptr || dist < best) {
+                        best = dist;
+                        nearest = this->children[i].get();
+                    }
+                }
+                continue;
+            }
+
+            // Visit the nearer child first, so that more of the farther one can be skipped
+            int left = &node - this->nodes.data() + 1;
+            int right = node.right;
+            const Bounds& lb = this->nodes[left].bounds;
+            const Bounds& rb = this->nodes[right].bounds;
+            if (lowerBound(pos, lb.min, lb.max) < lowerBound(pos, rb.min, rb.max)) {
+                std::swap(left, right);
+            }
+            stack[stack_size++] = left;
+            stack[stack_size++] = right;
+        }
+
+        return nearest;
+    }
+
+    float GUnion::signedDist(const falg::Vec3& pos) const {
+        float best;
+        this->nearestChild(pos, best);
+        return best;
+    }
+
+    float GUnion::signedDistGrad(const falg::Vec3& pos, falg::Vec3& grad) const {
+        float best;
+        const InnerGeometricExpression* nearest = this->nearestChild(pos, best);
+        if (nearest == nullptr) {
+            grad = falg::Vec3(0.0f, 0.0f, 0.0f);
+            return best;
+        }
+        return nearest->signedDistGrad(pos, grad);
+    }
+
+    void GUnion::signedDistBatch(const float* xs, const float* ys, const float* zs,
+                                 float* out, size_t n) const {
+        float tmp[batch_chunk_size];
+        std::vector<int> visited;
+        std::vector<Interval> ranges;
+
+        // Few points are traversed one by one, such as the packets of the ray marcher
+        if (n < union_batch_cull_size) {
+            for (size_t i = 0; i < n; i++) {
+                this->nearestChild(falg::Vec3(xs[i], ys[i], zs[i]), out[i]);
+            }
+            return;
+        }
+
+        for (size_t base = 0; base < n; base += batch_chunk_size) {
+            size_t m = std::min(batch_chunk_size, n - base);
+
+            // Only children that may be the smallest somewhere in the box around the chunk are evaluated.
+            // Those are evaluated for all points, which keeps scattered chunks as fast as a chain of GAdd
+            Interval bx(xs[base]), by(ys[base]), bz(zs[base]);
+            for (size_t i = base + 1; i < base + m; i++) {
+                bx = IntervalMath::hull(bx, Interval(xs[i]));
+                by = IntervalMath::hull(by, Interval(ys[i]));
+                bz = IntervalMath::hull(bz, Interval(zs[i]));
+            }
+
+            visited.clear();
+            ranges.clear();
+            this->collectInBox(IntervalBox(bx, by, bz), visited, ranges, nullptr);
+
+            float best_hi = std::numeric_limits<float>::infinity();
+            for (const Interval& r : ranges) {
+                best_hi = std::min(best_hi, r.hi);
+            }
+
+            std::fill(out + base, out + base + m, std::numeric_limits<float>::infinity());
+            for (unsigned int i = 0; i < visited.size(); i++) {
+                if (ranges[i].lo > best_hi) {
+                    continue;
+                }
+
+                this->children[visited[i]]->signedDistBatch(xs + base, ys + base, zs + base, tmp, m);
+                Kernels::minInPlace(out + base, tmp, m);
+            }
+        }
+    }
+
+    void GUnion::collectInBox(const IntervalBox& box, std::vector<int>& visited, std::vector<Interval>& ranges,
+                              std::vector<IGE>* specialized) const {
+        float best_hi = std::numeric_limits<float>::infinity();
+
+        auto visit = [&](int i) {
+            Interval range;
+            if (specialized) {
+                specialized->push_back(this->children[i]->specialize(this->children[i], box, range));
+            } else {
+                range = this->children[i]->signedDistInterval(box);
+            }
+
+            visited.push_back(i);
+            ranges.push_back(range);
+            best_hi = std::min(best_hi, range.hi);
+        };
+
+        for (int i = 0; i < this->num_unbounded; i++) {
+            visit(i);
+        }
+
+        if (this->nodes.empty()) {
+            return;
+        }
+
+        // Children farther from the box than best_hi are larger than some other child everywhere in it
+        int stack[max_bvh_depth];
+        int stack_size = 0;
+        stack[stack_size++] = 0;
+
+        while (stack_size > 0) {
+            const BvhNode& node = this->nodes[stack[--stack_size]];
+            if (lowerBound(box, node.bounds.min, node.bounds.max) > best_hi) {
+                continue;
+            }
+
+            if (node.count > 0) {
+                for (int i = node.first; i < node.first + node.count; i++) {
+                    if (lowerBound(box, this->child_bounds[i].min, this->child_bounds[i].max) <= best_hi) {
+                        visit(i);
+                    }
+                }
+                continue;
+            }
+
+            int left = &node - this->nodes.data() + 1;
+            int right = node.right;
+            const Bounds& lb = this->nodes[left].bounds;
+            const Bounds& rb = this->nodes[right].bounds;
+            if (lowerBound(box, lb.min, lb.max) < lowerBound(box, rb.min, rb.max)) {
+                std::swap(left, right);
+            }
+            stack[stack_size++] = left;
+            stack[stack_size++] = right;
+        }
+    }
+
+    Interval GUnion::signedDistInterval(const IntervalBox& box) const {
+        std::vector<int> visited;
+        std::vector<Interval> ranges;
+        this->collectInBox(box, visited, ranges, nullptr);
+
+        Interval range(std::numeric_limits<float>::infinity());
+        for (const Interval& r : ranges) {
+            range = IntervalMath::min(range, r);
+        }
+        return range;
+    }
+
+    IGE GUnion::specialize(const IGE& self, const IntervalBox& box, Interval& range) const {
+        std::vector<int> visited;
+        std::vector<Interval> ranges;
+        std::vector<IGE> specialized;
+        this->collectInBox(box, visited, ranges, &specialized);
+
+        range = Interval(std::numeric_limits<float>::infinity());
+        for (const Interval& r : ranges) {
+            range = IntervalMath::min(range, r);
+        }
+
+        // Keep the children that are not larger than another child everywhere in the box. Children that
+        // were not changed by specialization keep their bounds
+        std::vector<IGE> unbounded, bounded;
+        std::vector<Bounds> bounded_boxes;
+        bool unchanged = visited.size() == this->children.size();
+        for (unsigned int i = 0; i < visited.size(); i++) {
+            if (ranges[i].lo > range.hi) {
+                unchanged = false;
+                continue;
+            }
+
+            const IGE& child = specialized[i];
+            Bounds b;
+            if (child == this->children[visited[i]]) {
+                if (visited[i] < this->num_unbounded) {
+                    unbounded.push_back(child);
+                } else {
+                    bounded.push_back(child);
+                    bounded_boxes.push_back(this->child_bounds[visited[i]]);
+                }
+            } else if (child->bounds(b.min, b.max)) {
+                unchanged = false;
+                bounded.push_back(child);
+                bounded_boxes.push_back(b);
+            } else {
+                unchanged = false;
+                unbounded.push_back(child);
+            }
+        }
+
+        if (unchanged) {
+            return self;
+        } else if (unbounded.size() + bounded.size() == 1) {
+            return unbounded.empty() ? bounded[0] : unbounded[0];
+        }
+        return IGE(new GUnion(unbounded, bounded, bounded_boxes));
+    }
+
+    IGE GUnion::deduplicate(const IGE& self, ExpressionPool& pool) const {
+        std::vector<IGE> deduplicated;
+        bool unchanged = true;
+        for (const IGE& child : this->children) {
+            deduplicated.push_back(pool.deduplicate(child));
+            unchanged &= deduplicated.back() == child;
+        }
+
+        IGE node = unchanged ? self : IGE(new GUnion(deduplicated));
+        return pool.intern(node, NodeKey(typeid(GUnion), { }, deduplicated));
+    }
+
+    IGE GUnion::simplify(const IGE& self, Simplifier& simplifier) const {
+        std::vector<IGE> flattened;
+        bool unchanged = true;
+        for (const IGE& child : this->children) {
+            IGE simplified = simplifier.simplify(child);
+            GUnion::flatten(simplified, flattened);
+            unchanged &= simplified == child && flattened.back() == child;
+        }
+
+        if (unchanged) {
+            return self;
+        } else if (flattened.size() == 1) {
+            return flattened[0];
+        }
+        return IGE(new GUnion(flattened));
+    }
+
+    bool GUnion::bounds(falg::Vec3& min, falg::Vec3& max) const {
+        if (this->num_unbounded > 0 || this->nodes.empty()) {
+            return false;
+        }
+
+        min = this->nodes[0].bounds.min;
+        max = this->nodes[0].bounds.max;
+        return true;
+    }
+
+
+    /*
+     * GMultiIntersect member functions
+     */
+
+    GMultiIntersect::GMultiIntersect(const std::vector<IGE>& children) : children(children) { }
+
+    void GMultiIntersect::flatten(const IGE& node, std::vector<IGE>& children) {
+        const GMultiIntersect* multi = dynamic_cast<const GMultiIntersect*>(node.get());
+        const GIntersect* intersect = dynamic_cast<const GIntersect*>(node.get());
+
+        if (multi) {
+            children.insert(children.end(), multi->children.begin(), multi->children.end());
+        } else if (intersect) {
+            children.push_back(intersect->s1);
+            children.push_back(intersect->s2);
+        } else {
+            children.push_back(node);
+        }
+    }
+
+    float GMultiIntersect::signedDist(const falg::Vec3& pos) const {
+        float dist = this->children[0]->signedDist(pos);
+        for (unsigned int i = 1; i < this->children.size(); i++) {
+            dist = std::max(dist, this->children[i]->signedDist(pos));
+        }
+        return dist;
+    }
+
+    float GMultiIntersect::signedDistGrad(const falg::Vec3& pos, falg::Vec3& grad) const {
+        float dist = this->children[0]->signedDistGrad(pos, grad);
+        for (unsigned int i = 1; i < this->children.size(); i++) {
+            falg::Vec3 g;
+            float c = this->children[i]->signedDistGrad(pos, g);
+
+            // Follows the choice of std::max
+            if (dist < c) {
+                dist = c;
+                grad = g;
+            }
+        }
+        return dist;
+    }
+
+    void GMultiIntersect::signedDistBatch(const float* xs, const float* ys, const float* zs,
+                                          float* out, size_t n) const {
+        float tmp[batch_chunk_size];
+        for (size_t base = 0; base < n; base += batch_chunk_size) {
+            size_t m = std::min(batch_chunk_size, n - base);
+            this->children[0]->signedDistBatch(xs + base, ys + base, zs + base, out + base, m);
+
+            for (unsigned int i = 1; i < this->children.size(); i++) {
+                this->children[i]->signedDistBatch(xs + base, ys + base, zs + base, tmp, m);
+                Kernels::maxInPlace(out + base, tmp, m);
+            }
+        }
+    }
+
+    Interval GMultiIntersect::signedDistInterval(const IntervalBox& box) const {
+        Interval range = this->children[0]->signedDistInterval(box);
+        for (unsigned int i = 1; i < this->children.size(); i++) {
+            range = IntervalMath::max(range, this->children[i]->signedDistInterval(box));
+        }
+        return range;
+    }
+
+    IGE GMultiIntersect::specialize(const IGE& self, const IntervalBox& box, Interval& range) const {
+        std::vector<IGE> specialized;
+        std::vector<Interval> ranges;
+        for (const IGE& child : this->children) {
+            Interval r;
+            specialized.push_back(child->specialize(child, box, r));
+            ranges.push_back(r);
+            range = ranges.size() == 1 ? r : IntervalMath::max(range, r);
+        }
+
+        // Drop the children that are smaller than another child everywhere in the box
+        std::vector<IGE> kept;
+        bool unchanged = true;
+        for (unsigned int i = 0; i < this->children.size(); i++) {
+            if (ranges[i].hi < range.lo) {
+                unchanged = false;
+                continue;
+            }
+
+            kept.push_back(specialized[i]);
+            unchanged &= specialized[i] == this->children[i];
+        }
+
+        if (unchanged) {
+            return self;
+        } else if (kept.size() == 1) {
+            return kept[0];
+        }
+        return IGE(new GMultiIntersect(kept));
+    }
+
+    IGE GMultiIntersect::deduplicate(const IGE& self, ExpressionPool& pool) const {
+        std::vector<IGE> deduplicated;
+        bool unchanged = true;
+        for (const IGE& child : this->children) {
+            deduplicated.push_back(pool.deduplicate(child));
+            unchanged &= deduplicated.back() == child;
+        }
+
+        IGE node = unchanged ? self : IGE(new GMultiIntersect(deduplicated));
+        return pool.intern(node, NodeKey(typeid(GMultiIntersect), { }, deduplicated));
+    }
+
+    IGE GMultiIntersect::simplify(const IGE& self, Simplifier& simplifier) const {
+        std::vector<IGE> flattened;
+        bool unchanged = true;
+        for (const IGE& child : this->children) {
+            IGE simplified = simplifier.simplify(child);
+            GMultiIntersect::flatten(simplified, flattened);
+            unchanged &= simplified == child && flattened.back() == child;
+        }
+
+        if (unchanged) {
+            return self;
+        } else if (flattened.size() == 1) {
+            return flattened[0];
+        }
+        return IGE(new GMultiIntersect(flattened));
+    }
+
+    int GMultiIntersect::compile(TapeBuilder& builder, int pos) const {
+        int result = builder.compile(this->children[0].get(), pos);
+        for (unsigned int i = 1; i < this->children.size(); i++) {
+            result = builder.emitMax(result, builder.compile(this->children[i].get(), pos));
+        }
+        return result;
+    }
+
+    bool GMultiIntersect::bounds(falg::Vec3& min, falg::Vec3& max) const {
+        // The distance is at least that of each child, so each box holds. Pick the smallest
+        bool bounded = false;
+        for (const IGE& child : this->children) {
+            falg::Vec3 child_min, child_max;
+            if (child->bounds(child_min, child_max) &&
+                (!bounded || boxVolume(child_min, child_max) < boxVolume(min, max))) {
+                min = child_min;
+                max = child_max;
+                bounded = true;
+            }
+        }
+        return bounded;
+    }
+
+
+    /*
+     * Union constructor function
+     */
+
+    GE makeUnion(const std::vector<GE>& ges) {
+        if (ges.size() == 1) {
+            return ges[0];
+        }
+
+        std::vector<IGE> children;
+        for (const GE& ge : ges) {
+            children.push_back(ge.ige);
+        }
+        return GeometricExpression(new GUnion(children));
+    }
 };
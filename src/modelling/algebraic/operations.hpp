@@ -2,6 +2,8 @@
 
 #include "algebraic.hpp"
 
+#include <vector>
+
 namespace generelle {
 
     typedef std::shared_ptr<InnerGeometricExpression> IGE;
@@ -12,12 +14,22 @@ namespace generelle {
     
     class GAdd : public InnerGeometricExpression {
         const IGE s1, s2;
+
+        friend class GUnion;
     public:
         GAdd(const IGE& s1,
              const IGE& s2);
         
         virtual float signedDist(const falg::Vec3& pos) const;
-        virtual falg::Vec3 normal(const falg::Vec3& pos) const;
+        virtual float signedDistGrad(const falg::Vec3& pos, falg::Vec3& grad) const;
+        virtual void signedDistBatch(const float* xs, const float* ys, const float* zs,
+                                     float* out, size_t n) const;
+        virtual Interval signedDistInterval(const IntervalBox& box) const;
+        virtual IGE specialize(const IGE& self, const IntervalBox& box, Interval& range) const;
+        virtual IGE deduplicate(const IGE& self, ExpressionPool& pool) const;
+        virtual IGE simplify(const IGE& self, Simplifier& simplifier) const;
+        virtual int compile(TapeBuilder& builder, int pos) const;
+        virtual bool bounds(falg::Vec3& min, falg::Vec3& max) const;
     };
 
 
@@ -33,6 +45,15 @@ namespace generelle {
                    const IGE& s2, float k);
 
         virtual float signedDist(const falg::Vec3& pos) const;
+        virtual float signedDistGrad(const falg::Vec3& pos, falg::Vec3& grad) const;
+        virtual void signedDistBatch(const float* xs, const float* ys, const float* zs,
+                                     float* out, size_t n) const;
+        virtual Interval signedDistInterval(const IntervalBox& box) const;
+        virtual IGE specialize(const IGE& self, const IntervalBox& box, Interval& range) const;
+        virtual IGE deduplicate(const IGE& self, ExpressionPool& pool) const;
+        virtual IGE simplify(const IGE& self, Simplifier& simplifier) const;
+        virtual int compile(TapeBuilder& builder, int pos) const;
+        virtual bool bounds(falg::Vec3& min, falg::Vec3& max) const;
     };
 
 
@@ -47,6 +68,15 @@ namespace generelle {
         GPad(const IGE& s1, float r);
 
         virtual float signedDist(const falg::Vec3& pos) const;
+        virtual float signedDistGrad(const falg::Vec3& pos, falg::Vec3& grad) const;
+        virtual void signedDistBatch(const float* xs, const float* ys, const float* zs,
+                                     float* out, size_t n) const;
+        virtual Interval signedDistInterval(const IntervalBox& box) const;
+        virtual IGE specialize(const IGE& self, const IntervalBox& box, Interval& range) const;
+        virtual IGE deduplicate(const IGE& self, ExpressionPool& pool) const;
+        virtual IGE simplify(const IGE& self, Simplifier& simplifier) const;
+        virtual int compile(TapeBuilder& builder, int pos) const;
+        virtual bool bounds(falg::Vec3& min, falg::Vec3& max) const;
     };
 
 
@@ -56,10 +86,21 @@ namespace generelle {
 
     class GIntersect : public InnerGeometricExpression {
         const IGE s1, s2;
+
+        friend class GMultiIntersect;
     public:
         GIntersect(const IGE& s1, const IGE& s2);
 
         virtual float signedDist(const falg::Vec3& pos) const;
+        virtual float signedDistGrad(const falg::Vec3& pos, falg::Vec3& grad) const;
+        virtual void signedDistBatch(const float* xs, const float* ys, const float* zs,
+                                     float* out, size_t n) const;
+        virtual Interval signedDistInterval(const IntervalBox& box) const;
+        virtual IGE specialize(const IGE& self, const IntervalBox& box, Interval& range) const;
+        virtual IGE deduplicate(const IGE& self, ExpressionPool& pool) const;
+        virtual IGE simplify(const IGE& self, Simplifier& simplifier) const;
+        virtual int compile(TapeBuilder& builder, int pos) const;
+        virtual bool bounds(falg::Vec3& min, falg::Vec3& max) const;
     };
 
 
@@ -73,5 +114,98 @@ namespace generelle {
         GInverse(const IGE& s1);
 
         virtual float signedDist(const falg::Vec3& pos) const;
+        virtual float signedDistGrad(const falg::Vec3& pos, falg::Vec3& grad) const;
+        virtual void signedDistBatch(const float* xs, const float* ys, const float* zs,
+                                     float* out, size_t n) const;
+        virtual Interval signedDistInterval(const IntervalBox& box) const;
+        virtual IGE specialize(const IGE& self, const IntervalBox& box, Interval& range) const;
+        virtual IGE deduplicate(const IGE& self, ExpressionPool& pool) const;
+        virtual IGE simplify(const IGE& self, Simplifier& simplifier) const;
+        virtual int compile(TapeBuilder& builder, int pos) const;
+    };
+
+
+    /*
+     * GUnion - the union of any number of models, equal to a chain of GAdd. Children with bounds are kept in
+     * a bounding volume hierarchy, and are only evaluated where their bounds are closer than the nearest
+     * surface found so far. Batches are culled per chunk, by the box around its points
+     */
+
+    class GUnion : public InnerGeometricExpression {
+        struct Bounds {
+            falg::Vec3 min, max;
+        };
+
+        struct BvhNode {
+            Bounds bounds;
+
+            // Inner nodes have the left child right after them, and the right child at index right.
+            // Leaves have count > 0 and cover children [first, first + count)
+            int right, first, count;
+        };
+
+        // The first num_unbounded children have no bounds, and are always evaluated
+        std::vector<IGE> children;
+        int num_unbounded;
+
+        // Bounds of each child, unused for the unbounded ones
+        std::vector<Bounds> child_bounds;
+        std::vector<BvhNode> nodes;
+
+        // Takes the bounds of the bounded children, so that they need not be recomputed
+        GUnion(const std::vector<IGE>& unbounded, const std::vector<IGE>& bounded,
+               const std::vector<Bounds>& bounded_boxes);
+
+        void addBounded(const std::vector<IGE>& bounded, const std::vector<Bounds>& bounded_boxes);
+        int buildNode(int first, int count);
+
+        // Returns the child with the smallest distance, and stores the distance in best
+        const InnerGeometricExpression* nearestChild(const falg::Vec3& pos, float& best) const;
+
+        // Ranges over the box of every child that may be the smallest in it, the others are skipped
+        // Stores the children specialized to the box in specialized, if not null
+        void collectInBox(const IntervalBox& box, std::vector<int>& visited, std::vector<Interval>& ranges,
+                          std::vector<IGE>* specialized) const;
+
+    public:
+        GUnion(const std::vector<IGE>& children);
+
+        // Appends the operands of node to children if it is a union or GAdd, or else node itself
+        static void flatten(const IGE& node, std::vector<IGE>& children);
+
+        virtual float signedDist(const falg::Vec3& pos) const;
+        virtual float signedDistGrad(const falg::Vec3& pos, falg::Vec3& grad) const;
+        virtual void signedDistBatch(const float* xs, const float* ys, const float* zs,
+                                     float* out, size_t n) const;
+        virtual Interval signedDistInterval(const IntervalBox& box) const;
+        virtual IGE specialize(const IGE& self, const IntervalBox& box, Interval& range) const;
+        virtual IGE deduplicate(const IGE& self, ExpressionPool& pool) const;
+        virtual IGE simplify(const IGE& self, Simplifier& simplifier) const;
+        virtual bool bounds(falg::Vec3& min, falg::Vec3& max) const;
+    };
+
+
+    /*
+     * GMultiIntersect - intersects any number of models, equal to a chain of GIntersect
+     */
+
+    class GMultiIntersect : public InnerGeometricExpression {
+        std::vector<IGE> children;
+    public:
+        GMultiIntersect(const std::vector<IGE>& children);
+
+        // Appends the operands of node to children if it is an intersection, or else node itself
+        static void flatten(const IGE& node, std::vector<IGE>& children);
+
+        virtual float signedDist(const falg::Vec3& pos) const;
+        virtual float signedDistGrad(const falg::Vec3& pos, falg::Vec3& grad) const;
+        virtual void signedDistBatch(const float* xs, const float* ys, const float* zs,
+                                     float* out, size_t n) const;
+        virtual Interval signedDistInterval(const IntervalBox& box) const;
+        virtual IGE specialize(const IGE& self, const IntervalBox& box, Interval& range) const;
+        virtual IGE deduplicate(const IGE& self, ExpressionPool& pool) const;
+        virtual IGE simplify(const IGE& self, Simplifier& simplifier) const;
+        virtual int compile(TapeBuilder& builder, int pos) const;
+        virtual bool bounds(falg::Vec3& min, falg::Vec3& max) const;
     };
 };
@@ -1,4 +1,7 @@
 #include "shapes.hpp"
+#include "kernels.hpp"
+#include "compiled.hpp"
+#include "expression_pool.hpp"
 
 namespace generelle {
 
@@ -9,18 +12,75 @@ namespace generelle {
     Box::Box(const falg::Vec3& span) : span(span) { }
 
     float Box::signedDist(const falg::Vec3& pos) const {
-        float adx = std::abs(pos.x()) - std::abs(span.x());
-        float ady = std::abs(pos.y()) - std::abs(span.y());
-        float adz = std::abs(pos.z()) - std::abs(span.z());
+        return Kernels::boxDist(pos.x(), pos.y(), pos.z(),
+                                std::abs(span.x()), std::abs(span.y()), std::abs(span.z()));
+    }
+
+    float Box::signedDistGrad(const falg::Vec3& pos, falg::Vec3& grad) const {
+        falg::Vec3 sign(pos.x() < 0 ? -1.0f : 1.0f, pos.y() < 0 ? -1.0f : 1.0f, pos.z() < 0 ? -1.0f : 1.0f);
+        falg::Vec3 ad(std::abs(pos.x()) - std::abs(span.x()),
+                      std::abs(pos.y()) - std::abs(span.y()),
+                      std::abs(pos.z()) - std::abs(span.z()));
+
+        float dist = Kernels::boxDist(pos.x(), pos.y(), pos.z(),
+                                      std::abs(span.x()), std::abs(span.y()), std::abs(span.z()));
+
+        if (std::max(std::max(ad.x(), ad.y()), ad.z()) <= 0) {
+            // Inside or on the surface, the gradient is the normal of the closest face. Both branches give
+            // a distance of 0 on the surface, but only this one a nonzero gradient there
+            int axis = ad.x() < ad.y() ? 1 : 0;
+            axis = ad[axis] < ad.z() ? 2 : axis;
+
+            grad = falg::Vec3(0.0f, 0.0f, 0.0f);
+            grad[axis] = sign[axis];
+        } else {
+            falg::Vec3 outside(std::max(0.0f, ad.x()), std::max(0.0f, ad.y()), std::max(0.0f, ad.z()));
+            grad = dist > 0 ? outside * sign / dist : falg::Vec3(0.0f, 0.0f, 0.0f);
+        }
+
+        return dist;
+    }
+
+    void Box::signedDistBatch(const float* xs, const float* ys, const float* zs,
+                              float* out, size_t n) const {
+        Kernels::boxDist(xs, ys, zs, out, n,
+                         std::abs(span.x()), std::abs(span.y()), std::abs(span.z()));
+    }
 
-        float sx = std::max(0.0f, adx);
-        float sy = std::max(0.0f, ady);
-        float sz = std::max(0.0f, adz);
+    Interval Box::signedDistInterval(const IntervalBox& box) const {
+        Interval adx = IntervalMath::abs(box.x) - std::abs(span.x());
+        Interval ady = IntervalMath::abs(box.y) - std::abs(span.y());
+        Interval adz = IntervalMath::abs(box.z) - std::abs(span.z());
 
-        float dd = sqrtf(sx * sx + sy * sy + sz * sz);
-        float di = std::max(std::max(adx, ady), adz);
+        Interval sx = IntervalMath::max(Interval(0.0f), adx);
+        Interval sy = IntervalMath::max(Interval(0.0f), ady);
+        Interval sz = IntervalMath::max(Interval(0.0f), adz);
 
-        return di < 0 ? di : dd;
+        Interval dd = IntervalMath::sqrt(IntervalMath::sqr(sx) + IntervalMath::sqr(sy) + IntervalMath::sqr(sz));
+        Interval di = IntervalMath::max(IntervalMath::max(adx, ady), adz);
+
+        if (di.hi < 0) {
+            return di;
+        } else if (di.lo >= 0) {
+            return dd;
+        }
+
+        // Both branches are possible, the inside branch only for negative di
+        return IntervalMath::hull(Interval(di.lo, 0.0f), dd);
+    }
+
+    IGE Box::deduplicate(const IGE& self, ExpressionPool& pool) const {
+        return pool.intern(self, NodeKey(typeid(Box), { this->span.x(), this->span.y(), this->span.z() }, { }));
+    }
+
+    int Box::compile(TapeBuilder& builder, int pos) const {
+        return builder.emitBox(pos, span);
+    }
+
+    bool Box::bounds(falg::Vec3& min, falg::Vec3& max) const {
+        max = falg::Vec3(std::abs(span.x()), std::abs(span.y()), std::abs(span.z()));
+        min = - max;
+        return true;
     }
 
 
@@ -31,11 +91,48 @@ namespace generelle {
     Cylinder::Cylinder(float radius, float length) : radius(radius), half_length(length / 2) { }
 
     float Cylinder::signedDist(const falg::Vec3& pos) const {
-        float dr = falg::Vec2(pos.y(), pos.z()).norm() - radius;
+        return Kernels::cylinderDist(pos.x(), pos.y(), pos.z(), radius, half_length);
+    }
+
+    float Cylinder::signedDistGrad(const falg::Vec3& pos, falg::Vec3& grad) const {
+        float rho = sqrtf(pos.y() * pos.y() + pos.z() * pos.z());
+        float dr = rho - radius;
+        falg::Vec3 grad_dr = rho > 0 ? falg::Vec3(0.0f, pos.y() / rho, pos.z() / rho) : falg::Vec3(0.0f, 0.0f, 0.0f);
 
         float dx = std::abs(pos.x()) - half_length;
+        falg::Vec3 grad_dx(pos.x() < 0 ? -1.0f : 1.0f, 0.0f, 0.0f);
+
+        // Same branches as Kernels::cylinderDist
+        float inner = std::max(dx, dr);
+        falg::Vec3 grad_inner = dx < dr ? grad_dr : grad_dx;
+
+        float outer = sqrtf(dx * dx + dr * dr);
+        falg::Vec3 grad_outer = outer > 0 ? (dx * grad_dx + dr * grad_dr) / outer : falg::Vec3(0.0f, 0.0f, 0.0f);
+
+        grad = outer < inner ? grad_outer : grad_inner;
+        return Kernels::cylinderDist(pos.x(), pos.y(), pos.z(), radius, half_length);
+    }
 
-        return std::min(std::max(dx, dr), sqrtf(dx * dx + dr * dr));
+    void Cylinder::signedDistBatch(const float* xs, const float* ys, const float* zs,
+                                   float* out, size_t n) const {
+        Kernels::cylinderDist(xs, ys, zs, out, n, radius, half_length);
+    }
+
+    Interval Cylinder::signedDistInterval(const IntervalBox& box) const {
+        Interval dr = IntervalMath::sqrt(IntervalMath::sqr(box.y) + IntervalMath::sqr(box.z)) - radius;
+
+        Interval dx = IntervalMath::abs(box.x) - half_length;
+
+        return IntervalMath::min(IntervalMath::max(dx, dr),
+                                 IntervalMath::sqrt(IntervalMath::sqr(dx) + IntervalMath::sqr(dr)));
+    }
+
+    IGE Cylinder::deduplicate(const IGE& self, ExpressionPool& pool) const {
+        return pool.intern(self, NodeKey(typeid(Cylinder), { this->radius, this->half_length }, { }));
+    }
+
+    int Cylinder::compile(TapeBuilder& builder, int pos) const {
+        return builder.emitCylinder(pos, radius, half_length);
     }
 
 
@@ -46,11 +143,37 @@ namespace generelle {
     Sphere::Sphere(float radius) : radius(radius) { }
 
     float Sphere::signedDist(const falg::Vec3& pos) const {
-        return pos.norm() - this->radius;
+        return Kernels::sphereDist(pos.x(), pos.y(), pos.z(), this->radius);
+    }
+
+    float Sphere::signedDistGrad(const falg::Vec3& pos, falg::Vec3& grad) const {
+        float len = pos.norm();
+        grad = len > 0 ? pos / len : falg::Vec3(0.0f, 0.0f, 0.0f);
+        return Kernels::sphereDist(pos.x(), pos.y(), pos.z(), this->radius);
+    }
+
+    void Sphere::signedDistBatch(const float* xs, const float* ys, const float* zs,
+                                 float* out, size_t n) const {
+        Kernels::sphereDist(xs, ys, zs, out, n, this->radius);
+    }
+
+    Interval Sphere::signedDistInterval(const IntervalBox& box) const {
+        return box.norm() - this->radius;
+    }
+
+    IGE Sphere::deduplicate(const IGE& self, ExpressionPool& pool) const {
+        return pool.intern(self, NodeKey(typeid(Sphere), { this->radius }, { }));
+    }
+
+    int Sphere::compile(TapeBuilder& builder, int pos) const {
+        return builder.emitSphere(pos, this->radius);
     }
 
-    falg::Vec3 Sphere::normal(const falg::Vec3& pos) const {
-        return pos.normalized();
+    bool Sphere::bounds(falg::Vec3& min, falg::Vec3& max) const {
+        float r = std::abs(this->radius);
+        max = falg::Vec3(r, r, r);
+        min = - max;
+        return true;
     }
 
 
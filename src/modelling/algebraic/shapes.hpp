@@ -17,6 +17,13 @@ namespace generelle {
         Box(const falg::Vec3& span);
 
         virtual float signedDist(const falg::Vec3& pos) const;
+        virtual float signedDistGrad(const falg::Vec3& pos, falg::Vec3& grad) const;
+        virtual void signedDistBatch(const float* xs, const float* ys, const float* zs,
+                                     float* out, size_t n) const;
+        virtual Interval signedDistInterval(const IntervalBox& box) const;
+        virtual IGE deduplicate(const IGE& self, ExpressionPool& pool) const;
+        virtual int compile(TapeBuilder& builder, int pos) const;
+        virtual bool bounds(falg::Vec3& min, falg::Vec3& max) const;
     };
 
 
@@ -33,6 +40,12 @@ namespace generelle {
         Cylinder(float radius, float length);
 
         virtual float signedDist(const falg::Vec3& pos) const;
+        virtual float signedDistGrad(const falg::Vec3& pos, falg::Vec3& grad) const;
+        virtual void signedDistBatch(const float* xs, const float* ys, const float* zs,
+                                     float* out, size_t n) const;
+        virtual Interval signedDistInterval(const IntervalBox& box) const;
+        virtual IGE deduplicate(const IGE& self, ExpressionPool& pool) const;
+        virtual int compile(TapeBuilder& builder, int pos) const;
     };
 
 
@@ -48,7 +61,13 @@ namespace generelle {
         Sphere(float radius);
 
         virtual float signedDist(const falg::Vec3& pos) const;
-        virtual falg::Vec3 normal(const falg::Vec3& pos) const;
+        virtual float signedDistGrad(const falg::Vec3& pos, falg::Vec3& grad) const;
+        virtual void signedDistBatch(const float* xs, const float* ys, const float* zs,
+                                     float* out, size_t n) const;
+        virtual Interval signedDistInterval(const IntervalBox& box) const;
+        virtual IGE deduplicate(const IGE& self, ExpressionPool& pool) const;
+        virtual int compile(TapeBuilder& builder, int pos) const;
+        virtual bool bounds(falg::Vec3& min, falg::Vec3& max) const;
     };
 
     GE makeBox(const falg::Vec3& span);
@@ -0,0 +1,19 @@
+#include "simplifier.hpp"
+
+namespace generelle {
+
+    /*
+     * Simplifier member functions
+     */
+
+    IGE Simplifier::simplify(const IGE& node) {
+        auto it = this->simplified.find(node);
+        if (it != this->simplified.end()) {
+            return it->second;
+        }
+
+        IGE result = node->simplify(node, *this);
+        this->simplified[node] = result;
+        return result;
+    }
+};
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "algebraic.hpp"
+
+#include <unordered_map>
+
+namespace generelle {
+
+    /*
+     * Simplifier - rewrites expression trees into equivalent trees with fewer nodes
+     *
+     * Nodes take part through InnerGeometricExpression::simplify. Subtrees shared in the input are simplified once
+     */
+
+    class Simplifier {
+        std::unordered_map<IGE, IGE> simplified;
+
+    public:
+        // Returns the simplified form of node
+        IGE simplify(const IGE& node);
+    };
+};
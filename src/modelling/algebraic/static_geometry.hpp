@@ -0,0 +1,416 @@
+#pragma once
+
+#include "algebraic.hpp"
+#include "shapes.hpp"
+#include "operations.hpp"
+#include "transformations.hpp"
+#include "kernels.hpp"
+
+#include <FlatAlg.hpp>
+
+#include <algorithm>
+
+namespace generelle {
+
+    /*
+     * StaticGeometry - expression templates for models whose structure is known at compile time
+     *
+     * Every node is a value type holding its children by value, so signedDist of a whole model is one
+     * function the compiler can inline. Batches run the array kernels without any virtual calls. The
+     * distances are computed with the same operations as the corresponding dynamic nodes, and are bit for
+     * bit identical. Use expression() to get a GeometricExpression for combining with dynamic models
+     */
+
+    namespace StaticGeometry {
+
+        template<typename S>
+        class GStatic;
+
+        template<typename A, typename B>
+        struct Add;
+
+        template<typename A, typename B>
+        struct SmoothAdd;
+
+        template<typename A, typename B>
+        struct Intersect;
+
+        template<typename A>
+        struct Pad;
+
+        template<typename A>
+        struct Inverse;
+
+        template<typename A>
+        struct Translate;
+
+        template<typename A>
+        struct NonUniformScale;
+
+        template<typename A>
+        struct UniformScale;
+
+
+        /*
+         * Expression - base of all static nodes, giving them the same operations as GeometricExpression
+         *
+         * Derived must implement signedDist, signedDistChunk evaluating at most batch_chunk_size points given
+         * as SoA arrays, and dynamic, which builds the equivalent dynamic tree
+         */
+
+        template<typename Derived>
+        struct Expression {
+            const Derived& derived() const {
+                return static_cast<const Derived&>(*this);
+            }
+
+            template<typename Other>
+            Add<Derived, Other> add(const Other& other) const {
+                return Add<Derived, Other>(this->derived(), other);
+            }
+
+            template<typename Other>
+            Intersect<Derived, Inverse<Other>> subtract(const Other& other) const {
+                return Intersect<Derived, Inverse<Other>>(this->derived(), Inverse<Other>(other));
+            }
+
+            template<typename Other>
+            SmoothAdd<Derived, Other> smoothAdd(const Other& other, float k = 0.5f) const {
+                return SmoothAdd<Derived, Other>(this->derived(), other, k);
+            }
+
+            template<typename Other>
+            Intersect<Derived, Other> intersect(const Other& other) const {
+                return Intersect<Derived, Other>(this->derived(), other);
+            }
+
+            Pad<Derived> pad(float padding) const {
+                return Pad<Derived>(this->derived(), padding);
+            }
+
+            Inverse<Derived> inverse() const {
+                return Inverse<Derived>(this->derived());
+            }
+
+            Translate<Derived> translate(const falg::Vec3& d) const {
+                return Translate<Derived>(this->derived(), d);
+            }
+
+            NonUniformScale<Derived> scale(const falg::Vec3& scale) const {
+                return NonUniformScale<Derived>(this->derived(), scale);
+            }
+
+            UniformScale<Derived> scale(float scale) const {
+                return UniformScale<Derived>(this->derived(), scale);
+            }
+
+            // Wraps a copy of the model into a GeometricExpression
+            GeometricExpression expression() const {
+                return GeometricExpression(new GStatic<Derived>(this->derived()));
+            }
+        };
+
+
+        /*
+         * Shapes
+         */
+
+        struct Box : public Expression<Box> {
+            falg::Vec3 span;
+
+            Box(const falg::Vec3& span) : span(span) { }
+
+            float signedDist(const falg::Vec3& pos) const {
+                return Kernels::boxDist(pos.x(), pos.y(), pos.z(),
+                                        std::abs(span.x()), std::abs(span.y()), std::abs(span.z()));
+            }
+
+            void signedDistChunk(const float* xs, const float* ys, const float* zs, float* out, size_t n) const {
+                Kernels::boxDist(xs, ys, zs, out, n, std::abs(span.x()), std::abs(span.y()), std::abs(span.z()));
+            }
+
+            IGE dynamic() const {
+                return IGE(new generelle::Box(this->span));
+            }
+        };
+
+        struct Cylinder : public Expression<Cylinder> {
+            float radius, half_length;
+
+            // Aligned with the x-axis, centered at origo
+            Cylinder(float radius, float length) : radius(radius), half_length(length / 2) { }
+
+            float signedDist(const falg::Vec3& pos) const {
+                return Kernels::cylinderDist(pos.x(), pos.y(), pos.z(), this->radius, this->half_length);
+            }
+
+            void signedDistChunk(const float* xs, const float* ys, const float* zs, float* out, size_t n) const {
+                Kernels::cylinderDist(xs, ys, zs, out, n, this->radius, this->half_length);
+            }
+
+            IGE dynamic() const {
+                return IGE(new generelle::Cylinder(this->radius, 2 * this->half_length));
+            }
+        };
+
+        struct Sphere : public Expression<Sphere> {
+            float radius;
+
+            Sphere(float radius) : radius(radius) { }
+
+            float signedDist(const falg::Vec3& pos) const {
+                return Kernels::sphereDist(pos.x(), pos.y(), pos.z(), this->radius);
+            }
+
+            void signedDistChunk(const float* xs, const float* ys, const float* zs, float* out, size_t n) const {
+                Kernels::sphereDist(xs, ys, zs, out, n, this->radius);
+            }
+
+            IGE dynamic() const {
+                return IGE(new generelle::Sphere(this->radius));
+            }
+        };
+
+
+        /*
+         * Operations
+         */
+
+        template<typename A, typename B>
+        struct Add : public Expression<Add<A, B>> {
+            A s1;
+            B s2;
+
+            Add(const A& s1, const B& s2) : s1(s1), s2(s2) { }
+
+            float signedDist(const falg::Vec3& pos) const {
+                return std::min(this->s1.signedDist(pos), this->s2.signedDist(pos));
+            }
+
+            void signedDistChunk(const float* xs, const float* ys, const float* zs, float* out, size_t n) const {
+                float tmp[batch_chunk_size];
+                this->s1.signedDistChunk(xs, ys, zs, out, n);
+                this->s2.signedDistChunk(xs, ys, zs, tmp, n);
+                Kernels::minInPlace(out, tmp, n);
+            }
+
+            IGE dynamic() const {
+                return IGE(new GAdd(this->s1.dynamic(), this->s2.dynamic()));
+            }
+        };
+
+        template<typename A, typename B>
+        struct SmoothAdd : public Expression<SmoothAdd<A, B>> {
+            A s1;
+            B s2;
+            float k;
+
+            SmoothAdd(const A& s1, const B& s2, float k) : s1(s1), s2(s2), k(k) { }
+
+            float signedDist(const falg::Vec3& pos) const {
+                return Kernels::smoothMin(this->s1.signedDist(pos), this->s2.signedDist(pos), this->k);
+            }
+
+            void signedDistChunk(const float* xs, const float* ys, const float* zs, float* out, size_t n) const {
+                float tmp[batch_chunk_size];
+                this->s1.signedDistChunk(xs, ys, zs, out, n);
+                this->s2.signedDistChunk(xs, ys, zs, tmp, n);
+                Kernels::smoothMinInPlace(out, tmp, n, this->k);
+            }
+
+            IGE dynamic() const {
+                return IGE(new GSmoothAdd(this->s1.dynamic(), this->s2.dynamic(), this->k));
+            }
+        };
+
+        template<typename A, typename B>
+        struct Intersect : public Expression<Intersect<A, B>> {
+            A s1;
+            B s2;
+
+            Intersect(const A& s1, const B& s2) : s1(s1), s2(s2) { }
+
+            float signedDist(const falg::Vec3& pos) const {
+                return std::max(this->s1.signedDist(pos), this->s2.signedDist(pos));
+            }
+
+            void signedDistChunk(const float* xs, const float* ys, const float* zs, float* out, size_t n) const {
+                float tmp[batch_chunk_size];
+                this->s1.signedDistChunk(xs, ys, zs, out, n);
+                this->s2.signedDistChunk(xs, ys, zs, tmp, n);
+                Kernels::maxInPlace(out, tmp, n);
+            }
+
+            IGE dynamic() const {
+                return IGE(new GIntersect(this->s1.dynamic(), this->s2.dynamic()));
+            }
+        };
+
+        template<typename A>
+        struct Pad : public Expression<Pad<A>> {
+            A s1;
+            float r;
+
+            Pad(const A& s1, float r) : s1(s1), r(r) { }
+
+            float signedDist(const falg::Vec3& pos) const {
+                return this->s1.signedDist(pos) - this->r;
+            }
+
+            void signedDistChunk(const float* xs, const float* ys, const float* zs, float* out, size_t n) const {
+                this->s1.signedDistChunk(xs, ys, zs, out, n);
+                Kernels::affineInPlace(out, n, 1.0f, - this->r);
+            }
+
+            IGE dynamic() const {
+                return IGE(new GPad(this->s1.dynamic(), this->r));
+            }
+        };
+
+        template<typename A>
+        struct Inverse : public Expression<Inverse<A>> {
+            A s1;
+
+            Inverse(const A& s1) : s1(s1) { }
+
+            float signedDist(const falg::Vec3& pos) const {
+                return - this->s1.signedDist(pos);
+            }
+
+            void signedDistChunk(const float* xs, const float* ys, const float* zs, float* out, size_t n) const {
+                this->s1.signedDistChunk(xs, ys, zs, out, n);
+                Kernels::scaleInPlace(out, n, -1.0f);
+            }
+
+            IGE dynamic() const {
+                return IGE(new GInverse(this->s1.dynamic()));
+            }
+        };
+
+
+        /*
+         * Transformations
+         */
+
+        template<typename A>
+        struct Translate : public Expression<Translate<A>> {
+            A s1;
+            falg::Vec3 translation;
+
+            Translate(const A& s1, const falg::Vec3& d) : s1(s1), translation(d) { }
+
+            float signedDist(const falg::Vec3& pos) const {
+                return this->s1.signedDist(pos - this->translation);
+            }
+
+            void signedDistChunk(const float* xs, const float* ys, const float* zs, float* out, size_t n) const {
+                float txs[batch_chunk_size], tys[batch_chunk_size], tzs[batch_chunk_size];
+                Kernels::transformPoints(xs, ys, zs, txs, tys, tzs, n, 1.0f, 1.0f, 1.0f,
+                                         - this->translation.x(), - this->translation.y(), - this->translation.z());
+                this->s1.signedDistChunk(txs, tys, tzs, out, n);
+            }
+
+            IGE dynamic() const {
+                return IGE(new GTranslate(this->s1.dynamic(), this->translation));
+            }
+        };
+
+        template<typename A>
+        struct NonUniformScale : public Expression<NonUniformScale<A>> {
+            A s1;
+            falg::Vec3 scale, inv_scale;
+
+            NonUniformScale(const A& s1, const falg::Vec3& scale)
+                : s1(s1), scale(scale), inv_scale(falg::Vec3(1.0f / scale.x(), 1.0f / scale.y(), 1.0f / scale.z())) { }
+
+            float signedDist(const falg::Vec3& pos) const {
+                falg::Vec3 npos = pos * this->inv_scale;
+                float back_scale = Kernels::backScale(pos.x(), pos.y(), pos.z(), npos.x(), npos.y(), npos.z(),
+                                                      Kernels::backScaleAtOrigin(this->scale.x(), this->scale.y(), this->scale.z()));
+                return back_scale * this->s1.signedDist(npos);
+            }
+
+            void signedDistChunk(const float* xs, const float* ys, const float* zs, float* out, size_t n) const {
+                float txs[batch_chunk_size], tys[batch_chunk_size], tzs[batch_chunk_size];
+                Kernels::transformPoints(xs, ys, zs, txs, tys, tzs, n,
+                                         this->inv_scale.x(), this->inv_scale.y(), this->inv_scale.z(),
+                                         0.0f, 0.0f, 0.0f);
+                this->s1.signedDistChunk(txs, tys, tzs, out, n);
+                Kernels::backScaleInPlace(xs, ys, zs, txs, tys, tzs, out, n,
+                                          Kernels::backScaleAtOrigin(this->scale.x(), this->scale.y(), this->scale.z()));
+            }
+
+            IGE dynamic() const {
+                return IGE(new GNonUniformScale(this->s1.dynamic(), this->scale));
+            }
+        };
+
+        template<typename A>
+        struct UniformScale : public Expression<UniformScale<A>> {
+            A s1;
+            float inv_scale, scale;
+
+            UniformScale(const A& s1, float scale) : s1(s1), inv_scale(1.0f / scale), scale(scale) { }
+
+            float signedDist(const falg::Vec3& pos) const {
+                return this->scale * this->s1.signedDist(this->inv_scale * pos);
+            }
+
+            void signedDistChunk(const float* xs, const float* ys, const float* zs, float* out, size_t n) const {
+                float txs[batch_chunk_size], tys[batch_chunk_size], tzs[batch_chunk_size];
+                Kernels::transformPoints(xs, ys, zs, txs, tys, tzs, n,
+                                         this->inv_scale, this->inv_scale, this->inv_scale,
+                                         0.0f, 0.0f, 0.0f);
+                this->s1.signedDistChunk(txs, tys, tzs, out, n);
+                Kernels::scaleInPlace(out, n, this->scale);
+            }
+
+            IGE dynamic() const {
+                return IGE(new GUniformScale(this->s1.dynamic(), this->scale));
+            }
+        };
+
+
+        /*
+         * GStatic - a static model in the expression tree. Distances are computed by the inlined model, the
+         * equivalent dynamic tree is kept for the other operations
+         */
+
+        template<typename S>
+        class GStatic : public InnerGeometricExpression {
+            const S shape;
+            const IGE source;
+        public:
+            GStatic(const S& shape) : shape(shape), source(shape.dynamic()) { }
+
+            virtual float signedDist(const falg::Vec3& pos) const {
+                return this->shape.signedDist(pos);
+            }
+
+            virtual float signedDistGrad(const falg::Vec3& pos, falg::Vec3& grad) const {
+                return this->source->signedDistGrad(pos, grad);
+            }
+
+            virtual void signedDistBatch(const float* xs, const float* ys, const float* zs,
+                                         float* out, size_t n) const {
+                for (size_t base = 0; base < n; base += batch_chunk_size) {
+                    size_t m = std::min(batch_chunk_size, n - base);
+                    this->shape.signedDistChunk(xs + base, ys + base, zs + base, out + base, m);
+                }
+            }
+
+            virtual Interval signedDistInterval(const IntervalBox& box) const {
+                return this->source->signedDistInterval(box);
+            }
+
+            virtual IGE specialize(const IGE& self, const IntervalBox& box, Interval& range) const {
+                IGE specialized = this->source->specialize(this->source, box, range);
+                return specialized == this->source ? self : specialized;
+            }
+
+            virtual bool bounds(falg::Vec3& min, falg::Vec3& max) const {
+                return this->source->bounds(min, max);
+            }
+        };
+    };
+};
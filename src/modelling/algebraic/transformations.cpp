@@ -1,4 +1,8 @@
 #include "transformations.hpp"
+#include "kernels.hpp"
+#include "compiled.hpp"
+#include "expression_pool.hpp"
+#include "simplifier.hpp"
 
 namespace generelle {
 
@@ -12,18 +16,185 @@ namespace generelle {
         return this->s1->signedDist(pos - this->translation);
     }
 
+    float GTranslate::signedDistGrad(const falg::Vec3& pos, falg::Vec3& grad) const {
+        return this->s1->signedDistGrad(pos - this->translation, grad);
+    }
+
+    void GTranslate::signedDistBatch(const float* xs, const float* ys, const float* zs,
+                                     float* out, size_t n) const {
+        float txs[batch_chunk_size], tys[batch_chunk_size], tzs[batch_chunk_size];
+        for (size_t base = 0; base < n; base += batch_chunk_size) {
+            size_t m = std::min(batch_chunk_size, n - base);
+            Kernels::transformPoints(xs + base, ys + base, zs + base, txs, tys, tzs, m,
+                                     1.0f, 1.0f, 1.0f,
+                                     - this->translation.x(), - this->translation.y(), - this->translation.z());
+            this->s1->signedDistBatch(txs, tys, tzs, out + base, m);
+        }
+    }
+
+    Interval GTranslate::signedDistInterval(const IntervalBox& box) const {
+        return this->s1->signedDistInterval(box.transformed(falg::Vec3(1.0f, 1.0f, 1.0f), - this->translation));
+    }
+
+    IGE GTranslate::specialize(const IGE& self, const IntervalBox& box, Interval& range) const {
+        Interval r1;
+        IGE n1 = this->s1->specialize(this->s1, box.transformed(falg::Vec3(1.0f, 1.0f, 1.0f), - this->translation), r1);
+        range = r1;
+
+        if (n1 == this->s1) {
+            return self;
+        }
+        return IGE(new GTranslate(n1, this->translation));
+    }
+
+    IGE GTranslate::deduplicate(const IGE& self, ExpressionPool& pool) const {
+        IGE n1 = pool.deduplicate(this->s1);
+        IGE node = n1 == this->s1 ? self : IGE(new GTranslate(n1, this->translation));
+        const falg::Vec3& t = this->translation;
+        return pool.intern(node, NodeKey(typeid(GTranslate), { t.x(), t.y(), t.z() }, { n1 }));
+    }
+
+    IGE GTranslate::simplify(const IGE&, Simplifier& simplifier) const {
+        return GAffine::compose(simplifier.simplify(this->s1), 1.0f, this->translation);
+    }
+
+    int GTranslate::compile(TapeBuilder& builder, int pos) const {
+        int npos = builder.emitTransform(pos, falg::Vec3(1.0f, 1.0f, 1.0f), - this->translation);
+        return builder.compile(this->s1.get(), npos);
+    }
+
+    bool GTranslate::bounds(falg::Vec3& min, falg::Vec3& max) const {
+        if (!this->s1->bounds(min, max)) {
+            return false;
+        }
+
+        min += this->translation;
+        max += this->translation;
+        return true;
+    }
+
+
     /*
      * GNonUniformScale member functions
      */
 
     GNonUniformScale::GNonUniformScale(const IGE& s1, const falg::Vec3& scale)
-        : s1(s1),
+        : s1(s1), scale(scale),
           inv_scale(falg::Vec3(1.0f / scale.x(), 1.0f / scale.y(), 1.0f / scale.z())), scale_norm(scale.norm()) { }
 
+    Interval GNonUniformScale::backScaleRange() const {
+        // The back scale factor |p| / |p * inv_scale| always lies between the smallest and largest scale
+        float abs_x = std::abs(this->scale.x()), abs_y = std::abs(this->scale.y()), abs_z = std::abs(this->scale.z());
+        return Interval(std::min(std::min(abs_x, abs_y), abs_z), std::max(std::max(abs_x, abs_y), abs_z));
+    }
+
     float GNonUniformScale::signedDist(const falg::Vec3& pos) const {
         falg::Vec3 npos = pos * this->inv_scale;
-        float back_scale = sqrtf(pos.sqNorm() / npos.sqNorm());
-        return back_scale * this->s1->signedDist(pos * this->inv_scale);
+        float back_scale = Kernels::backScale(pos.x(), pos.y(), pos.z(), npos.x(), npos.y(), npos.z(),
+                                              Kernels::backScaleAtOrigin(this->scale.x(), this->scale.y(), this->scale.z()));
+        return back_scale * this->s1->signedDist(npos);
+    }
+
+    float GNonUniformScale::signedDistGrad(const falg::Vec3& pos, falg::Vec3& grad) const {
+        falg::Vec3 npos = pos * this->inv_scale;
+        float back_scale = Kernels::backScale(pos.x(), pos.y(), pos.z(), npos.x(), npos.y(), npos.z(),
+                                              Kernels::backScaleAtOrigin(this->scale.x(), this->scale.y(), this->scale.z()));
+
+        falg::Vec3 grad1;
+        float c1 = this->s1->signedDistGrad(npos, grad1);
+
+        // Product rule, with the gradient of the back scale factor sqrt(|p|^2 / |p * inv_scale|^2)
+        float nsq = npos.sqNorm();
+        falg::Vec3 grad_back_scale(0.0f, 0.0f, 0.0f);
+        if (nsq > 0) {
+            grad_back_scale = (pos - back_scale * back_scale * npos * this->inv_scale) / (back_scale * nsq);
+        }
+
+        grad = back_scale * grad1 * this->inv_scale + c1 * grad_back_scale;
+        return back_scale * c1;
+    }
+
+    void GNonUniformScale::signedDistBatch(const float* xs, const float* ys, const float* zs,
+                                           float* out, size_t n) const {
+        float txs[batch_chunk_size], tys[batch_chunk_size], tzs[batch_chunk_size];
+        for (size_t base = 0; base < n; base += batch_chunk_size) {
+            size_t m = std::min(batch_chunk_size, n - base);
+            Kernels::transformPoints(xs + base, ys + base, zs + base, txs, tys, tzs, m,
+                                     this->inv_scale.x(), this->inv_scale.y(), this->inv_scale.z(),
+                                     0.0f, 0.0f, 0.0f);
+            this->s1->signedDistBatch(txs, tys, tzs, out + base, m);
+            Kernels::backScaleInPlace(xs + base, ys + base, zs + base, txs, tys, tzs, out + base, m,
+                                      Kernels::backScaleAtOrigin(this->scale.x(), this->scale.y(), this->scale.z()));
+        }
+    }
+
+    Interval GNonUniformScale::signedDistInterval(const IntervalBox& box) const {
+        Interval c1 = this->s1->signedDistInterval(box.transformed(this->inv_scale, falg::Vec3(0.0f, 0.0f, 0.0f)));
+        return c1 * this->backScaleRange();
+    }
+
+    IGE GNonUniformScale::specialize(const IGE& self, const IntervalBox& box, Interval& range) const {
+        Interval r1;
+        IGE n1 = this->s1->specialize(this->s1, box.transformed(this->inv_scale, falg::Vec3(0.0f, 0.0f, 0.0f)), r1);
+        range = r1 * this->backScaleRange();
+
+        if (n1 == this->s1) {
+            return self;
+        }
+        return IGE(new GNonUniformScale(n1, this->scale));
+    }
+
+    IGE GNonUniformScale::deduplicate(const IGE& self, ExpressionPool& pool) const {
+        IGE n1 = pool.deduplicate(this->s1);
+        IGE node = n1 == this->s1 ? self : IGE(new GNonUniformScale(n1, this->scale));
+        return pool.intern(node, NodeKey(typeid(GNonUniformScale),
+                                         { this->scale.x(), this->scale.y(), this->scale.z() }, { n1 }));
+    }
+
+    IGE GNonUniformScale::simplify(const IGE& self, Simplifier& simplifier) const {
+        IGE n1 = simplifier.simplify(this->s1);
+
+        // Since the distance is brought back by the ratio of point lengths, nested scales multiply. This holds for
+        // uniform scales too, unless they are negative and flip the sign
+        const GNonUniformScale* nested = dynamic_cast<const GNonUniformScale*>(n1.get());
+        if (nested) {
+            return IGE(new GNonUniformScale(nested->s1, nested->scale * this->scale));
+        }
+
+        const GAffine* affine = dynamic_cast<const GAffine*>(n1.get());
+        if (affine && affine->scale > 0 && affine->translation.x() == 0 &&
+            affine->translation.y() == 0 && affine->translation.z() == 0) {
+            return IGE(new GNonUniformScale(affine->s1, affine->scale * this->scale));
+        }
+
+        float x = this->scale.x();
+        if (x > 0 && x == this->scale.y() && x == this->scale.z()) {
+            return GAffine::compose(n1, x, falg::Vec3(0.0f, 0.0f, 0.0f));
+        }
+
+        if (n1 == this->s1) {
+            return self;
+        }
+        return IGE(new GNonUniformScale(n1, this->scale));
+    }
+
+    int GNonUniformScale::compile(TapeBuilder& builder, int pos) const {
+        int npos = builder.emitTransform(pos, this->inv_scale, falg::Vec3(0.0f, 0.0f, 0.0f));
+        int c1 = builder.compile(this->s1.get(), npos);
+        return builder.emitBackScale(c1, pos, npos, Kernels::backScaleAtOrigin(this->scale.x(), this->scale.y(), this->scale.z()));
+    }
+
+    bool GNonUniformScale::bounds(falg::Vec3& min, falg::Vec3& max) const {
+        // With different scales, the distance may shrink by more than the box, except when only signs differ
+        float abs_x = std::abs(this->scale.x());
+        if (abs_x != std::abs(this->scale.y()) || abs_x != std::abs(this->scale.z()) || !this->s1->bounds(min, max)) {
+            return false;
+        }
+
+        falg::Vec3 a = min * this->scale, b = max * this->scale;
+        min = falg::Vec3(std::min(a.x(), b.x()), std::min(a.y(), b.y()), std::min(a.z(), b.z()));
+        max = falg::Vec3(std::max(a.x(), b.x()), std::max(a.y(), b.y()), std::max(a.z(), b.z()));
+        return true;
     }
 
 
@@ -36,4 +207,170 @@ namespace generelle {
     float GUniformScale::signedDist(const falg::Vec3& pos) const {
         return this->scale * this->s1->signedDist(this->inv_scale * pos);
     }
+
+    float GUniformScale::signedDistGrad(const falg::Vec3& pos, falg::Vec3& grad) const {
+        float dist = this->s1->signedDistGrad(this->inv_scale * pos, grad);
+        grad = this->scale * this->inv_scale * grad;
+        return this->scale * dist;
+    }
+
+    void GUniformScale::signedDistBatch(const float* xs, const float* ys, const float* zs,
+                                        float* out, size_t n) const {
+        float txs[batch_chunk_size], tys[batch_chunk_size], tzs[batch_chunk_size];
+        for (size_t base = 0; base < n; base += batch_chunk_size) {
+            size_t m = std::min(batch_chunk_size, n - base);
+            Kernels::transformPoints(xs + base, ys + base, zs + base, txs, tys, tzs, m,
+                                     this->inv_scale, this->inv_scale, this->inv_scale,
+                                     0.0f, 0.0f, 0.0f);
+            this->s1->signedDistBatch(txs, tys, tzs, out + base, m);
+            Kernels::scaleInPlace(out + base, m, this->scale);
+        }
+    }
+
+    Interval GUniformScale::signedDistInterval(const IntervalBox& box) const {
+        falg::Vec3 inv(this->inv_scale, this->inv_scale, this->inv_scale);
+        return this->s1->signedDistInterval(box.transformed(inv, falg::Vec3(0.0f, 0.0f, 0.0f))) * this->scale;
+    }
+
+    IGE GUniformScale::specialize(const IGE& self, const IntervalBox& box, Interval& range) const {
+        Interval r1;
+        falg::Vec3 inv(this->inv_scale, this->inv_scale, this->inv_scale);
+        IGE n1 = this->s1->specialize(this->s1, box.transformed(inv, falg::Vec3(0.0f, 0.0f, 0.0f)), r1);
+        range = r1 * this->scale;
+
+        if (n1 == this->s1) {
+            return self;
+        }
+        return IGE(new GUniformScale(n1, this->scale));
+    }
+
+    IGE GUniformScale::deduplicate(const IGE& self, ExpressionPool& pool) const {
+        IGE n1 = pool.deduplicate(this->s1);
+        IGE node = n1 == this->s1 ? self : IGE(new GUniformScale(n1, this->scale));
+        return pool.intern(node, NodeKey(typeid(GUniformScale), { this->scale }, { n1 }));
+    }
+
+    IGE GUniformScale::simplify(const IGE&, Simplifier& simplifier) const {
+        return GAffine::compose(simplifier.simplify(this->s1), this->scale, falg::Vec3(0.0f, 0.0f, 0.0f));
+    }
+
+    int GUniformScale::compile(TapeBuilder& builder, int pos) const {
+        int npos = builder.emitTransform(pos, falg::Vec3(this->inv_scale, this->inv_scale, this->inv_scale),
+                                         falg::Vec3(0.0f, 0.0f, 0.0f));
+        int c1 = builder.compile(this->s1.get(), npos);
+        return builder.emitAffine(c1, this->scale, 0.0f);
+    }
+
+    bool GUniformScale::bounds(falg::Vec3& min, falg::Vec3& max) const {
+        // A negative scale turns the shape inside out
+        if (this->scale <= 0 || !this->s1->bounds(min, max)) {
+            return false;
+        }
+
+        min = min * this->scale;
+        max = max * this->scale;
+        return true;
+    }
+
+
+    /*
+     * GAffine member functions
+     */
+
+    GAffine::GAffine(const IGE& s1, float scale, const falg::Vec3& translation)
+        : s1(s1), scale(scale), inv_scale(1.0f / scale), translation(translation),
+          offset(- this->inv_scale * translation) { }
+
+    IGE GAffine::compose(const IGE& node, float scale, const falg::Vec3& translation) {
+        // Scaling by a, translating by t, then scaling by b and translating by u,
+        // equals scaling by a * b and translating by b * t + u
+        const GAffine* affine = dynamic_cast<const GAffine*>(node.get());
+        if (affine) {
+            return GAffine::compose(affine->s1, affine->scale * scale, scale * affine->translation + translation);
+        }
+
+        bool translated = translation.x() != 0 || translation.y() != 0 || translation.z() != 0;
+
+        // A positive uniform scale merges into a non-uniform one, see GNonUniformScale::simplify
+        const GNonUniformScale* non_uniform = dynamic_cast<const GNonUniformScale*>(node.get());
+        if (non_uniform && !translated && scale > 0) {
+            return IGE(new GNonUniformScale(non_uniform->s1, non_uniform->scale * scale));
+        }
+
+        if (!translated && scale == 1.0f) {
+            return node;
+        }
+        return IGE(new GAffine(node, scale, translation));
+    }
+
+    float GAffine::signedDist(const falg::Vec3& pos) const {
+        return this->scale * this->s1->signedDist(this->inv_scale * pos + this->offset);
+    }
+
+    float GAffine::signedDistGrad(const falg::Vec3& pos, falg::Vec3& grad) const {
+        float dist = this->s1->signedDistGrad(this->inv_scale * pos + this->offset, grad);
+        grad = this->scale * this->inv_scale * grad;
+        return this->scale * dist;
+    }
+
+    void GAffine::signedDistBatch(const float* xs, const float* ys, const float* zs,
+                                  float* out, size_t n) const {
+        float txs[batch_chunk_size], tys[batch_chunk_size], tzs[batch_chunk_size];
+        for (size_t base = 0; base < n; base += batch_chunk_size) {
+            size_t m = std::min(batch_chunk_size, n - base);
+            Kernels::transformPoints(xs + base, ys + base, zs + base, txs, tys, tzs, m,
+                                     this->inv_scale, this->inv_scale, this->inv_scale,
+                                     this->offset.x(), this->offset.y(), this->offset.z());
+            this->s1->signedDistBatch(txs, tys, tzs, out + base, m);
+            Kernels::scaleInPlace(out + base, m, this->scale);
+        }
+    }
+
+    Interval GAffine::signedDistInterval(const IntervalBox& box) const {
+        falg::Vec3 inv(this->inv_scale, this->inv_scale, this->inv_scale);
+        return this->s1->signedDistInterval(box.transformed(inv, this->offset)) * this->scale;
+    }
+
+    IGE GAffine::specialize(const IGE& self, const IntervalBox& box, Interval& range) const {
+        Interval r1;
+        falg::Vec3 inv(this->inv_scale, this->inv_scale, this->inv_scale);
+        IGE n1 = this->s1->specialize(this->s1, box.transformed(inv, this->offset), r1);
+        range = r1 * this->scale;
+
+        if (n1 == this->s1) {
+            return self;
+        }
+        return IGE(new GAffine(n1, this->scale, this->translation));
+    }
+
+    IGE GAffine::deduplicate(const IGE& self, ExpressionPool& pool) const {
+        IGE n1 = pool.deduplicate(this->s1);
+        IGE node = n1 == this->s1 ? self : IGE(new GAffine(n1, this->scale, this->translation));
+        const falg::Vec3& t = this->translation;
+        return pool.intern(node, NodeKey(typeid(GAffine), { this->scale, t.x(), t.y(), t.z() }, { n1 }));
+    }
+
+    IGE GAffine::simplify(const IGE&, Simplifier& simplifier) const {
+        return GAffine::compose(simplifier.simplify(this->s1), this->scale, this->translation);
+    }
+
+    int GAffine::compile(TapeBuilder& builder, int pos) const {
+        int npos = builder.emitTransform(pos, falg::Vec3(this->inv_scale, this->inv_scale, this->inv_scale),
+                                         this->offset);
+        int c1 = builder.compile(this->s1.get(), npos);
+        if (this->scale == 1.0f) {
+            return c1;
+        }
+        return builder.emitAffine(c1, this->scale, 0.0f);
+    }
+
+    bool GAffine::bounds(falg::Vec3& min, falg::Vec3& max) const {
+        if (this->scale <= 0 || !this->s1->bounds(min, max)) {
+            return false;
+        }
+
+        min = min * this->scale + this->translation;
+        max = max * this->scale + this->translation;
+        return true;
+    }
 };
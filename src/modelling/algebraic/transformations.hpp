@@ -17,6 +17,15 @@ namespace generelle {
         GTranslate(const IGE& s1, const falg::Vec3& d);
 
         virtual float signedDist(const falg::Vec3& pos) const;
+        virtual float signedDistGrad(const falg::Vec3& pos, falg::Vec3& grad) const;
+        virtual void signedDistBatch(const float* xs, const float* ys, const float* zs,
+                                     float* out, size_t n) const;
+        virtual Interval signedDistInterval(const IntervalBox& box) const;
+        virtual IGE specialize(const IGE& self, const IntervalBox& box, Interval& range) const;
+        virtual IGE deduplicate(const IGE& self, ExpressionPool& pool) const;
+        virtual IGE simplify(const IGE& self, Simplifier& simplifier) const;
+        virtual int compile(TapeBuilder& builder, int pos) const;
+        virtual bool bounds(falg::Vec3& min, falg::Vec3& max) const;
     };
 
 
@@ -26,13 +35,27 @@ namespace generelle {
 
     class GNonUniformScale : public InnerGeometricExpression {
         const IGE s1;
-        falg::Vec3 inv_scale;
+        falg::Vec3 scale, inv_scale;
         float scale_norm;
 
+        // Range of the factor that brings distances back from scaled space
+        Interval backScaleRange() const;
+
+        friend class GAffine;
+
     public:
         GNonUniformScale(const IGE& s1, const falg::Vec3& scale);
 
         virtual float signedDist(const falg::Vec3& pos) const;
+        virtual float signedDistGrad(const falg::Vec3& pos, falg::Vec3& grad) const;
+        virtual void signedDistBatch(const float* xs, const float* ys, const float* zs,
+                                     float* out, size_t n) const;
+        virtual Interval signedDistInterval(const IntervalBox& box) const;
+        virtual IGE specialize(const IGE& self, const IntervalBox& box, Interval& range) const;
+        virtual IGE deduplicate(const IGE& self, ExpressionPool& pool) const;
+        virtual IGE simplify(const IGE& self, Simplifier& simplifier) const;
+        virtual int compile(TapeBuilder& builder, int pos) const;
+        virtual bool bounds(falg::Vec3& min, falg::Vec3& max) const;
     };
 
 
@@ -47,5 +70,47 @@ namespace generelle {
         GUniformScale(const IGE& s1, float scale);
 
         virtual float signedDist(const falg::Vec3& pos) const;
+        virtual float signedDistGrad(const falg::Vec3& pos, falg::Vec3& grad) const;
+        virtual void signedDistBatch(const float* xs, const float* ys, const float* zs,
+                                     float* out, size_t n) const;
+        virtual Interval signedDistInterval(const IntervalBox& box) const;
+        virtual IGE specialize(const IGE& self, const IntervalBox& box, Interval& range) const;
+        virtual IGE deduplicate(const IGE& self, ExpressionPool& pool) const;
+        virtual IGE simplify(const IGE& self, Simplifier& simplifier) const;
+        virtual int compile(TapeBuilder& builder, int pos) const;
+        virtual bool bounds(falg::Vec3& min, falg::Vec3& max) const;
+    };
+
+
+    /*
+     * GAffine - uniformly scales the model, then translates it. Chains of translations and uniform scales are folded
+     * into one of these by simplification
+     */
+
+    class GAffine : public InnerGeometricExpression {
+        const IGE s1;
+        float scale, inv_scale;
+        falg::Vec3 translation;
+
+        // Added to points after scaling by inv_scale, undoing the translation
+        falg::Vec3 offset;
+    public:
+        GAffine(const IGE& s1, float scale, const falg::Vec3& translation);
+
+        // Applies the scale and translation to node, merged with the transformation at the top of node if possible
+        static IGE compose(const IGE& node, float scale, const falg::Vec3& translation);
+
+        virtual float signedDist(const falg::Vec3& pos) const;
+        virtual float signedDistGrad(const falg::Vec3& pos, falg::Vec3& grad) const;
+        virtual void signedDistBatch(const float* xs, const float* ys, const float* zs,
+                                     float* out, size_t n) const;
+        virtual Interval signedDistInterval(const IntervalBox& box) const;
+        virtual IGE specialize(const IGE& self, const IntervalBox& box, Interval& range) const;
+        virtual IGE deduplicate(const IGE& self, ExpressionPool& pool) const;
+        virtual IGE simplify(const IGE& self, Simplifier& simplifier) const;
+        virtual int compile(TapeBuilder& builder, int pos) const;
+        virtual bool bounds(falg::Vec3& min, falg::Vec3& max) const;
+
+        friend class GNonUniformScale;
     };
 };
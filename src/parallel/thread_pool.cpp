@@ -0,0 +1,145 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+
+namespace generelle {
+
+    // The pool and worker slot of the current thread, used to route submissions to the submitter's own deque
+    static thread_local const ThreadPool* current_pool = nullptr;
+    static thread_local int current_index = 0;
+
+
+    /*
+     * ThreadPool member functions
+     */
+
+    ThreadPool::ThreadPool(int num_threads) : queued(0), pending(0), stopping(false) {
+        num_threads = std::max(num_threads, 1);
+
+        // Slot 0 belongs to the thread calling wait()
+        for (int i = 0; i < num_threads; i++) {
+            this->workers.push_back(std::unique_ptr<Worker>(new Worker()));
+        }
+
+        for (int i = 1; i < num_threads; i++) {
+            this->threads.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+        }
+    }
+
+    ThreadPool::~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(this->state_mutex);
+            this->stopping = true;
+        }
+        this->state_changed.notify_all();
+
+        for (std::thread& thread : this->threads) {
+            thread.join();
+        }
+    }
+
+    int ThreadPool::getNumThreads() const {
+        return this->workers.size();
+    }
+
+    void ThreadPool::submit(const std::function<void()>& task) {
+        int index = current_pool == this ? current_index : 0;
+
+        this->pending++;
+        {
+            std::lock_guard<std::mutex> lock(this->workers[index]->mutex);
+            this->workers[index]->tasks.push_back(task);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(this->state_mutex);
+            this->queued++;
+        }
+        this->state_changed.notify_one();
+    }
+
+    bool ThreadPool::runOneTask(int index) {
+        std::function<void()> task;
+        int num_workers = this->workers.size();
+
+        for (int i = 0; i < num_workers && !task; i++) {
+            Worker& worker = *this->workers[(index + i) % num_workers];
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            if (worker.tasks.empty()) {
+                continue;
+            }
+
+            if (i == 0) {
+                // Own deque, newest first for locality
+                task = std::move(worker.tasks.back());
+                worker.tasks.pop_back();
+            } else {
+                // Steal the oldest task, which tends to be the largest
+                task = std::move(worker.tasks.front());
+                worker.tasks.pop_front();
+            }
+        }
+
+        if (!task) {
+            return false;
+        }
+
+        this->queued--;
+        task();
+
+        if (--this->pending == 0) {
+            std::lock_guard<std::mutex> lock(this->state_mutex);
+            this->state_changed.notify_all();
+        }
+        return true;
+    }
+
+    void ThreadPool::workerLoop(int index) {
+        current_pool = this;
+        current_index = index;
+
+        while (true) {
+            if (this->runOneTask(index)) {
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(this->state_mutex);
+            this->state_changed.wait(lock, [this] { return this->stopping || this->queued > 0; });
+            if (this->stopping) {
+                return;
+            }
+        }
+    }
+
+    void ThreadPool::wait() {
+        const ThreadPool* previous_pool = current_pool;
+        int previous_index = current_index;
+        current_pool = this;
+        current_index = 0;
+
+        while (true) {
+            if (this->runOneTask(0)) {
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(this->state_mutex);
+            if (this->pending == 0) {
+                break;
+            }
+            this->state_changed.wait(lock, [this] { return this->pending == 0 || this->queued > 0; });
+        }
+
+        current_pool = previous_pool;
+        current_index = previous_index;
+    }
+
+    void ThreadPool::parallelFor(size_t begin, size_t end, size_t grain,
+                                 const std::function<void(size_t, size_t)>& fn) {
+        grain = std::max(grain, (size_t)1);
+        for (size_t chunk_begin = begin; chunk_begin < end; chunk_begin += grain) {
+            size_t chunk_end = std::min(chunk_begin + grain, end);
+            this->submit([&fn, chunk_begin, chunk_end] { fn(chunk_begin, chunk_end); });
+        }
+        this->wait();
+    }
+};
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace generelle {
+
+    /*
+     * ThreadPool - a work-stealing pool. Every thread owns a deque of tasks, pushes and pops its own
+     * tasks at the back, and steals from the front of other deques when its own is empty
+     *
+     * The thread calling wait() takes part in the work, so a pool with one thread runs everything
+     * on the calling thread. Tasks may submit more tasks
+     */
+
+    class ThreadPool {
+        struct Worker {
+            std::deque<std::function<void()>> tasks;
+            std::mutex mutex;
+        };
+
+        std::vector<std::unique_ptr<Worker>> workers;
+        std::vector<std::thread> threads;
+
+        std::mutex state_mutex;
+        std::condition_variable state_changed;
+        std::atomic<int> queued;
+        std::atomic<int> pending;
+        bool stopping;
+
+        bool runOneTask(int index);
+        void workerLoop(int index);
+
+    public:
+        ThreadPool(int num_threads);
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        int getNumThreads() const;
+
+        void submit(const std::function<void()>& task);
+
+        // Runs tasks on the calling thread until every submitted task has finished
+        void wait();
+
+        // Calls fn(chunk_begin, chunk_end) on consecutive chunks of at most grain elements and waits for all
+        // The chunking does not depend on the number of threads
+        void parallelFor(size_t begin, size_t end, size_t grain,
+                         const std::function<void(size_t, size_t)>& fn);
+    };
+};
@@ -1,6 +1,10 @@
 #include "visualization.hpp"
 
+#include "../parallel/thread_pool.hpp"
+
+#include <algorithm>
 #include <iostream>
+#include <vector>
 
 namespace generelle {
     
@@ -14,30 +18,76 @@ namespace generelle {
      * Visualization static methods
      */
     
+    // Rays marched together through batched distance evaluation
+    static const int packet_size = 8;
+
+    // Packets with this many active rays or fewer are finished one ray at a time
+    static const int packet_scalar_tail = 2;
+
+    static const int max_march_steps = 100;
+    static const float march_epsilon = 1e-3;
+    static const float march_escape = 100;
+
+    // Cone marching splits blocks until they are at most this many pixels wide and high
+    static const int cone_leaf_size = 8;
+
+    Visualization::MarchState Visualization::startMarch(float t, float relaxation) {
+        MarchState state;
+        state.t = t;
+        state.dist = 1e9;
+        state.omega = relaxation;
+        state.prev_dist = 0.0f;
+        state.prev_step = 0.0f;
+        return state;
+    }
+
+    // Advances the march given the distance at the current point, returns whether the ray is done
+    bool Visualization::marchStep(MarchState& state, float dist) {
+        if (state.omega > 1 && std::abs(dist) + state.prev_dist < state.prev_step) {
+            // The empty spheres at the last two points do not overlap, so the over-relaxed step may have
+            // passed the surface. Fall back to the plain step from the previous point, and stop relaxing
+            state.t += state.prev_dist - state.prev_step;
+            state.omega = 1;
+            state.prev_step = 0;
+            return false;
+        }
+
+        float step = dist < march_epsilon ? dist : dist * state.omega;
+        state.dist = dist;
+        state.t += step;
+        state.prev_dist = std::abs(dist);
+        state.prev_step = step;
+
+        return dist < march_epsilon || state.t > march_escape;
+    }
+
     Visualization::RayMarchResult Visualization::rayMarch(const Ray& ray, const GE& geom) {
+        return continueRayMarch(ray, geom, startMarch(0.0f, 1.0f), 0);
+    }
 
-        float eps = 1e-3;
-        
-        float t = 0;
-        falg::Vec3 currPos = ray.origin + ray.dir * t;
-        float dist = 1e9;
-        for (int i = 0; i < 100; i++) {
-            dist = geom.signedDist(currPos);
-            t += dist; // * 1.2f;
-            currPos = ray.origin + ray.dir * t;
-
-            if (dist < eps || t > 100) {
+    // Continues marching a ray that has taken step steps
+    Visualization::RayMarchResult Visualization::continueRayMarch(const Ray& ray, const GE& geom,
+                                                                  MarchState state, int step) {
+
+        for (int i = step; i < max_march_steps; i++) {
+            falg::Vec3 currPos = ray.origin + ray.dir * state.t;
+            if (marchStep(state, geom.signedDist(currPos))) {
                 break;
             }
         }
 
+        return rayMarchResult(ray, geom, state.t, state.dist);
+    }
+
+    Visualization::RayMarchResult Visualization::rayMarchResult(const Ray& ray, const GE& geom, float t, float dist) {
+
         Visualization::RayMarchResult res;
-        if (dist < eps) {
+        if (dist < march_epsilon) {
             res.hit = true;
             res.color = falg::Vec3(1.0f, 1.0f, 1.0f);
             res.t = t;
-            res.pos = currPos;
-            res.normal = geom.normal(currPos);
+            res.pos = ray.origin + ray.dir * t;
+            res.normal = geom.normal(res.pos);
         } else {
             res.hit = false;
             res.color = falg::Vec3(0.0f, 0.0f, 0.0f);
@@ -47,21 +97,144 @@ namespace generelle {
         return res;
     }
 
-    unsigned char* Visualization::visualize(const GE& expr, int width, int height) {
+    // Marches up to packet_size rays in lockstep from t_start. Every step evaluates the distance for all active rays
+    // in one batch, rays leave the packet as they hit or escape. Gives the same results as marching each ray alone
+    void Visualization::rayMarchPacket(const Ray* rays, int count, const GE& geom,
+                                       float t_start, float relaxation, RayMarchResult* results) {
+
+        MarchState states[packet_size];
+        int active[packet_size];
+        int num_active = count;
+
+        for (int l = 0; l < count; l++) {
+            states[l] = startMarch(t_start, relaxation);
+            active[l] = l;
+        }
+
+        float xs[packet_size], ys[packet_size], zs[packet_size], batch_dists[packet_size];
+
+        int step = 0;
+        for (; step < max_march_steps && num_active > packet_scalar_tail; step++) {
+            for (int a = 0; a < num_active; a++) {
+                const Ray& ray = rays[active[a]];
+                float t = states[active[a]].t;
+                xs[a] = ray.origin.x() + ray.dir.x() * t;
+                ys[a] = ray.origin.y() + ray.dir.y() * t;
+                zs[a] = ray.origin.z() + ray.dir.z() * t;
+            }
+
+            geom.signedDistBatch(xs, ys, zs, batch_dists, num_active);
+
+            // Update and compact the active rays
+            int num_remaining = 0;
+            for (int a = 0; a < num_active; a++) {
+                int l = active[a];
+                if (!marchStep(states[l], batch_dists[a])) {
+                    active[num_remaining++] = l;
+                }
+            }
+            num_active = num_remaining;
+        }
+
+        bool finished[packet_size] = { };
+        for (int a = 0; a < num_active; a++) {
+            int l = active[a];
+            results[l] = continueRayMarch(rays[l], geom, states[l], step);
+            finished[l] = true;
+        }
+
+        for (int l = 0; l < count; l++) {
+            if (!finished[l]) {
+                results[l] = rayMarchResult(rays[l], geom, states[l].t, states[l].dist);
+            }
+        }
+    }
+
+    // Marches the cone around the rays of pixel rows [i0, i1) and columns [j0, j1) from t, and returns a distance
+    // that every ray in the block can safely start marching from
+    float Visualization::coneMarch(const GE& expr, const Camera& camera, int width, int height,
+                                   int i0, int j0, int i1, int j1, float t) {
+        Ray axis = primaryRay(camera, (i0 + i1 - 1) / 2.0f, (j0 + j1 - 1) / 2.0f, width, height);
+
+        // Largest distance between the axis direction and a ray direction in the block, attained at a corner.
+        // At distance t along their rays, all points are within t * spread of the axis point
+        float spread = 0.0f;
+        for (int c = 0; c < 4; c++) {
+            Ray corner = primaryRay(camera, c / 2 ? i1 - 1 : i0, c % 2 ? j1 - 1 : j0, width, height);
+            spread = std::max(spread, (corner.dir - axis.dir).norm());
+        }
+
+        for (int i = 0; i < max_march_steps && t <= march_escape; i++) {
+            float dist = expr.signedDist(axis.origin + axis.dir * t);
 
-        falg::Vec3 campos(-3.0f, 3.0f, -3.0f);
+            // The empty sphere at the axis point covers every ray in the block this far ahead. A ray point at
+            // t + step is within (t + step) * spread of the axis point there, which is step further along the axis
+            float step = (dist - t * spread) / (1.0f + spread);
+            if (step < t * spread) {
+                break;
+            }
+            t += step;
+        }
+
+        return t;
+    }
+
+    // Renders rows [i0, i1) and columns [j0, j1) from t_start, refining the start distance with cones
+    // over quadrants of the block until blocks are small
+    void Visualization::renderBlock(const GE& expr, const Camera& camera, int width, int height,
+                                    int i0, int j0, int i1, int j1, float t_start,
+                                    const RenderSetup& setup, unsigned char* buffer) {
+        if (setup.coneMarching) {
+            t_start = coneMarch(expr, camera, width, height, i0, j0, i1, j1, t_start);
+
+            if (i1 - i0 > cone_leaf_size || j1 - j0 > cone_leaf_size) {
+                int im = (i0 + i1) / 2, jm = (j0 + j1) / 2;
+                int is[3] = { i0, im, i1 }, js[3] = { j0, jm, j1 };
+                for (int q = 0; q < 4; q++) {
+                    int qi0 = is[q / 2], qi1 = is[q / 2 + 1], qj0 = js[q % 2], qj1 = js[q % 2 + 1];
+                    if (qi0 < qi1 && qj0 < qj1) {
+                        renderBlock(expr, camera, width, height, qi0, qj0, qi1, qj1, t_start, setup, buffer);
+                    }
+                }
+                return;
+            }
+        }
+
+        std::vector<Ray> rays;
+        rays.reserve(packet_size);
+        RayMarchResult results[packet_size];
+
+        // Packets are runs of pixels along a row
+        for (int i = i0; i < i1; i++) {
+            for (int j = j0; j < j1; j += packet_size) {
+                int count = std::min(packet_size, j1 - j);
+                rays.clear();
+                for (int l = 0; l < count; l++) {
+                    rays.push_back(primaryRay(camera, i, j + l, width, height));
+                }
+
+                rayMarchPacket(rays.data(), count, expr, t_start, setup.relaxation, results);
+
+                for (int l = 0; l < count; l++) {
+                    shadePixel(results[l], buffer + 4 * (i * width + j + l));
+                }
+            }
+        }
+    }
+
+    Visualization::Camera Visualization::setupCamera(int width, int height) {
+
+        Camera camera;
+        camera.position = falg::Vec3(-3.0f, 3.0f, -3.0f);
         falg::Vec4 cam_up(0.0f, 1.0f, 0.0f, 0.0f);
         falg::Vec4 cam_forward(0.0f, 0.0f, 1.0f, 0.0f);
         falg::Vec4 cam_right(1.0f, 0.0f, 0.0f, 0.0f);
 
-        float width_r = 1.0f;
-        float height_r = (width_r * height) / width;
-
-        unsigned char* ch = new unsigned char[width * height * 4];
+        camera.width_r = 1.0f;
+        camera.height_r = (camera.width_r * height) / width;
 
-        
         falg::Mat4 viewMatrix(falg::FLATALG_MATRIX_LOOK_AT,
-                              campos,
+                              camera.position,
                               falg::Vec3(0.0f, 0.0f, 0.0f),
                               falg::Vec3(0.0f, 1.0f, 0.0f));
         
@@ -72,35 +245,60 @@ namespace generelle {
         falg::Vec4 forward4 = viewMatrix * cam_forward;
         falg::Vec4 right4 = viewMatrix * cam_right;
 
-        falg::Vec3 up = falg::Vec3(up4.x(), up4.y(), up4.z());
-        falg::Vec3 forward = - falg::Vec3(forward4.x(), forward4.y(), forward4.z());
-        falg::Vec3 right = falg::Vec3(right4.x(), right4.y(), right4.z());
-        
-        for (int i = 0; i < height; i++) {
-            for (int j = 0; j < width; j++) {
+        camera.up = falg::Vec3(up4.x(), up4.y(), up4.z());
+        camera.forward = - falg::Vec3(forward4.x(), forward4.y(), forward4.z());
+        camera.right = falg::Vec3(right4.x(), right4.y(), right4.z());
 
-                float width_c = 2 * (j - width / 2 + 0.5f) / width * width_r;
-                float height_c = - 2 * (i - height / 2 + 0.5f) / height * height_r;
+        return camera;
+    }
 
-                Ray ray(campos, forward + up * height_c + right * width_c);
-                ray.dir = ray.dir.normalized();
+    // Ray through the pixel at row i and column j, which may be fractional
+    Ray Visualization::primaryRay(const Camera& camera, float i, float j, int width, int height) {
+        float width_c = 2 * (j - width / 2 + 0.5f) / width * camera.width_r;
+        float height_c = - 2 * (i - height / 2 + 0.5f) / height * camera.height_r;
 
-                RayMarchResult res = rayMarch(ray, expr);
+        Ray ray(camera.position, camera.forward + camera.up * height_c + camera.right * width_c);
+        ray.dir = ray.dir.normalized();
+        return ray;
+    }
 
-                falg::Vec3 color = res.color;
-                if (res.hit) {
-                    falg::Vec3 sun_dir = falg::Vec3(3.0f, -2.0f, 1.0f).normalized();
-                    color = color * std::max(( - falg::dot(sun_dir, res.normal)), 0.0f);
-                }
-                
-                int base_ind = 4 * (i * width + j);
-                for (int k = 0; k < 3; k++) {
-                    ch[base_ind + k] = std::max(std::min(255.0f, color[k] * 255), 0.0f);
-                }
-                ch[base_ind + 3] = 255;
-            }
+    void Visualization::shadePixel(const RayMarchResult& res, unsigned char* pixel) {
+        falg::Vec3 color = res.color;
+        if (res.hit) {
+            falg::Vec3 sun_dir = falg::Vec3(3.0f, -2.0f, 1.0f).normalized();
+            color = color * std::max(( - falg::dot(sun_dir, res.normal)), 0.0f);
         }
 
+        for (int k = 0; k < 3; k++) {
+            pixel[k] = std::max(std::min(255.0f, color[k] * 255), 0.0f);
+        }
+        pixel[3] = 255;
+    }
+
+    void Visualization::render(const GE& expr, int width, int height, unsigned char* buffer,
+                               const RenderSetup& setup) {
+        Camera camera = setupCamera(width, height);
+
+        int tile_size = std::max(setup.tileSize, 1);
+        int tiles_x = (width + tile_size - 1) / tile_size;
+        int tiles_y = (height + tile_size - 1) / tile_size;
+
+        // One task per tile, idle threads steal the remaining tiles
+        ThreadPool pool(std::max(setup.numThreads, 1));
+        pool.parallelFor(0, tiles_x * tiles_y, 1, [&](size_t begin, size_t end) {
+            for (size_t tile = begin; tile < end; tile++) {
+                int i0 = (tile / tiles_x) * tile_size;
+                int j0 = (tile % tiles_x) * tile_size;
+                renderBlock(expr, camera, width, height,
+                            i0, j0, std::min(i0 + tile_size, height), std::min(j0 + tile_size, width), 0.0f,
+                            setup, buffer);
+            }
+        });
+    }
+
+    unsigned char* Visualization::visualize(const GE& expr, int width, int height) {
+        unsigned char* ch = new unsigned char[width * height * 4];
+        render(expr, width, height, ch);
         return ch;
     }
 
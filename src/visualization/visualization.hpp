@@ -16,11 +16,36 @@ namespace generelle {
     };
 
 
+    /*
+     * RenderSetup - options for Visualization::render
+     */
+
+    struct RenderSetup {
+        // Threads rendering tiles, the image is the same for any thread count
+        int numThreads = 1;
+
+        // Tiles are squares of this many pixels per side, handed out to threads as they become idle
+        int tileSize = 16;
+
+        // Seed rays with distances found by marching cones around blocks of pixels
+        bool coneMarching = true;
+
+        // Over-relaxation factor of sphere tracing steps. Steps that overshoot fall back to plain steps
+        float relaxation = 1.3f;
+    };
+
+
     /*
      * Functions for visualization
      */
 
     class Visualization {
+        struct Camera {
+            falg::Vec3 position;
+            falg::Vec3 up, forward, right;
+            float width_r, height_r;
+        };
+
         struct RayMarchResult {
             bool hit;
             float t;
@@ -29,12 +54,42 @@ namespace generelle {
             falg::Vec3 normal;
         };
 
+        struct MarchState {
+            float t, dist;
+
+            // Over-relaxation factor, and the previous distance and step to detect overshooting
+            float omega;
+            float prev_dist, prev_step;
+        };
+
         Visualization() = delete;
 
+        static MarchState startMarch(float t, float relaxation);
+        static bool marchStep(MarchState& state, float dist);
+
         static RayMarchResult rayMarch(const Ray& ray, const GE& geom);
+        static RayMarchResult continueRayMarch(const Ray& ray, const GE& geom, MarchState state, int step);
+        static RayMarchResult rayMarchResult(const Ray& ray, const GE& geom, float t, float dist);
+        static void rayMarchPacket(const Ray* rays, int count, const GE& geom,
+                                   float t_start, float relaxation, RayMarchResult* results);
+
+        static Camera setupCamera(int width, int height);
+        static Ray primaryRay(const Camera& camera, float i, float j, int width, int height);
+        static void shadePixel(const RayMarchResult& res, unsigned char* pixel);
+
+        static float coneMarch(const GE& expr, const Camera& camera, int width, int height,
+                               int i0, int j0, int i1, int j1, float t);
+        static void renderBlock(const GE& expr, const Camera& camera, int width, int height,
+                                int i0, int j0, int i1, int j1, float t_start,
+                                const RenderSetup& setup, unsigned char* buffer);
 
     public:
 
+        // Renders into buffer, which must hold width * height RGBA pixels
+        static void render(const GE& expr, int width, int height, unsigned char* buffer,
+                           const RenderSetup& setup = RenderSetup());
+
+        // Renders into a new buffer, which must be freed with destroyBuffer
         static unsigned char* visualize(const GE& expr, int width, int height);
         static void destroyBuffer(unsigned char* ch);
     };